@@ -3,10 +3,23 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include <cstring>
+#include <iterator>
+#if defined(ANSI_C_MEM_TRACK_THREAD_SAFE) || defined(ANSI_C_MEM_TRACK_THREAD_CACHE)
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
 
 extern "C" {
 #include "include/ansi_c_mem_track.h"
+#ifdef ANSI_C_MEM_TRACK_TRACE
+#include "src/ansi_c_mem_track_trace.h"
+#endif
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+#include "src/ansi_c_mem_track_stack.h"
+#endif
 }
 
 const char* FILENAME = NULL;//FILENAME;
@@ -38,6 +51,17 @@ void test_memory_allocation(size_t block_size, size_t num_blocks) {
     }
     mem_info = ansi_c_mem_track_get_info();
     ansi_c_mem_track_print_info(FILENAME, &mem_info);
+    if (ansi_c_mem_track_get_block_size(block_ptrs[0]) != block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Wrong block size");
+    }
+#if !defined(ANSI_C_MEM_TRACK_INLINE_HEADER) && !defined(ANSI_C_MEM_TRACK_THREAD_CACHE) && !defined(ANSI_C_MEM_TRACK_SAMPLING)
+    // Only the address index can tell a pointer of another allocator without reading in front of it
+    char* untracked = new char[block_size];
+    if (ansi_c_mem_track_get_block_size(untracked) != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Wrong size of an untracked block");
+    }
+    delete[] untracked;
+#endif
 
     ansi_c_mem_track_log_message(FILENAME, "Info", "Free");
     for (size_t i = 0; i < num_blocks; i++) {
@@ -290,9 +314,20 @@ void test_ansi_c_mem_track_free_by_object_id() {
     mem_info=ansi_c_mem_track_get_info();
     ansi_c_mem_track_print_info(FILENAME, &mem_info);
 
+    // check memory usage by object ID
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Check memory usage by object ID");
+    ObjectUsageInfo object_info = ansi_c_mem_track_get_object_info(2);
+    if (object_info.size != 1 || object_info.memory_usage != sizeof(char) * 10) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Object ID memory usage is wrong");
+    }
+
     // free memory blocks by object ID
     ansi_c_mem_track_log_message(FILENAME, "Info", "Free memory blocks by object ID");
     ansi_c_mem_track_free_by_object_id(2);
+    object_info = ansi_c_mem_track_get_object_info(2);
+    if (object_info.size != 0 || object_info.memory_usage != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Object ID memory was not freed");
+    }
 
     // get memory usage information
     mem_info = ansi_c_mem_track_get_info();
@@ -359,11 +394,982 @@ void get_unfreed_blocks_info_test() {
 }
 
 
+#if defined(ANSI_C_MEM_TRACK_THREAD_SAFE) || defined(ANSI_C_MEM_TRACK_THREAD_CACHE)
+/**
+ * @brief Allocates, reallocates and frees memory blocks from `num_threads` threads at once, then verifies that
+ * the counters of the memory tracker are exact. Every thread uses its own object ID, which is taken with
+ * `ansi_c_mem_track_get_next_object_id`, and frees half of its blocks with `ansi_c_mem_track_free_by_object_id`.
+ *
+ * @param num_threads The number of threads.
+ * @param block_size The initial size of each block to be allocated.
+ * @param num_blocks The number of blocks allocated by each thread.
+ */
+void test_multithreaded_stress(size_t num_threads, size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_multithreaded_stress");
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+
+    std::vector<std::thread> threads;
+    std::vector<size_t> object_ids(num_threads);
+    std::vector<size_t> errors(num_threads);
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            size_t object_id = ansi_c_mem_track_get_next_object_id();
+            object_ids[t] = object_id;
+            char** block_ptrs = new char*[num_blocks];
+            for (size_t i = 0; i < num_blocks; i++) {
+                block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_multithreaded_stress() -> block_ptrs[i] memory allocation", "char", object_id);
+                if (!block_ptrs[i]) {
+                    errors[t]++;
+                    continue;
+                }
+                memset(block_ptrs[i], (int)t, block_size);
+            }
+            for (size_t i = 0; i < num_blocks; i++) {
+                char* new_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[i], block_size * 2, object_id);
+                if (!new_ptr || new_ptr[block_size - 1] != (char)t) {
+                    errors[t]++;
+                    continue;
+                }
+                block_ptrs[i] = new_ptr;
+            }
+            for (size_t i = 0; i < num_blocks; i += 2) {
+                ansi_c_mem_track_free(block_ptrs[i]);
+            }
+            ObjectUsageInfo object_info = ansi_c_mem_track_get_object_info(object_id);
+            if (object_info.size != num_blocks / 2 || object_info.memory_usage != num_blocks / 2 * block_size * 2) {
+                errors[t]++;
+            }
+            ansi_c_mem_track_free_by_object_id(object_id);
+            delete[] block_ptrs;
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    MemoryUsageInfo mem_info = ansi_c_mem_track_get_info();
+    ansi_c_mem_track_print_info(FILENAME, &mem_info);
+    for (size_t t = 0; t < num_threads; t++) {
+        for (size_t u = t + 1; u < num_threads; u++) {
+            if (object_ids[t] == object_ids[u]) {
+                errors[t]++;
+            }
+        }
+        if (errors[t]) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Thread reported errors");
+        }
+    }
+    if (mem_info.size != before.size || mem_info.memory_usage != before.memory_usage
+        || mem_info.total_size != before.total_size + num_threads * num_blocks
+        || mem_info.total_user_memory_usage != before.total_user_memory_usage + num_threads * num_blocks * block_size * 2
+        || mem_info.total_freed_memory != before.total_freed_memory + num_threads * num_blocks * block_size * 2) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Counters are wrong after concurrent use");
+    }
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Cleanup allocations");
+    ansi_c_mem_track_cleanup_allocations();
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_multithreaded_stress");
+}
+
+/**
+ * @brief Every thread allocates `num_blocks` blocks, then all threads free the blocks of their neighbour while
+ * the neighbour is still running, so the frees cross threads. Verifies that the counters are exact afterwards.
+ *
+ * @param num_threads The number of threads.
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks allocated by each thread.
+ */
+void test_multithreaded_remote_free(size_t num_threads, size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_multithreaded_remote_free");
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+
+    std::vector<std::vector<char*>> block_ptrs(num_threads, std::vector<char*>(num_blocks));
+    std::atomic<size_t> allocated(0);
+    std::atomic<size_t> freed(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < num_blocks; i++) {
+                block_ptrs[t][i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_multithreaded_remote_free() -> block_ptrs[t][i] memory allocation", "char", 0);
+            }
+            allocated++;
+            while (allocated < num_threads) {
+                std::this_thread::yield();
+            }
+            std::vector<char*>& neighbour_ptrs = block_ptrs[(t + 1) % num_threads];
+            for (size_t i = 0; i < num_blocks; i++) {
+                ansi_c_mem_track_free(neighbour_ptrs[i]);
+            }
+            freed++;
+            while (freed < num_threads) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    MemoryUsageInfo mem_info = ansi_c_mem_track_get_info();
+    ansi_c_mem_track_print_info(FILENAME, &mem_info);
+    if (mem_info.size != before.size || mem_info.memory_usage != before.memory_usage
+        || mem_info.total_size != before.total_size + num_threads * num_blocks
+        || mem_info.total_freed_memory != before.total_freed_memory + num_threads * num_blocks * block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Counters are wrong after cross-thread frees");
+    }
+    size_t info_array_size = 0;
+    ansi_c_mem_track_get_unfreed_blocks_info(&info_array_size);
+    if (info_array_size != mem_info.size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Blocks freed by other threads are still tracked");
+    }
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Cleanup allocations");
+    ansi_c_mem_track_cleanup_allocations();
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_multithreaded_remote_free");
+}
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_SLAB
+/**
+ * @brief Allocates small blocks, which are served by the slab backend, grows them into a larger size class and
+ * frees them again, while verifying the contents of the blocks and the slab statistics.
+ *
+ * @param block_size The initial size of each block, must fit a size class of the slabs.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_slab_backend(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_slab_backend");
+
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_slab_backend() -> block_ptrs[i] memory allocation", "char", 0);
+        if (!block_ptrs[i]) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Slab allocation failed");
+            for (size_t j = 0; j < i; j++) {
+                ansi_c_mem_track_free(block_ptrs[j]);
+            }
+            delete[] block_ptrs;
+            return;
+        }
+        memset(block_ptrs[i], (int)(i & 0x7F), block_size);
+    }
+    MemoryUsageInfo mem_info = ansi_c_mem_track_get_info();
+    if (mem_info.slab_count == 0 || mem_info.slab_memory < num_blocks * block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Small blocks are not served by the slabs");
+    }
+
+    // Growing moves every second block to a larger size class, shrinking back keeps the others in place
+    for (size_t i = 0; i < num_blocks; i++) {
+        size_t new_size = i % 2 ? block_size * 2 : block_size - 1;
+        char* new_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[i], new_size, 0);
+        if (!new_ptr || new_ptr[0] != (char)(i & 0x7F) || new_ptr[block_size - 2] != (char)(i & 0x7F)) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Data is lost by realloc in the slabs");
+            continue;
+        }
+        block_ptrs[i] = new_ptr;
+    }
+
+    for (size_t i = 0; i < num_blocks; i += 2) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    mem_info = ansi_c_mem_track_get_info();
+    ansi_c_mem_track_print_info(FILENAME, &mem_info);
+    if (mem_info.partial_slab_count == 0 || mem_info.slab_free_memory == 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Freed blocks are not returned to their slabs");
+    }
+    for (size_t i = 1; i < num_blocks; i += 2) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_slab_backend");
+}
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_ARENA
+/**
+ * @brief Allocates blocks with the object ID of an arena, grows the last one in place and releases all of them
+ * with `ansi_c_mem_track_free_by_object_id`, while verifying the contents of the blocks and the counters.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_arena(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_arena");
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+
+    size_t object_id = ansi_c_mem_track_create_arena();
+    if (object_id == 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Arena creation failed");
+        return;
+    }
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_arena() -> block_ptrs[i] memory allocation", "char", object_id);
+        if (!block_ptrs[i]) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Arena allocation failed");
+            ansi_c_mem_track_free_by_object_id(object_id);
+            delete[] block_ptrs;
+            return;
+        }
+        memset(block_ptrs[i], (int)(i & 0x7F), block_size);
+    }
+
+    // The last block is the tip of the arena, so it grows in place
+    char* last_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[num_blocks - 1], block_size * 2, object_id);
+    if (last_ptr != block_ptrs[num_blocks - 1]) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The tip of the arena is not grown in place");
+    }
+    block_ptrs[num_blocks - 1] = last_ptr;
+    // Any other block moves
+    char* first_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[0], block_size * 2, object_id);
+    if (!first_ptr || first_ptr[block_size - 1] != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Data is lost by realloc in the arena");
+    }
+    block_ptrs[0] = first_ptr;
+    for (size_t i = 1; i < num_blocks; i++) {
+        if (block_ptrs[i][0] != (char)(i & 0x7F) || block_ptrs[i][block_size - 1] != (char)(i & 0x7F)) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Data integrity check failed in the arena");
+            break;
+        }
+    }
+
+    ObjectUsageInfo object_info = ansi_c_mem_track_get_object_info(object_id);
+    if (object_info.size != num_blocks || object_info.memory_usage != (num_blocks + 2) * block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Arena blocks are not accounted for one by one");
+    }
+    ansi_c_mem_track_free_by_object_id(object_id);
+    delete[] block_ptrs;
+
+    MemoryUsageInfo mem_info = ansi_c_mem_track_get_info();
+    ansi_c_mem_track_print_info(FILENAME, &mem_info);
+    if (mem_info.size != before.size || mem_info.memory_usage != before.memory_usage) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Counters are wrong after the release of the arena");
+    }
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_arena");
+}
+#endif
+
+/**
+ * @brief Logs `num_messages` messages to a file, calls `ansi_c_mem_track_log_flush` and verifies that every
+ * message is in the file. The file stays open between the messages, and with ANSI_C_MEM_TRACK_ASYNC_LOG the
+ * messages are written by the background thread.
+ *
+ * @param num_messages The number of messages to be logged.
+ */
+void test_log_flush(size_t num_messages) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_log_flush");
+    const char* log_file_name = "ansi_c_mem_track_log_test.log";
+    std::remove(log_file_name);
+
+    size_t logged = 0;
+    for (size_t i = 0; i < num_messages; i++) {
+        if (ansi_c_mem_track_log_message(log_file_name, "Info", "test_log_flush() message")) {
+            logged++;
+        }
+    }
+    ansi_c_mem_track_log_flush();
+
+    std::ifstream log_file(log_file_name);
+    std::string line;
+    size_t lines = 0;
+    while (std::getline(log_file, line)) {
+        lines++;
+    }
+    if (logged == 0 || lines != logged) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Logged messages are missing after the flush");
+    }
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_log_flush");
+}
+
+#ifdef ANSI_C_MEM_TRACK_TRACE
+/**
+ * @brief Traces `num_blocks` allocations, reallocations and frees into small trace files, so that the trace
+ * rotates, then reads the headers of the files back and verifies that every event was recorded.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_trace(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_trace");
+    const char* trace_file_name = "ansi_c_mem_track_test.trace";
+    const size_t trace_file_count = 8;
+    if (!ansi_c_mem_track_start_trace(trace_file_name, 16384, trace_file_count)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The trace could not be started");
+        return;
+    }
+
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_trace() -> block_ptrs[i] memory allocation", "char", 0);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        char* new_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[i], block_size * 2, 0);
+        if (new_ptr) {
+            block_ptrs[i] = new_ptr;
+        }
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    ansi_c_mem_track_stop_trace();
+
+    uint64_t event_count = 0;
+    for (size_t i = 0; i < trace_file_count; i++) {
+        std::string file_name = std::string(trace_file_name) + "." + std::to_string(i);
+        std::ifstream trace_file(file_name, std::ios::binary);
+        TraceFileHeader header;
+        if (trace_file.read((char*)&header, sizeof(header))) {
+            if (memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.event_size != sizeof(TraceEvent)) {
+                ansi_c_mem_track_log_message(FILENAME, "Error", "Invalid trace file header");
+            }
+            event_count += header.event_count;
+        }
+        trace_file.close();
+        std::remove(file_name.c_str());
+    }
+    if (event_count != num_blocks * 3) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Trace events are missing");
+    }
+
+    // The call sites are dumped for the trace analyzer, one line each
+    const char* sites_file_name = "ansi_c_mem_track_test.sites";
+    if (!ansi_c_mem_track_dump_call_sites(sites_file_name)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call sites could not be dumped");
+    }
+    std::ifstream sites_file(sites_file_name);
+    std::string line;
+    bool found = false;
+    while (std::getline(sites_file, line)) {
+        found = found || line.find("test_trace() -> block_ptrs[i] memory allocation") != std::string::npos;
+    }
+    sites_file.close();
+    std::remove(sites_file_name);
+    if (!found) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site of the trace is missing from the dump");
+    }
+
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_trace");
+}
+#endif
+
+/**
+ * @brief Allocates memory blocks with MEM_TRACK_MALLOC in a loop and verifies that all of them share one call site,
+ * which knows the file, the line, the function and the type of the allocation. Frees the blocks at the end.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_call_site_macros(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_call_site_macros");
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+
+    char** block_ptrs = new char*[num_blocks];
+    const unsigned int line = __LINE__ + 2;
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)MEM_TRACK_MALLOC(block_size, char*, 0);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)MEM_TRACK_REALLOC(block_ptrs[i], block_size * 2, 0);
+    }
+#ifndef ANSI_C_MEM_TRACK_DISABLE
+    const MemoryBlock* first = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    const MemoryBlock* last = ansi_c_mem_track_get_block_info(block_ptrs[num_blocks - 1]);
+    const CallSite* call_site = first ? ansi_c_mem_track_get_call_site(first->call_site_id) : NULL;
+    if (!first || !last || first->call_site_id != last->call_site_id) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The blocks of a macro call site have different call sites");
+    }
+    else if (!call_site || call_site->line != line || strcmp(call_site->file_name, __FILE__) != 0
+        || strcmp(call_site->comment, "test_call_site_macros") != 0 || strcmp(call_site->type, "char*") != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The macro call site is recorded wrong");
+    }
+#endif
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        MEM_TRACK_FREE(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    MemoryUsageInfo after = ansi_c_mem_track_get_info();
+    if (after.memory_usage != before.memory_usage || after.size != before.size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Blocks of the macro call site are not freed");
+    }
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_call_site_macros");
+}
+
+/**
+ * @brief Allocates memory blocks with an object ID, frees them, and verifies the peaks of the tracker, of the call
+ * site and of the object ID, then resets the peaks. In the thread-safe build the global peak may be off by
+ * ANSI_C_MEM_TRACK_PEAK_SLACK, its default of 64 KiB is allowed for.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_peaks(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_peaks");
+    const size_t slack = 64 * 1024;
+    ansi_c_mem_track_reset_peaks();
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+    size_t object_id = ansi_c_mem_track_get_next_object_id();
+
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)MEM_TRACK_MALLOC(block_size, char*, object_id);
+    }
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    size_t call_site_id = block ? block->call_site_id : 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        MEM_TRACK_FREE(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+
+    size_t peak = before.memory_usage + block_size * num_blocks;
+    MemoryUsageInfo after = ansi_c_mem_track_get_info();
+    if (after.peak_memory_usage + slack < peak || after.peak_memory_usage > peak + slack
+        || after.peak_size < before.size + num_blocks - 64) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The global peak is wrong");
+    }
+    CallSiteUsageInfo call_site_info = ansi_c_mem_track_get_call_site_info(call_site_id);
+    if (call_site_id == 0 || call_site_info.size != 0 || call_site_info.peak_size != num_blocks
+        || call_site_info.peak_memory_usage != block_size * num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The peak of the call site is wrong");
+    }
+    ObjectUsageInfo object_info = ansi_c_mem_track_get_object_info(object_id);
+    if (object_info.size != 0 || object_info.peak_size != num_blocks || object_info.peak_memory_usage != block_size * num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The peak of the object ID is wrong");
+    }
+
+    ansi_c_mem_track_reset_peaks();
+    after = ansi_c_mem_track_get_info();
+    call_site_info = ansi_c_mem_track_get_call_site_info(call_site_id);
+    object_info = ansi_c_mem_track_get_object_info(object_id);
+    if (after.peak_memory_usage != after.memory_usage || call_site_info.peak_size != 0 || object_info.peak_size != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The peaks are not reset");
+    }
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_peaks");
+}
+
+/**
+ * @brief Returns the bucket of a size histogram that counts the given size.
+ */
+size_t size_histogram_bucket_of(size_t size) {
+    size_t bucket = 0;
+    while (bucket + 1 < SIZE_HISTOGRAM_BUCKET_COUNT && ansi_c_mem_track_size_histogram_bucket_min(bucket + 1) <= size) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Allocates and reallocates memory blocks of known sizes and verifies the size histograms of their call
+ * site and of the tracker, then prints the histogram of the call site.
+ *
+ * @param block_size The size of each block to be allocated, the blocks are reallocated to ten times the size.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_size_histogram(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_size_histogram");
+    static SizeHistogram before, after, call_site_histogram;
+    ansi_c_mem_track_get_size_histogram(&before);
+    size_t small_bucket = size_histogram_bucket_of(block_size);
+    size_t large_bucket = size_histogram_bucket_of(block_size * 10);
+
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_size_histogram", "char*", 0);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_realloc(block_ptrs[i], block_size * 10, 0);
+    }
+    ansi_c_mem_track_get_size_histogram(&after);
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    if (!block || !ansi_c_mem_track_get_call_site_size_histogram(block->call_site_id, &call_site_histogram)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The size histogram of the call site is not found");
+    }
+    else if (call_site_histogram.counts[small_bucket] != num_blocks
+        || call_site_histogram.counts[large_bucket] != num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The size histogram of the call site is wrong");
+    }
+    if (after.counts[small_bucket] - before.counts[small_bucket] < num_blocks
+        || after.counts[large_bucket] - before.counts[large_bucket] < num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The size histogram of the tracker is wrong");
+    }
+    if (ansi_c_mem_track_size_histogram_bucket_min(small_bucket) > block_size
+        || ansi_c_mem_track_size_histogram_bucket_min(small_bucket + 1) <= block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The size histogram buckets are wrong");
+    }
+    if (block) {
+        ansi_c_mem_track_print_size_histogram(FILENAME, &call_site_histogram);
+    }
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_size_histogram");
+}
+
+/**
+ * @brief Allocates memory blocks at two call sites and verifies the call site profile: the call site with the most
+ * memory comes first, the rows are ordered and hold the live and the total usage. Prints the profile.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated at the first call site, the second one gets half of them.
+ */
+void test_call_site_profile(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_call_site_profile");
+    const size_t max_entries = 10;
+    CallSiteProfileEntry entries[max_entries];
+
+    char** block_ptrs = new char*[num_blocks + num_blocks / 2];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_call_site_profile", "large", 0);
+    }
+    for (size_t i = num_blocks; i < num_blocks + num_blocks / 2; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size / 2, __FILE__, "test_call_site_profile", "small", 0);
+    }
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    size_t large_id = block ? block->call_site_id : 0;
+
+    size_t count = ansi_c_mem_track_get_call_site_profile(entries, max_entries, CALL_SITE_PROFILE_BY_MEMORY_USAGE);
+    if (count < 2 || entries[0].call_site_id != large_id || entries[0].usage.memory_usage != block_size * num_blocks
+        || entries[0].usage.size != num_blocks || entries[0].usage.total_size < num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site profile is wrong");
+    }
+    for (size_t i = 1; i < count; i++) {
+        if (entries[i].usage.memory_usage > entries[i - 1].usage.memory_usage) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "The call site profile is not ordered");
+        }
+    }
+    ansi_c_mem_track_print_call_site_profile(FILENAME, 5, CALL_SITE_PROFILE_BY_MEMORY_USAGE);
+    // A limit beyond the number of call sites prints all of them
+    if (!ansi_c_mem_track_print_call_site_profile(FILENAME, (size_t)-1, CALL_SITE_PROFILE_BY_SIZE)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site profile is not printed with an unbounded limit");
+    }
+
+    for (size_t i = 0; i < num_blocks + num_blocks / 2; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    CallSiteUsageInfo info = ansi_c_mem_track_get_call_site_info(large_id);
+    if (info.memory_usage != 0 || info.total_memory_usage < block_size * num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site totals are wrong");
+    }
+    count = ansi_c_mem_track_get_call_site_profile(entries, 1, CALL_SITE_PROFILE_BY_TOTAL_MEMORY_USAGE);
+    if (count != 1 || entries[0].usage.total_memory_usage < info.total_memory_usage) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site profile by total memory usage is wrong");
+    }
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_call_site_profile");
+}
+
+/**
+ * @brief Allocates memory blocks at a call site, exports the profile in the folded stack and in the pprof format,
+ * and verifies that the call site is in both files. Frees the blocks at the end.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_profile_export(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_profile_export");
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_profile_export", "char*", 0);
+    }
+
+    const char* folded_file_name = "ansi_c_mem_track_test.folded";
+    if (!ansi_c_mem_track_export_folded(folded_file_name, CALL_SITE_PROFILE_BY_MEMORY_USAGE)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The folded profile could not be written");
+    }
+    std::string expected = std::string(";test_profile_export;char* ") + std::to_string(block_size * num_blocks);
+    std::ifstream folded_file(folded_file_name);
+    std::string line;
+    bool found = false;
+    while (std::getline(folded_file, line)) {
+        found = found || (line.size() >= expected.size() && line.compare(line.size() - expected.size(), expected.size(), expected) == 0);
+    }
+    folded_file.close();
+    std::remove(folded_file_name);
+    if (!found) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site is missing from the folded profile");
+    }
+
+    const char* pprof_file_name = "ansi_c_mem_track_test.pb";
+    if (!ansi_c_mem_track_export_pprof(pprof_file_name)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The pprof profile could not be written");
+    }
+    std::ifstream pprof_file(pprof_file_name, std::ios::binary);
+    std::string profile((std::istreambuf_iterator<char>(pprof_file)), std::istreambuf_iterator<char>());
+    pprof_file.close();
+    std::remove(pprof_file_name);
+    // The string table starts with the empty string, and the strings are stored unescaped
+    if (profile.compare(0, 2, "\x32\x00", 2) != 0 || profile.find("test_profile_export") == std::string::npos) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site is missing from the pprof profile");
+    }
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_profile_export");
+}
+
+/**
+ * @brief Visitor of test_block_visitor, adds up the sizes of the blocks and stops after `limit` blocks.
+ */
+struct BlockVisitorTotals {
+    size_t count;
+    size_t size;
+    size_t limit;
+};
+
+bool test_block_visitor_visit(const MemoryBlock* block, void* context) {
+    BlockVisitorTotals* totals = (BlockVisitorTotals*)context;
+    totals->count++;
+    totals->size += block->size;
+    return totals->count < totals->limit;
+}
+
+/**
+ * @brief Allocates memory blocks of growing sizes with an object ID, and verifies that the visitor and the cursor
+ * find them with filters by object ID, size range and call site, and that a visitor can stop early. Logs a few of
+ * the blocks and frees them at the end.
+ *
+ * @param num_blocks The number of blocks to be allocated, of 1 to `num_blocks` bytes.
+ */
+void test_block_visitor(size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_block_visitor");
+    size_t object_id = ansi_c_mem_track_get_next_object_id();
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(i + 1, __FILE__, "test_block_visitor", "char*", object_id);
+    }
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    size_t call_site_id = block ? block->call_site_id : 0;
+
+    BlockFilter filter = BLOCK_FILTER_INIT;
+    filter.optional_object_id = object_id;
+    BlockVisitorTotals totals = { 0, 0, (size_t)-1 };
+    size_t visited = ansi_c_mem_track_visit_blocks(&filter, test_block_visitor_visit, &totals);
+    if (visited != num_blocks || totals.count != num_blocks || totals.size != num_blocks * (num_blocks + 1) / 2) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The visitor missed blocks of the object ID");
+    }
+
+    BlockFilter size_filter = BLOCK_FILTER_INIT;
+    size_filter.min_size = 10;
+    size_filter.max_size = 19;
+    size_filter.call_site_id = call_site_id;
+    totals = { 0, 0, (size_t)-1 };
+    ansi_c_mem_track_visit_blocks(&size_filter, test_block_visitor_visit, &totals);
+    if (totals.count != 10 || totals.size != 145) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The visitor does not filter by size and call site");
+    }
+    totals = { 0, 0, 5 };
+    if (ansi_c_mem_track_visit_blocks(&filter, test_block_visitor_visit, &totals) != 5) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The visitor does not stop");
+    }
+
+    // The cursor reads the blocks in batches smaller than a shard
+    MemoryBlock blocks[7];
+    BlockCursor cursor = BLOCK_CURSOR_INIT;
+    size_t count, read = 0, size = 0;
+    while ((count = ansi_c_mem_track_read_blocks(&cursor, &filter, blocks, 7)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            read++;
+            size += blocks[i].size;
+        }
+    }
+    if (read != num_blocks || size != num_blocks * (num_blocks + 1) / 2
+        || ansi_c_mem_track_read_blocks(&cursor, &filter, blocks, 7) != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The cursor missed blocks of the object ID");
+    }
+    size_filter.max_size = 11;
+    if (!ansi_c_mem_track_log_blocks(FILENAME, &size_filter)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The blocks could not be logged");
+    }
+
+    ansi_c_mem_track_free_by_object_id(object_id);
+    delete[] block_ptrs;
+    totals = { 0, 0, (size_t)-1 };
+    if (ansi_c_mem_track_visit_blocks(&filter, test_block_visitor_visit, &totals) != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The visitor found freed blocks");
+    }
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_block_visitor");
+}
+
+/**
+ * @brief Takes a heap snapshot, frees half of the blocks allocated before it and allocates new ones at another
+ * call site, takes a second snapshot, and verifies that the difference finds the new and the freed blocks and
+ * ranks the growing call site first. Logs the difference and frees the blocks at the end.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated at each call site.
+ */
+void test_heap_snapshot(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_heap_snapshot");
+    char** old_ptrs = new char*[num_blocks];
+    char** new_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        old_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_heap_snapshot", "old", 0);
+    }
+    HeapSnapshot before;
+    if (!ansi_c_mem_track_take_snapshot(&before, NULL)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The first heap snapshot could not be taken");
+    }
+    for (size_t i = 0; i < num_blocks / 2; i++) {
+        ansi_c_mem_track_free(old_ptrs[i]);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        new_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_heap_snapshot", "new", 0);
+    }
+    HeapSnapshot after;
+    if (!ansi_c_mem_track_take_snapshot(&after, NULL)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The second heap snapshot could not be taken");
+    }
+    for (size_t i = 1; i < after.block_count; i++) {
+        if ((uintptr_t)after.blocks[i - 1].address >= (uintptr_t)after.blocks[i].address) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "The heap snapshot is not sorted by address");
+            break;
+        }
+    }
+
+    HeapSnapshotDiff diff;
+    if (!ansi_c_mem_track_diff_snapshots(&before, &after, &diff)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The heap snapshots could not be compared");
+    }
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(new_ptrs[0]);
+    size_t call_site_id = block ? block->call_site_id : 0;
+    if (diff.new_block_count != num_blocks || diff.new_memory_usage != num_blocks * block_size
+        || diff.freed_block_count != num_blocks / 2 || diff.freed_memory_usage != num_blocks / 2 * block_size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The difference of the heap snapshots is wrong");
+    }
+    for (size_t i = 0; i < diff.new_block_count; i++) {
+        if (diff.new_blocks[i].call_site_id != call_site_id) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "An old block is reported as new");
+            break;
+        }
+    }
+    if (diff.call_site_count != 2 || diff.call_sites[0].call_site_id != call_site_id
+        || diff.call_sites[0].after_size - diff.call_sites[0].before_size != num_blocks
+        || diff.call_sites[1].before_size - diff.call_sites[1].after_size != num_blocks / 2) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The growth of the call sites is wrong");
+    }
+    if (!ansi_c_mem_track_print_snapshot_diff(FILENAME, &diff, 5)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The difference of the heap snapshots could not be logged");
+    }
+    ansi_c_mem_track_free_snapshot_diff(&diff);
+    ansi_c_mem_track_free_snapshot(&before);
+    ansi_c_mem_track_free_snapshot(&after);
+
+    for (size_t i = num_blocks / 2; i < num_blocks; i++) {
+        ansi_c_mem_track_free(old_ptrs[i]);
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(new_ptrs[i]);
+    }
+    delete[] old_ptrs;
+    delete[] new_ptrs;
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_heap_snapshot");
+}
+
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+/**
+ * @brief Allocates a block at the call site of test_stacks.
+ */
+void* test_stacks_alloc(size_t block_size) {
+    return ansi_c_mem_track_malloc(block_size, __FILE__, "test_stacks", "char*", 0);
+}
+
+/**
+ * @brief Allocates memory blocks at one call site from a loop and from another line, and verifies that the blocks
+ * of the loop share a stack, while the other block has a stack of its own. Prints the stacks and frees the blocks.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated in the loop.
+ */
+void test_stacks(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_stacks");
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)test_stacks_alloc(block_size);
+    }
+    char* other = (char*)test_stacks_alloc(block_size);
+
+    const MemoryBlock* block = ansi_c_mem_track_get_block_info(block_ptrs[0]);
+    size_t stack_id = block ? block->stack_id : 0;
+    size_t call_site_id = block ? block->call_site_id : 0;
+    block = ansi_c_mem_track_get_block_info(block_ptrs[num_blocks - 1]);
+    if (stack_id == 0 || !block || block->stack_id != stack_id) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The blocks of a loop have different stacks");
+    }
+    block = ansi_c_mem_track_get_block_info(other);
+    if (!block || block->call_site_id != call_site_id || block->stack_id == stack_id || block->stack_id == 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The blocks of two code paths have the same stack");
+    }
+    void* frames[ANSI_C_MEM_TRACK_BACKTRACE_DEPTH];
+    if (ansi_c_mem_track_get_stack(stack_id, frames, ANSI_C_MEM_TRACK_BACKTRACE_DEPTH) < 2
+        || !ansi_c_mem_track_print_stack(FILENAME, stack_id)) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The stack could not be read");
+    }
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    ansi_c_mem_track_free(other);
+    delete[] block_ptrs;
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_stacks");
+}
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+/**
+ * @brief Returns the memory usage of all call sites in the call site profile.
+ */
+size_t profile_memory_usage() {
+    const size_t max_entries = 4096;
+    CallSiteProfileEntry* entries = new CallSiteProfileEntry[max_entries];
+    size_t count = ansi_c_mem_track_get_call_site_profile(entries, max_entries, CALL_SITE_PROFILE_BY_MEMORY_USAGE);
+    size_t memory_usage = 0;
+    for (size_t i = 0; i < count; i++) {
+        memory_usage += entries[i].usage.memory_usage;
+    }
+    delete[] entries;
+    return memory_usage;
+}
+
+/**
+ * @brief Leaks blocks while only a sample of them is tracked, and verifies that the counters stay exact and that
+ * the estimated sizes of the tracked blocks and the call site profile add up to about the leaked memory. Frees the
+ * blocks at the end.
+ *
+ * @param block_size The size of each block to be allocated.
+ * @param num_blocks The number of blocks to be allocated.
+ */
+void test_sampling(size_t block_size, size_t num_blocks) {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_sampling");
+    const size_t sampling_interval = 64 * 1024;
+    ansi_c_mem_track_set_sampling_interval(sampling_interval);
+    MemoryUsageInfo before = ansi_c_mem_track_get_info();
+    size_t profile_before = profile_memory_usage();
+
+    char** block_ptrs = new char*[num_blocks];
+    for (size_t i = 0; i < num_blocks; i++) {
+        block_ptrs[i] = (char*)ansi_c_mem_track_malloc(block_size, __FILE__, "test_sampling() -> block_ptrs[i] memory allocation", "char", 0);
+        if (!block_ptrs[i]) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Sampled allocation failed");
+            for (size_t j = 0; j < i; j++) {
+                ansi_c_mem_track_free(block_ptrs[j]);
+            }
+            delete[] block_ptrs;
+            return;
+        }
+        memset(block_ptrs[i], 'S', block_size);
+    }
+    // Growing the blocks that were not sampled samples some of them
+    for (size_t i = 0; i < num_blocks; i += 2) {
+        char* new_ptr = (char*)ansi_c_mem_track_realloc(block_ptrs[i], block_size * 2, 0);
+        if (!new_ptr || new_ptr[block_size - 1] != 'S') {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Data is lost by realloc of a sampled block");
+            continue;
+        }
+        block_ptrs[i] = new_ptr;
+    }
+    for (size_t i = 0; i < num_blocks; i++) {
+        if (ansi_c_mem_track_get_block_size(block_ptrs[i]) != (i % 2 == 0 ? block_size * 2 : block_size)) {
+            ansi_c_mem_track_log_message(FILENAME, "Error", "Wrong size of a sampled block");
+            break;
+        }
+    }
+    size_t leaked = num_blocks * block_size + (num_blocks + 1) / 2 * block_size;
+
+    MemoryUsageInfo after = ansi_c_mem_track_get_info();
+    if (after.memory_usage - before.memory_usage != leaked || after.size - before.size != num_blocks) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The counters are not exact while sampling");
+    }
+    size_t count = 0;
+    const MemoryBlock** blocks = ansi_c_mem_track_get_unfreed_blocks_info(&count);
+    size_t tracked = 0;
+    size_t estimated = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i]->is_sampled) {
+            tracked++;
+            estimated += ansi_c_mem_track_get_estimated_size(blocks[i]);
+        }
+    }
+    if (tracked == 0 || tracked >= num_blocks / 4 || estimated < leaked / 4 * 3 || estimated > leaked / 4 * 5) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The estimate of the sampled blocks is off");
+    }
+    size_t profiled = profile_memory_usage() - profile_before;
+    if (profiled < leaked / 4 * 3 || profiled > leaked / 4 * 5) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The call site profile does not scale the sampled blocks");
+    }
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        ansi_c_mem_track_free(block_ptrs[i]);
+    }
+    delete[] block_ptrs;
+    after = ansi_c_mem_track_get_info();
+    if (after.memory_usage != before.memory_usage || after.size != before.size) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "Blocks that were not sampled are not counted as freed");
+    }
+    if (profile_memory_usage() != profile_before) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The estimates of the freed sampled blocks are not removed from the profile");
+    }
+    ansi_c_mem_track_set_sampling_interval(0);
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_sampling");
+}
+#endif
+
+#if defined(__linux__)
+/**
+ * @brief Runs a small program under the LD_PRELOAD interposer and verifies that its report was written with the
+ * usage information and the call sites of the interposed functions. The interposer is built separately, see
+ * ANSI_C_MEM_TRACK_PRELOAD, and the test is skipped unless ANSI_C_MEM_TRACK_PRELOAD_LIBRARY names it.
+ */
+void test_preload() {
+    ansi_c_mem_track_log_message(FILENAME, "Info", "Begin test_preload");
+    const char* library = std::getenv("ANSI_C_MEM_TRACK_PRELOAD_LIBRARY");
+    if (!library || !library[0]) {
+        ansi_c_mem_track_log_message(FILENAME, "Info", "test_preload skipped, ANSI_C_MEM_TRACK_PRELOAD_LIBRARY is not set");
+        return;
+    }
+    const char* log_file_name = "test_preload.log";
+    std::remove(log_file_name);
+    std::string command = std::string("LD_PRELOAD='") + library + "' ANSI_C_MEM_TRACK_LOG=" + log_file_name
+        + " ANSI_C_MEM_TRACK_LOG_BLOCKS=1 /bin/sh -c 'ls / | sort > /dev/null'";
+    if (std::system(command.c_str()) != 0) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The program run under the interposer failed");
+    }
+
+    std::ifstream log_file(log_file_name);
+    std::string line;
+    bool has_info = false;
+    bool has_malloc = false;
+    while (std::getline(log_file, line)) {
+        has_info = has_info || line.find("[MEMORY] Memory usage information") != std::string::npos;
+        has_malloc = has_malloc || line.find("(preload) malloc") != std::string::npos;
+    }
+    if (!has_info || !has_malloc) {
+        ansi_c_mem_track_log_message(FILENAME, "Error", "The interposer did not write its report");
+    }
+    log_file.close();
+    std::remove(log_file_name);
+    ansi_c_mem_track_log_message(FILENAME, "Info", "End test_preload");
+}
+#endif
+
 int main()
 {
     // initialize the ansi_c_mem_track library
     ansi_c_mem_track_init();
     ansi_c_mem_track_log_message(FILENAME, "Info", "Initialized");
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    // The other tests check every block, so all of them are tracked except in test_sampling
+    ansi_c_mem_track_set_sampling_interval(0);
+#endif
 
     // test memory allocation with large amount of data
     test_memory_allocation(128, 100000);
@@ -377,6 +1383,54 @@ int main()
     test_ansi_c_mem_track_free_by_object_id();
     // get_unfreed_blocks_info_test
     get_unfreed_blocks_info_test();
+    // Log to a file and flush it
+    test_log_flush(10000);
+    // Call sites captured by the allocation macros
+    test_call_site_macros(32, 1000);
+#ifndef ANSI_C_MEM_TRACK_DISABLE
+    // Peak usage of the tracker, a call site and an object ID
+    test_peaks(1000, 1000);
+#endif
+    // Histograms of the requested sizes
+    test_size_histogram(100, 1000);
+    // Aggregated heap profile of the call sites
+    test_call_site_profile(10000, 1000);
+    // Heap profiles for pprof and flame graphs
+    test_profile_export(100, 1000);
+    // Live blocks through a visitor and a cursor, without copies
+    test_block_visitor(1000);
+
+    // Heap snapshots and their difference
+    test_heap_snapshot(64, 1000);
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+    // Call stacks of the allocations
+    test_stacks(64, 1000);
+#endif
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    // Small blocks from the size-class slabs
+    test_slab_backend(100, 10000);
+#endif
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    // Request-scoped blocks from an arena
+    test_arena(200, 10000);
+#endif
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    // Only a sample of the blocks is tracked
+    test_sampling(1000, 20000);
+#endif
+#ifdef ANSI_C_MEM_TRACK_TRACE
+    // Binary allocation trace over rotating files
+    test_trace(64, 500);
+#endif
+#if defined(ANSI_C_MEM_TRACK_THREAD_SAFE) || defined(ANSI_C_MEM_TRACK_THREAD_CACHE)
+    // Concurrent allocations from several threads
+    test_multithreaded_stress(8, 64, 20000);
+    test_multithreaded_remote_free(8, 64, 20000);
+#endif
+#if defined(__linux__)
+    // An unmodified program under the LD_PRELOAD interposer
+    test_preload();
+#endif
 
     // deinitialize the ansi_c_mem_track library
     ansi_c_mem_track_log_message(FILENAME, "Info", "Deinitialized");
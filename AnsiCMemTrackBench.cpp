@@ -0,0 +1,972 @@
+// AnsiCMemTrackBench.cpp : Measures the tracker against the system allocator, in microbenchmarks of its hot paths
+// or in multi-threaded allocation workloads.
+//
+// Usage: AnsiCMemTrackBench [options]
+//   --min-live <count>   The smallest live set, 1000 blocks by default.
+//   --max-live <count>   The largest live set, 10000000 blocks by default. The live set grows tenfold per step.
+//   --sizes <list>       The block sizes, separated by commas, 16,256,4096 by default.
+//   --patterns <list>    The orders of the frees: lifo, fifo and random, all by default.
+//   --min-ops <count>    The operations measured at least per row, 1000000 by default; small live sets are repeated.
+//   --max-memory <MiB>   Skips the live sets whose blocks would take more memory, 1024 MiB by default.
+//   --output <file>      Writes the results to a file instead of the standard output.
+//
+// Every row of the output is one operation at one live set size, block size and order, measured with the system
+// allocator and with the tracker, as comma-separated values with a header line. A round allocates the live set,
+// looks up, reallocates and frees its blocks in the order of the pattern, then allocates it again with an object ID
+// per OBJECT_BLOCKS blocks and frees the object IDs in the order of the pattern. One round runs unmeasured first, so
+// the tables of the tracker have grown to the live set. Compile the library and this file with the same build
+// options; they are named in the first column.
+//
+// Usage: AnsiCMemTrackBench --workloads <list> [options]
+//   --workloads <list>   producer_consumer, request_bursts, cache_churn, realloc_growth, or all.
+//   --threads <count>    The most threads, the number of processors by default. The runs take 1, 2, 4, ... threads.
+//   --ops <count>        The operations of every thread in a run, 1000000 by default.
+//   --cache-blocks <count> The blocks of the cache of every thread in cache_churn, 10000 by default.
+//
+// Every row is one workload on a number of threads with one allocator: the throughput, the 50th, 99th and 99.9th
+// percentile and the maximum of the latency of a call, and the peak resident set size of the run. Every call is
+// timed on its own, so the latencies include a clock read, and the percentiles are bucketed to 1/16 of their value.
+// The peak resident set size is reset before every run on Linux only; elsewhere it is the peak of the process.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+extern "C" {
+#include "include/ansi_c_mem_track.h"
+}
+
+/**
+ * @brief The number of blocks allocated with the same object ID for the free_by_object_id rows.
+ */
+const size_t OBJECT_BLOCKS = 64;
+
+/**
+ * @brief The seed of the random orders, so the runs of a live set are comparable.
+ */
+const unsigned int RANDOM_SEED = 12345;
+
+/**
+ * @brief The orders in which the blocks are looked up, reallocated and freed after they were allocated.
+ */
+enum Pattern {
+    PATTERN_LIFO,  /**< The last allocated block first. */
+    PATTERN_FIFO,  /**< The first allocated block first. */
+    PATTERN_RANDOM, /**< A random order. */
+    PATTERN_COUNT
+};
+
+static const char* const pattern_names[] = { "lifo", "fifo", "random" };
+
+/**
+ * @brief The measured operations, in the order of the output.
+ */
+enum Operation {
+    OPERATION_MALLOC,
+    OPERATION_GET_BLOCK_INFO,
+    OPERATION_REALLOC,
+    OPERATION_FREE,
+    OPERATION_MALLOC_AT,
+    OPERATION_FREE_BY_OBJECT_ID,
+    OPERATION_COUNT
+};
+
+static const char* const operation_names[] = {
+    "malloc", "get_block_info", "realloc", "free", "malloc_at", "free_by_object_id"
+};
+
+/**
+ * @brief The tracker can be called from several threads, see ANSI_C_MEM_TRACK_THREAD_SAFE and the options that
+ * imply it.
+ */
+#if defined(ANSI_C_MEM_TRACK_THREAD_SAFE) || defined(ANSI_C_MEM_TRACK_THREAD_CACHE) || defined(ANSI_C_MEM_TRACK_ASYNC_LOG)
+const bool IS_THREAD_SAFE = true;
+#else
+const bool IS_THREAD_SAFE = false;
+#endif
+
+/**
+ * @brief The allocation workloads of the multi-threaded benchmark.
+ */
+enum WorkloadKind {
+    WORKLOAD_PRODUCER_CONSUMER, /**< Every thread allocates blocks and hands them to the next thread, which frees them. */
+    WORKLOAD_REQUEST_BURSTS,    /**< Bursts of blocks with an object ID per request, freed by the object ID at once. */
+    WORKLOAD_CACHE_CHURN,       /**< A long-lived cache per thread, whose random entries are replaced. */
+    WORKLOAD_REALLOC_GROWTH,    /**< Buffers that grow by realloc in steps and are freed when they are full. */
+    WORKLOAD_COUNT
+};
+
+static const char* const workload_names[] = { "producer_consumer", "request_bursts", "cache_churn", "realloc_growth" };
+
+/**
+ * @brief Options of the command line.
+ */
+struct Options {
+    size_t min_live = 1000;
+    size_t max_live = 10000000;
+    std::vector<size_t> sizes = { 16, 256, 4096 };
+    std::vector<Pattern> patterns = { PATTERN_LIFO, PATTERN_FIFO, PATTERN_RANDOM };
+    size_t min_operations = 1000000;
+    size_t max_memory = (size_t)1024 * 1024 * 1024;
+    const char* output_file_name = NULL;
+    std::vector<WorkloadKind> workloads;
+    size_t max_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t workload_operations = 1000000;
+    size_t cache_blocks = 10000;
+};
+
+/**
+ * @brief The time and the number of operations of one operation over all rounds.
+ */
+struct Measurement {
+    double seconds = 0.0;
+    uint64_t operations = 0;
+};
+
+/**
+ * @brief The blocks and the orders of one live set.
+ */
+struct Workload {
+    size_t block_size = 0;
+    std::vector<void*> blocks;
+    std::vector<size_t> order;        /**< The indices of the blocks in the order of the pattern. */
+    std::vector<size_t> object_order; /**< The indices of the object IDs in the order of the pattern. */
+    std::vector<size_t> object_ids;
+};
+
+/**
+ * @brief Returns the build options of the tracker that this file was compiled with.
+ */
+static std::string build_name() {
+    std::string name;
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    name += " INLINE_HEADER";
+#endif
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    name += " THREAD_SAFE";
+#endif
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    name += " THREAD_CACHE";
+#endif
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    name += " SLAB";
+#endif
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    name += " ARENA";
+#endif
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG
+    name += " ASYNC_LOG";
+#endif
+#ifdef ANSI_C_MEM_TRACK_TRACE
+    name += " TRACE";
+#endif
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    name += " SAMPLING";
+#endif
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+    name += " BACKTRACE";
+#endif
+    return name.empty() ? "default" : name.substr(1);
+}
+
+/**
+ * @brief Fills an order of the given number of indices.
+ */
+static void make_order(std::vector<size_t>& order, size_t count, Pattern pattern, std::mt19937& random) {
+    order.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = pattern == PATTERN_LIFO ? count - 1 - i : i;
+    }
+    if (pattern == PATTERN_RANDOM) {
+        std::shuffle(order.begin(), order.end(), random);
+    }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Runs one round with the system allocator. The object IDs are only used to group the frees.
+ */
+static void run_system_round(Workload& workload, Measurement* measurements) {
+    std::vector<void*>& blocks = workload.blocks;
+    size_t count = blocks.size();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        blocks[i] = std::malloc(workload.block_size);
+    }
+    measurements[OPERATION_MALLOC].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = workload.order[i];
+        blocks[index] = std::realloc(blocks[index], workload.block_size * 2);
+    }
+    measurements[OPERATION_REALLOC].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        std::free(blocks[workload.order[i]]);
+    }
+    measurements[OPERATION_FREE].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        blocks[i] = std::malloc(workload.block_size);
+    }
+    measurements[OPERATION_MALLOC_AT].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < workload.object_order.size(); ++i) {
+        size_t first = workload.object_order[i] * OBJECT_BLOCKS;
+        size_t last = std::min(first + OBJECT_BLOCKS, count);
+        for (size_t index = first; index < last; ++index) {
+            std::free(blocks[index]);
+        }
+    }
+    measurements[OPERATION_FREE_BY_OBJECT_ID].seconds += seconds_since(start);
+}
+
+/**
+ * @brief Runs one round with the tracker.
+ *
+ * @return The sum of the sizes returned by get_block_info, so the lookups are not optimized away.
+ */
+static size_t run_tracker_round(Workload& workload, Measurement* measurements) {
+    static CallSiteDescriptor call_site = { __FILE__, "run_tracker_round", "char", __LINE__, 0 };
+    std::vector<void*>& blocks = workload.blocks;
+    size_t count = blocks.size();
+    size_t checksum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        blocks[i] = ansi_c_mem_track_malloc(workload.block_size, __FILE__, "run_tracker_round", "char", 0);
+    }
+    measurements[OPERATION_MALLOC].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        const MemoryBlock* block = ansi_c_mem_track_get_block_info(blocks[workload.order[i]]);
+        checksum += block ? block->size : 0;
+    }
+    measurements[OPERATION_GET_BLOCK_INFO].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = workload.order[i];
+        blocks[index] = ansi_c_mem_track_realloc(blocks[index], workload.block_size * 2, 0);
+    }
+    measurements[OPERATION_REALLOC].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        ansi_c_mem_track_free(blocks[workload.order[i]]);
+    }
+    measurements[OPERATION_FREE].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        blocks[i] = ansi_c_mem_track_malloc_at(workload.block_size, &call_site, workload.object_ids[i / OBJECT_BLOCKS]);
+    }
+    measurements[OPERATION_MALLOC_AT].seconds += seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < workload.object_order.size(); ++i) {
+        ansi_c_mem_track_free_by_object_id(workload.object_ids[workload.object_order[i]]);
+    }
+    measurements[OPERATION_FREE_BY_OBJECT_ID].seconds += seconds_since(start);
+    return checksum;
+}
+
+/**
+ * @brief Prints the rows of one allocator. The operations are counted per block, also for free_by_object_id.
+ */
+static void print_rows(FILE* output, const std::string& build, const char* allocator, const Measurement* measurements,
+    Pattern pattern, size_t live, size_t block_size) {
+    for (int operation = 0; operation < OPERATION_COUNT; ++operation) {
+        const Measurement& measurement = measurements[operation];
+        if (measurement.operations == 0) {
+            continue;
+        }
+        double ns = measurement.seconds * 1e9 / (double)measurement.operations;
+        std::fprintf(output, "%s,%s,%s,%s,%lu,%lu,%llu,%.2f,%.0f\n", build.c_str(), allocator,
+            operation_names[operation], pattern_names[pattern], (unsigned long)live, (unsigned long)block_size,
+            (unsigned long long)measurement.operations, ns, ns > 0.0 ? 1e9 / ns : 0.0);
+    }
+}
+
+/**
+ * @brief Measures one live set with both allocators and prints its rows.
+ *
+ * @return false if a lookup of the tracker did not find its block.
+ */
+static bool run_benchmark(FILE* output, const std::string& build, size_t live, size_t block_size, Pattern pattern,
+    const Options& options) {
+    std::mt19937 random(RANDOM_SEED);
+    Workload workload;
+    workload.block_size = block_size;
+    workload.blocks.resize(live);
+    make_order(workload.order, live, pattern, random);
+    size_t object_count = (live + OBJECT_BLOCKS - 1) / OBJECT_BLOCKS;
+    make_order(workload.object_order, object_count, pattern, random);
+    workload.object_ids.resize(object_count);
+    for (size_t i = 0; i < object_count; ++i) {
+        workload.object_ids[i] = ansi_c_mem_track_get_next_object_id();
+    }
+    size_t rounds = std::max<size_t>(1, options.min_operations / live);
+
+    Measurement system[OPERATION_COUNT];
+    Measurement tracker[OPERATION_COUNT];
+    Measurement warm_up[OPERATION_COUNT];
+    run_system_round(workload, warm_up);
+    for (size_t round = 0; round < rounds; ++round) {
+        run_system_round(workload, system);
+    }
+    size_t checksum = run_tracker_round(workload, warm_up);
+    for (size_t round = 0; round < rounds; ++round) {
+        checksum += run_tracker_round(workload, tracker);
+    }
+    for (int operation = 0; operation < OPERATION_COUNT; ++operation) {
+        system[operation].operations = operation == OPERATION_GET_BLOCK_INFO ? 0 : (uint64_t)live * rounds;
+        tracker[operation].operations = (uint64_t)live * rounds;
+    }
+    print_rows(output, build, "system", system, pattern, live, block_size);
+    print_rows(output, build, "tracker", tracker, pattern, live, block_size);
+    std::fflush(output);
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    // Only the sampled blocks are found
+    (void)checksum;
+    return true;
+#else
+    // Every lookup of the warm-up round and the measured rounds must have found its block
+    return checksum == block_size * live * (rounds + 1);
+#endif
+}
+
+/**
+ * @brief Log-linear histogram of operation latencies in nanoseconds, with LATENCY_SUB_BUCKETS buckets per power of
+ * two, so a percentile is off by at most 1/LATENCY_SUB_BUCKETS.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(LATENCY_BUCKET_COUNT, 0), count(0), max(0) {
+    }
+
+    void record(uint64_t ns) {
+        ++counts[bucket(ns)];
+        ++count;
+        max = std::max(max, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        max = std::max(max, other.max);
+    }
+
+    /**
+     * @brief Returns the largest latency of the bucket that holds the given fraction of the operations.
+     */
+    uint64_t percentile(double fraction) const {
+        uint64_t rank = (uint64_t)(fraction * (double)count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::min(bucket_min(i + 1) - 1, max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t operations() const {
+        return count;
+    }
+
+    uint64_t maximum() const {
+        return max;
+    }
+
+private:
+    static const unsigned int LATENCY_SUB_BUCKET_BITS = 4;
+    static const uint64_t LATENCY_SUB_BUCKETS = (uint64_t)1 << LATENCY_SUB_BUCKET_BITS;
+    static const size_t LATENCY_BUCKET_COUNT = (64 - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS;
+
+    static size_t bucket(uint64_t ns) {
+        if (ns < LATENCY_SUB_BUCKETS) {
+            return (size_t)ns;
+        }
+        unsigned int msb = 0;
+        while (ns >> (msb + 1)) {
+            ++msb;
+        }
+        unsigned int shift = msb - LATENCY_SUB_BUCKET_BITS;
+        return (size_t)(((uint64_t)(shift + 1) << LATENCY_SUB_BUCKET_BITS) + ((ns >> shift) & (LATENCY_SUB_BUCKETS - 1)));
+    }
+
+    static uint64_t bucket_min(size_t index) {
+        if (index < LATENCY_SUB_BUCKETS) {
+            return index;
+        }
+        if (index >= LATENCY_BUCKET_COUNT) {
+            return UINT64_MAX;
+        }
+        return (LATENCY_SUB_BUCKETS + (index & (LATENCY_SUB_BUCKETS - 1))) << ((index >> LATENCY_SUB_BUCKET_BITS) - 1);
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t max;
+};
+
+/**
+ * @brief The blocks handed to a thread by the producer_consumer workload.
+ */
+struct HandoffQueue {
+    std::mutex mutex;
+    std::vector<void*> blocks;
+};
+
+/**
+ * @brief The state shared by the threads of one run of a workload.
+ */
+struct WorkloadRun {
+    WorkloadKind kind;
+    bool tracked;
+    size_t threads;
+    size_t operations;   /**< The operations of every thread. */
+    size_t cache_blocks; /**< The blocks of the cache of every thread in the cache_churn workload. */
+    std::vector<HandoffQueue> queues;
+    std::atomic<bool> is_started;
+    WorkloadRun() : kind(WORKLOAD_PRODUCER_CONSUMER), tracked(false), threads(1), operations(0), cache_blocks(0),
+        is_started(false) {
+    }
+};
+
+/**
+ * @brief The state of one thread of a workload run.
+ */
+struct WorkloadThread {
+    WorkloadRun* run;
+    size_t index;
+    std::mt19937 random;
+    LatencyHistogram latencies;
+    uint64_t operations;
+};
+
+static uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Allocates a block with the allocator of the run and records the latency.
+ */
+static void* workload_malloc(WorkloadThread& thread, size_t size, size_t object_id) {
+    uint64_t start = now_ns();
+    void* ptr = thread.run->tracked ? MEM_TRACK_MALLOC(size, char, object_id) : std::malloc(size);
+    thread.latencies.record(now_ns() - start);
+    ++thread.operations;
+    if (ptr) {
+        // The block is touched, as a program would
+        *(char*)ptr = 0;
+    }
+    return ptr;
+}
+
+static void* workload_realloc(WorkloadThread& thread, void* ptr, size_t size) {
+    uint64_t start = now_ns();
+    void* new_ptr = thread.run->tracked ? ansi_c_mem_track_realloc(ptr, size, 0) : std::realloc(ptr, size);
+    thread.latencies.record(now_ns() - start);
+    ++thread.operations;
+    return new_ptr;
+}
+
+static void workload_free(WorkloadThread& thread, void* ptr) {
+    uint64_t start = now_ns();
+    if (thread.run->tracked) {
+        ansi_c_mem_track_free(ptr);
+    }
+    else {
+        std::free(ptr);
+    }
+    thread.latencies.record(now_ns() - start);
+    ++thread.operations;
+}
+
+/**
+ * @brief Returns a block size between 16 bytes and 4 KiB, most of them small.
+ */
+static size_t workload_block_size(std::mt19937& random) {
+    return random() % 5 == 0 ? 256 + random() % 3840 : 16 + random() % 240;
+}
+
+static void run_producer_consumer(WorkloadThread& thread) {
+    WorkloadRun& run = *thread.run;
+    HandoffQueue& next = run.queues[(thread.index + 1) % run.threads];
+    HandoffQueue& own = run.queues[thread.index];
+    std::vector<void*> produced;
+    std::vector<void*> consumed;
+    size_t allocations = 0;
+    while (allocations < run.operations / 2) {
+        // The blocks are handed over in batches, so the queues cost little next to the allocator
+        for (size_t i = 0; i < 64 && allocations < run.operations / 2; ++i, ++allocations) {
+            produced.push_back(workload_malloc(thread, workload_block_size(thread.random), 0));
+        }
+        {
+            std::lock_guard<std::mutex> lock(next.mutex);
+            next.blocks.insert(next.blocks.end(), produced.begin(), produced.end());
+        }
+        produced.clear();
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            consumed.swap(own.blocks);
+        }
+        for (void* ptr : consumed) {
+            workload_free(thread, ptr);
+        }
+        consumed.clear();
+    }
+}
+
+static void run_request_bursts(WorkloadThread& thread) {
+    WorkloadRun& run = *thread.run;
+    std::vector<void*> blocks;
+    while (thread.operations < run.operations) {
+        size_t object_id = run.tracked ? ansi_c_mem_track_create_arena() : 0;
+        if (run.tracked && object_id == 0) {
+            // Without memory for an arena the request still needs an object ID of its own
+            object_id = ansi_c_mem_track_get_next_object_id();
+        }
+        size_t count = 32 + thread.random() % 225;
+        for (size_t i = 0; i < count; ++i) {
+            blocks.push_back(workload_malloc(thread, 8 + thread.random() % 505, object_id));
+        }
+        // The whole request is released at once, as one operation
+        uint64_t start = now_ns();
+        if (run.tracked) {
+            ansi_c_mem_track_free_by_object_id(object_id);
+        }
+        else {
+            for (void* ptr : blocks) {
+                std::free(ptr);
+            }
+        }
+        thread.latencies.record(now_ns() - start);
+        ++thread.operations;
+        blocks.clear();
+    }
+}
+
+static void run_cache_churn(WorkloadThread& thread) {
+    WorkloadRun& run = *thread.run;
+    std::vector<void*> cache(run.cache_blocks);
+    for (size_t i = 0; i < cache.size(); ++i) {
+        cache[i] = run.tracked ? MEM_TRACK_MALLOC(workload_block_size(thread.random), char, 0)
+            : std::malloc(workload_block_size(thread.random));
+    }
+    while (thread.operations < run.operations) {
+        size_t slot = thread.random() % cache.size();
+        workload_free(thread, cache[slot]);
+        cache[slot] = workload_malloc(thread, workload_block_size(thread.random), 0);
+    }
+    for (void* ptr : cache) {
+        if (run.tracked) {
+            ansi_c_mem_track_free(ptr);
+        }
+        else {
+            std::free(ptr);
+        }
+    }
+}
+
+static void run_realloc_growth(WorkloadThread& thread) {
+    const size_t buffer_count = 16;
+    const size_t step = 128;
+    const size_t limit = 64 * 1024;
+    WorkloadRun& run = *thread.run;
+    void* buffers[buffer_count];
+    size_t sizes[buffer_count];
+    for (size_t i = 0; i < buffer_count; ++i) {
+        buffers[i] = NULL;
+        sizes[i] = 0;
+    }
+    while (thread.operations < run.operations) {
+        size_t i = thread.random() % buffer_count;
+        if (sizes[i] >= limit) {
+            workload_free(thread, buffers[i]);
+            buffers[i] = NULL;
+            sizes[i] = 0;
+        }
+        if (!buffers[i]) {
+            buffers[i] = workload_malloc(thread, step, 0);
+            sizes[i] = step;
+            continue;
+        }
+        void* grown = workload_realloc(thread, buffers[i], sizes[i] + step);
+        if (grown) {
+            // The new part is written, like the appended data of a growing buffer
+            std::memset((char*)grown + sizes[i], 'B', step);
+            buffers[i] = grown;
+            sizes[i] += step;
+        }
+    }
+    for (size_t i = 0; i < buffer_count; ++i) {
+        if (run.tracked) {
+            ansi_c_mem_track_free(buffers[i]);
+        }
+        else {
+            std::free(buffers[i]);
+        }
+    }
+}
+
+static void run_workload_thread(WorkloadThread* thread) {
+    while (!thread->run->is_started.load()) {
+        std::this_thread::yield();
+    }
+    if (thread->run->kind == WORKLOAD_PRODUCER_CONSUMER) {
+        run_producer_consumer(*thread);
+    }
+    else if (thread->run->kind == WORKLOAD_REQUEST_BURSTS) {
+        run_request_bursts(*thread);
+    }
+    else if (thread->run->kind == WORKLOAD_CACHE_CHURN) {
+        run_cache_churn(*thread);
+    }
+    else {
+        run_realloc_growth(*thread);
+    }
+}
+
+/**
+ * @brief Resets the peak resident set size of the process, where the system allows it.
+ */
+static void reset_peak_rss() {
+#if defined(__linux__)
+    FILE* file = std::fopen("/proc/self/clear_refs", "w");
+    if (file) {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+#endif
+}
+
+/**
+ * @brief Returns the peak resident set size in KiB: since the last reset_peak_rss on Linux, and since the start
+ * of the process elsewhere.
+ */
+static size_t peak_rss_kib() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return (size_t)(counters.PeakWorkingSetSize / 1024);
+#elif defined(__linux__)
+    FILE* file = std::fopen("/proc/self/status", "r");
+    if (!file) {
+        return 0;
+    }
+    char line[256];
+    size_t peak = 0;
+    while (std::fgets(line, sizeof(line), file)) {
+        if (std::strncmp(line, "VmHWM:", 6) == 0) {
+            peak = (size_t)std::strtoul(line + 6, NULL, 10);
+            break;
+        }
+    }
+    std::fclose(file);
+    return peak;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss / 1024;
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+/**
+ * @brief Runs a workload on the given number of threads with one allocator and prints its row.
+ */
+static void run_workload(FILE* output, const std::string& build, WorkloadKind kind, size_t threads, bool tracked,
+    const Options& options) {
+    WorkloadRun run;
+    run.kind = kind;
+    run.tracked = tracked;
+    run.threads = threads;
+    run.operations = options.workload_operations;
+    run.cache_blocks = options.cache_blocks;
+    run.queues = std::vector<HandoffQueue>(threads);
+    std::vector<WorkloadThread> states(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        states[i].run = &run;
+        states[i].index = i;
+        states[i].random.seed(RANDOM_SEED + (unsigned int)i);
+        states[i].operations = 0;
+    }
+    reset_peak_rss();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.push_back(std::thread(run_workload_thread, &states[i]));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    run.is_started.store(true);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = seconds_since(start);
+    size_t peak_rss = peak_rss_kib();
+    // The blocks still on their way to a consumer are released outside the measurement
+    for (HandoffQueue& queue : run.queues) {
+        for (void* ptr : queue.blocks) {
+            if (tracked) {
+                ansi_c_mem_track_free(ptr);
+            }
+            else {
+                std::free(ptr);
+            }
+        }
+    }
+
+    LatencyHistogram latencies;
+    for (const WorkloadThread& state : states) {
+        latencies.merge(state.latencies);
+    }
+    uint64_t operations = latencies.operations();
+    std::fprintf(output, "%s,%s,%s,%lu,%llu,%.3f,%.0f,%llu,%llu,%llu,%llu,%lu\n", build.c_str(),
+        tracked ? "tracker" : "system", workload_names[kind], (unsigned long)threads, (unsigned long long)operations,
+        seconds, seconds > 0.0 ? (double)operations / seconds : 0.0, (unsigned long long)latencies.percentile(0.5),
+        (unsigned long long)latencies.percentile(0.99), (unsigned long long)latencies.percentile(0.999),
+        (unsigned long long)latencies.maximum(), (unsigned long)peak_rss);
+    std::fflush(output);
+}
+
+/**
+ * @brief Runs the selected workloads at 1, 2, 4, ... and the maximum number of threads. Without a thread-safe build
+ * of the tracker only one thread is run.
+ */
+static void run_workloads(FILE* output, const std::string& build, const Options& options) {
+    size_t max_threads = options.max_threads;
+    if (!IS_THREAD_SAFE && max_threads > 1) {
+        std::fprintf(stderr, "The tracker is not thread-safe in this build, the workloads run on one thread\n");
+        max_threads = 1;
+    }
+    std::fprintf(output, "build,allocator,workload,threads,operations,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,"
+        "peak_rss_kib\n");
+    for (WorkloadKind kind : options.workloads) {
+        for (size_t threads = 1; threads <= max_threads;
+            threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2) {
+            std::fprintf(stderr, "%s on %lu threads\n", workload_names[kind], (unsigned long)threads);
+            run_workload(output, build, kind, threads, false, options);
+            run_workload(output, build, kind, threads, true, options);
+        }
+    }
+}
+
+
+/**
+ * @brief Runs the microbenchmarks of all selected live sets, block sizes and patterns.
+ *
+ * @return false if a lookup of the tracker did not find its block.
+ */
+static bool run_benchmarks(FILE* output, const std::string& build, const Options& options) {
+    bool is_valid = true;
+    std::fprintf(output, "build,allocator,operation,pattern,live_blocks,block_size,operations,ns_per_op,ops_per_sec\n");
+    for (size_t live = options.min_live; live <= options.max_live; live = live > options.max_live / 10 ? options.max_live + 1 : live * 10) {
+        for (size_t block_size : options.sizes) {
+            // The realloc doubles the blocks
+            if (live > options.max_memory / (block_size * 2)) {
+                std::fprintf(stderr, "Skipping %lu blocks of %lu bytes, more than --max-memory\n", (unsigned long)live,
+                    (unsigned long)block_size);
+                continue;
+            }
+            for (Pattern pattern : options.patterns) {
+                std::fprintf(stderr, "%lu blocks of %lu bytes, %s\n", (unsigned long)live, (unsigned long)block_size,
+                    pattern_names[pattern]);
+                if (!run_benchmark(output, build, live, block_size, pattern, options)) {
+                    std::fprintf(stderr, "The tracker did not find blocks of %lu bytes\n", (unsigned long)block_size);
+                    is_valid = false;
+                }
+            }
+        }
+    }
+    return is_valid;
+}
+
+/**
+ * @brief Parses a list of numbers separated by commas.
+ */
+static std::vector<size_t> parse_sizes(const char* text) {
+    std::vector<size_t> sizes;
+    for (const char* item = text; *item; ) {
+        char* end = NULL;
+        size_t size = (size_t)std::strtoul(item, &end, 10);
+        if (end == item) {
+            return std::vector<size_t>();
+        }
+        if (size > 0) {
+            sizes.push_back(size);
+        }
+        item = *end == ',' ? end + 1 : end;
+    }
+    return sizes;
+}
+
+/**
+ * @brief Parses a list of names separated by commas into their indices in a table of names. "all" selects all names.
+ *
+ * @return false if a name is not in the table or the list is empty.
+ */
+static bool parse_names(const std::string& text, const char* const* names, size_t name_count, std::vector<size_t>& indices) {
+    indices.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        std::string name = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t index = 0;
+        while (index < name_count && name != names[index]) {
+            ++index;
+        }
+        if (name == "all") {
+            for (index = 0; index < name_count; ++index) {
+                indices.push_back(index);
+            }
+        }
+        else if (index < name_count) {
+            indices.push_back(index);
+        }
+        else {
+            return false;
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return !indices.empty();
+}
+
+static void print_usage(void) {
+    std::fprintf(stderr,
+        "Usage: AnsiCMemTrackBench [--min-live <count>] [--max-live <count>] [--sizes <list>]\n"
+        "                          [--patterns <list>] [--min-ops <count>] [--max-memory <MiB>] [--output <file>]\n"
+        "       AnsiCMemTrackBench --workloads <list> [--threads <count>] [--ops <count>] [--cache-blocks <count>]\n"
+        "                          [--output <file>]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--min-live" && has_value) {
+            options.min_live = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--max-live" && has_value) {
+            options.max_live = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--sizes" && has_value) {
+            options.sizes = parse_sizes(argv[++i]);
+        }
+        else if (arg == "--patterns" && has_value) {
+            std::vector<size_t> indices;
+            if (!parse_names(argv[++i], pattern_names, PATTERN_COUNT, indices)) {
+                print_usage();
+                return 1;
+            }
+            options.patterns.clear();
+            for (size_t index : indices) {
+                options.patterns.push_back((Pattern)index);
+            }
+        }
+        else if (arg == "--workloads" && has_value) {
+            std::vector<size_t> indices;
+            if (!parse_names(argv[++i], workload_names, WORKLOAD_COUNT, indices)) {
+                print_usage();
+                return 1;
+            }
+            for (size_t index : indices) {
+                options.workloads.push_back((WorkloadKind)index);
+            }
+        }
+        else if (arg == "--threads" && has_value) {
+            options.max_threads = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--ops" && has_value) {
+            options.workload_operations = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--cache-blocks" && has_value) {
+            options.cache_blocks = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--min-ops" && has_value) {
+            options.min_operations = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--max-memory" && has_value) {
+            options.max_memory = (size_t)std::strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else if (arg == "--output" && has_value) {
+            options.output_file_name = argv[++i];
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (options.min_live == 0 || options.max_live < options.min_live || options.sizes.empty()
+        || options.max_threads == 0 || options.cache_blocks == 0) {
+        print_usage();
+        return 1;
+    }
+
+    FILE* output = stdout;
+    if (options.output_file_name) {
+        output = std::fopen(options.output_file_name, "w");
+        if (!output) {
+            std::fprintf(stderr, "Cannot open %s\n", options.output_file_name);
+            return 1;
+        }
+    }
+    if (!ansi_c_mem_track_init()) {
+        std::fprintf(stderr, "Cannot initialize the tracker\n");
+        return 1;
+    }
+    std::string build = build_name();
+    bool is_valid = true;
+    if (options.workloads.empty()) {
+        is_valid = run_benchmarks(output, build, options);
+    }
+    else {
+        run_workloads(output, build, options);
+    }
+    ansi_c_mem_track_cleanup_allocations();
+    ansi_c_mem_track_deinit();
+    if (output != stdout) {
+        std::fclose(output);
+    }
+    return is_valid ? 0 : 1;
+}
@@ -0,0 +1,646 @@
+// AnsiCMemTrackTrace.cpp : Analyzes and replays the binary trace written by ansi_c_mem_track_start_trace().
+//
+// Usage: AnsiCMemTrackTrace <trace name> [options]
+//   --sites <file>       Names the call sites with a file written by ansi_c_mem_track_dump_call_sites().
+//   --at <seconds>       Rebuilds the heap as it was at this time of the trace instead of at its end.
+//   --blocks             Lists every live block of the rebuilt heap.
+//   --interval <seconds> The length of a row of the allocation rate timeline, 1 second by default.
+//   --top <count>        The number of call sites in the reports, 10 by default.
+//   --replay             Replays the trace against the system allocator and the tracker and reports the overhead.
+//
+// The trace files are read one buffer of events at a time, in the order of their sequence numbers, and the timeline
+// is printed while they are read. The memory used depends on the number of blocks live at the same time and on the
+// number of call sites, not on the length of the trace.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "include/ansi_c_mem_track.h"
+#include "src/ansi_c_mem_track_trace.h"
+}
+
+/**
+ * @brief The number of events read from a trace file at a time.
+ */
+const size_t TRACE_READ_BUFFER_EVENTS = 4096;
+
+/**
+ * @brief Reads the events of all files of a trace in order.
+ */
+class TraceReader {
+public:
+    /**
+     * @brief Finds the files `<trace_name>.0`, `<trace_name>.1`, ... and orders them by their sequence numbers.
+     * Files left from an earlier trace with the same name are skipped.
+     *
+     * @return true if at least one file was found.
+     */
+    bool open(const std::string& trace_name) {
+        for (size_t i = 0;; ++i) {
+            std::string name = trace_name + "." + std::to_string(i);
+            FILE* file = std::fopen(name.c_str(), "rb");
+            if (!file) {
+                break;
+            }
+            TraceFileInfo info;
+            info.name = name;
+            bool valid = std::fread(&info.header, sizeof(info.header), 1, file) == 1
+                && std::memcmp(info.header.magic, TRACE_FILE_MAGIC, sizeof(info.header.magic)) == 0
+                && info.header.version == TRACE_FILE_VERSION
+                && info.header.event_size == sizeof(TraceEvent);
+            std::fclose(file);
+            if (valid) {
+                files.push_back(info);
+            }
+            else {
+                std::fprintf(stderr, "Skipping %s, it is not a trace file of this version\n", name.c_str());
+            }
+        }
+        if (files.empty()) {
+            return false;
+        }
+        uint64_t start_time = 0;
+        for (const TraceFileInfo& info : files) {
+            start_time = std::max(start_time, info.header.start_time);
+        }
+        files.erase(std::remove_if(files.begin(), files.end(),
+            [start_time](const TraceFileInfo& info) { return info.header.start_time != start_time; }), files.end());
+        std::sort(files.begin(), files.end(),
+            [](const TraceFileInfo& a, const TraceFileInfo& b) { return a.header.sequence < b.header.sequence; });
+        clock_frequency = files[0].header.clock_frequency ? files[0].header.clock_frequency : 1;
+        buffer.resize(TRACE_READ_BUFFER_EVENTS);
+        rewind();
+        return true;
+    }
+
+    /**
+     * @brief Starts reading from the first event again.
+     */
+    void rewind() {
+        close_file();
+        file_index = 0;
+        buffer_position = 0;
+        buffer_size = 0;
+    }
+
+    /**
+     * @brief Reads the next event.
+     *
+     * @return false at the end of the trace.
+     */
+    bool next(TraceEvent& event) {
+        while (buffer_position == buffer_size) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        event = buffer[buffer_position++];
+        return true;
+    }
+
+    /**
+     * @brief Converts a timestamp to seconds since the trace started.
+     */
+    double seconds(uint64_t timestamp) const {
+        return (double)timestamp / (double)clock_frequency;
+    }
+
+    /**
+     * @brief Converts seconds since the trace started to a timestamp.
+     */
+    uint64_t timestamp(double seconds) const {
+        return (uint64_t)(seconds * (double)clock_frequency);
+    }
+
+    size_t file_count() const {
+        return files.size();
+    }
+
+    uint64_t first_sequence() const {
+        return files.front().header.sequence;
+    }
+
+    ~TraceReader() {
+        close_file();
+    }
+
+private:
+    struct TraceFileInfo {
+        std::string name;
+        TraceFileHeader header;
+    };
+
+    /**
+     * @brief Reads the next buffer of events, opening the next file when the current one is finished.
+     *
+     * @return false if there are no more files.
+     */
+    bool fill() {
+        buffer_position = 0;
+        buffer_size = 0;
+        if (!file) {
+            if (file_index == files.size()) {
+                return false;
+            }
+            file = std::fopen(files[file_index].name.c_str(), "rb");
+            if (!file || std::fseek(file, (long)sizeof(TraceFileHeader), SEEK_SET) != 0) {
+                std::fprintf(stderr, "Cannot read %s\n", files[file_index].name.c_str());
+                close_file();
+                ++file_index;
+                return true;
+            }
+            // The event count is 0 in a file that was not closed, it is then read up to the first unused event
+            remaining = files[file_index].header.event_count ? files[file_index].header.event_count : UINT64_MAX;
+        }
+        size_t count = (size_t)std::min<uint64_t>(remaining, buffer.size());
+        size_t read = std::fread(buffer.data(), sizeof(TraceEvent), count, file);
+        while (buffer_size < read && buffer[buffer_size].op != TRACE_OP_NONE) {
+            ++buffer_size;
+        }
+        remaining -= read;
+        if (buffer_size < count || remaining == 0) {
+            close_file();
+            ++file_index;
+        }
+        return true;
+    }
+
+    void close_file() {
+        if (file) {
+            std::fclose(file);
+            file = NULL;
+        }
+    }
+
+    std::vector<TraceFileInfo> files;
+    size_t file_index = 0;
+    FILE* file = NULL;
+    uint64_t remaining = 0;
+    std::vector<TraceEvent> buffer;
+    size_t buffer_position = 0;
+    size_t buffer_size = 0;
+    uint64_t clock_frequency = 1;
+};
+
+/**
+ * @brief The strings of a call site, read from the output of ansi_c_mem_track_dump_call_sites().
+ */
+struct CallSiteNames {
+    std::string file_name;
+    std::string comment;
+    std::string type;
+    bool known = false;
+};
+
+/**
+ * @brief Reverts the escaping of ansi_c_mem_track_dump_call_sites().
+ */
+static std::string unescape(const std::string& text) {
+    std::string result;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\\' && i + 1 < text.size()) {
+            char c = text[++i];
+            result += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+        }
+        else {
+            result += text[i];
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Reads the call site names, indexed by their IDs.
+ *
+ * @return false if the file could not be read.
+ */
+static bool read_call_sites(const char* file_name, std::vector<CallSiteNames>& call_sites) {
+    std::ifstream file(file_name);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+        size_t third = second == std::string::npos ? second : line.find('\t', second + 1);
+        if (third == std::string::npos) {
+            continue;
+        }
+        size_t id = (size_t)std::strtoul(line.c_str(), NULL, 10);
+        if (id >= call_sites.size()) {
+            call_sites.resize(id + 1);
+        }
+        call_sites[id].file_name = unescape(line.substr(first + 1, second - first - 1));
+        call_sites[id].comment = unescape(line.substr(second + 1, third - second - 1));
+        call_sites[id].type = unescape(line.substr(third + 1));
+        call_sites[id].known = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Returns a printable name of a call site.
+ */
+static std::string call_site_label(const std::vector<CallSiteNames>& call_sites, uint32_t id) {
+    if (id == 0) {
+        return "(unknown call site)";
+    }
+    if (id < call_sites.size() && call_sites[id].known) {
+        const CallSiteNames& names = call_sites[id];
+        return names.file_name + ": " + names.comment + (names.type.empty() ? "" : " (" + names.type + ")");
+    }
+    return "call site " + std::to_string(id);
+}
+
+/**
+ * @brief A block that is allocated at the current point of the trace.
+ */
+struct LiveBlock {
+    uint64_t size;
+    uint64_t object_id;
+    uint32_t call_site_id;
+};
+
+/**
+ * @brief The statistics of a call site.
+ */
+struct CallSiteStats {
+    uint64_t allocations = 0;     /**< The number of mallocs and reallocs. */
+    uint64_t allocated_bytes = 0; /**< The bytes requested by the mallocs and reallocs. */
+    uint64_t live_blocks = 0;     /**< The number of blocks allocated at the current point. */
+    uint64_t live_bytes = 0;      /**< The bytes of the blocks allocated at the current point. */
+};
+
+/**
+ * @brief The heap rebuilt from the events seen so far.
+ */
+class HeapState {
+public:
+    void apply(const TraceEvent& event) {
+        ++event_count;
+        if (event.op == TRACE_OP_MALLOC) {
+            allocate(event);
+        }
+        else if (event.op == TRACE_OP_REALLOC) {
+            if (event.old_address) {
+                release(event.old_address);
+            }
+            allocate(event);
+        }
+        else if (event.op == TRACE_OP_FREE) {
+            release(event.address);
+        }
+        else if (event.op == TRACE_OP_FREE_OBJECT_ID) {
+            ++object_frees;
+        }
+        if (live_bytes > peak_bytes) {
+            peak_bytes = live_bytes;
+            peak_blocks = blocks.size();
+            peak_timestamp = event.timestamp;
+        }
+    }
+
+    std::unordered_map<uint64_t, LiveBlock> blocks;
+    std::unordered_map<uint32_t, CallSiteStats> call_sites;
+    uint64_t event_count = 0;
+    uint64_t live_bytes = 0;
+    uint64_t peak_bytes = 0;
+    uint64_t peak_blocks = 0;
+    uint64_t peak_timestamp = 0;
+    uint64_t object_frees = 0;
+    uint64_t unmatched_frees = 0;
+
+private:
+    void allocate(const TraceEvent& event) {
+        // An address that is still live lost its free before the oldest file of the trace, which was overwritten
+        release(event.address, false);
+        LiveBlock block = { event.size, event.object_id, event.call_site_id };
+        blocks[event.address] = block;
+        CallSiteStats& stats = call_sites[event.call_site_id];
+        ++stats.allocations;
+        stats.allocated_bytes += event.size;
+        ++stats.live_blocks;
+        stats.live_bytes += event.size;
+        live_bytes += event.size;
+    }
+
+    void release(uint64_t address, bool count_unmatched = true) {
+        std::unordered_map<uint64_t, LiveBlock>::iterator it = blocks.find(address);
+        if (it == blocks.end()) {
+            // The block was allocated before the oldest file of the trace
+            unmatched_frees += count_unmatched ? 1 : 0;
+            return;
+        }
+        CallSiteStats& stats = call_sites[it->second.call_site_id];
+        --stats.live_blocks;
+        stats.live_bytes -= it->second.size;
+        live_bytes -= it->second.size;
+        blocks.erase(it);
+    }
+};
+
+/**
+ * @brief Options of the command line.
+ */
+struct Options {
+    const char* trace_name = NULL;
+    const char* sites_file_name = NULL;
+    double at_seconds = -1.0;
+    bool list_blocks = false;
+    double interval_seconds = 1.0;
+    size_t top = 10;
+    bool replay = false;
+};
+
+/**
+ * @brief One row of the allocation rate timeline.
+ */
+struct TimelineRow {
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    uint64_t frees = 0;
+};
+
+static void print_timeline_row(uint64_t interval, const TimelineRow& row, double interval_seconds, const HeapState& heap) {
+    std::printf("%10.3f %14.0f %14.3f %14.0f %14.3f\n", (double)interval * interval_seconds,
+        (double)row.allocations / interval_seconds, (double)row.allocated_bytes / interval_seconds / 1048576.0,
+        (double)row.frees / interval_seconds, (double)heap.live_bytes / 1048576.0);
+}
+
+/**
+ * @brief Prints the call sites with the largest values of a statistic.
+ */
+static void print_top_call_sites(const HeapState& heap, const std::vector<CallSiteNames>& names, size_t top,
+    bool by_live_bytes) {
+    std::vector<std::pair<uint32_t, CallSiteStats>> sites(heap.call_sites.begin(), heap.call_sites.end());
+    if (by_live_bytes) {
+        sites.erase(std::remove_if(sites.begin(), sites.end(),
+            [](const std::pair<uint32_t, CallSiteStats>& site) { return site.second.live_blocks == 0; }), sites.end());
+    }
+    std::sort(sites.begin(), sites.end(),
+        [by_live_bytes](const std::pair<uint32_t, CallSiteStats>& a, const std::pair<uint32_t, CallSiteStats>& b) {
+            return by_live_bytes ? a.second.live_bytes > b.second.live_bytes
+                : a.second.allocated_bytes > b.second.allocated_bytes;
+        });
+    if (sites.size() > top) {
+        sites.resize(top);
+    }
+    for (const std::pair<uint32_t, CallSiteStats>& site : sites) {
+        if (by_live_bytes) {
+            std::printf("  %14llu bytes in %10llu blocks  %s\n", (unsigned long long)site.second.live_bytes,
+                (unsigned long long)site.second.live_blocks, call_site_label(names, site.first).c_str());
+        }
+        else {
+            std::printf("  %14llu bytes in %10llu allocations  %s\n", (unsigned long long)site.second.allocated_bytes,
+                (unsigned long long)site.second.allocations, call_site_label(names, site.first).c_str());
+        }
+    }
+}
+
+/**
+ * @brief Streams the trace into the heap state and prints the timeline and the reports.
+ */
+static void analyze(TraceReader& reader, const Options& options, const std::vector<CallSiteNames>& names) {
+    HeapState heap;
+    uint64_t interval_ticks = std::max<uint64_t>(reader.timestamp(options.interval_seconds), 1);
+    uint64_t stop_timestamp = options.at_seconds >= 0.0 ? reader.timestamp(options.at_seconds) : UINT64_MAX;
+    uint64_t last_timestamp = 0;
+    uint64_t interval = 0;
+    TimelineRow row;
+    bool row_empty = true;
+
+    std::printf("Allocation rate timeline\n%10s %14s %14s %14s %14s\n", "time [s]", "allocs/s", "alloc MiB/s",
+        "frees/s", "live MiB");
+    TraceEvent event;
+    while (reader.next(event) && event.timestamp <= stop_timestamp) {
+        // The events of different threads may be slightly out of order, an older one counts in the current row
+        uint64_t event_interval = event.timestamp / interval_ticks;
+        if (event_interval > interval) {
+            if (!row_empty) {
+                print_timeline_row(interval, row, options.interval_seconds, heap);
+            }
+            interval = event_interval;
+            row = TimelineRow();
+            row_empty = true;
+        }
+        heap.apply(event);
+        row_empty = false;
+        if (event.op == TRACE_OP_MALLOC || event.op == TRACE_OP_REALLOC) {
+            ++row.allocations;
+            row.allocated_bytes += event.size;
+        }
+        else if (event.op == TRACE_OP_FREE) {
+            ++row.frees;
+        }
+        last_timestamp = std::max(last_timestamp, event.timestamp);
+    }
+    if (!row_empty) {
+        print_timeline_row(interval, row, options.interval_seconds, heap);
+    }
+
+    std::printf("\nTrace: %llu events in %lu files from sequence %llu, %.3f s\n", (unsigned long long)heap.event_count,
+        (unsigned long)reader.file_count(), (unsigned long long)reader.first_sequence(), reader.seconds(last_timestamp));
+    if (heap.unmatched_frees) {
+        std::printf("Frees of blocks allocated before the oldest file: %llu\n", (unsigned long long)heap.unmatched_frees);
+    }
+    std::printf("Calls of ansi_c_mem_track_free_by_object_id: %llu\n", (unsigned long long)heap.object_frees);
+    std::printf("Peak: %llu bytes in %llu blocks at %.3f s\n", (unsigned long long)heap.peak_bytes,
+        (unsigned long long)heap.peak_blocks, reader.seconds(heap.peak_timestamp));
+
+    std::printf("\nTop call sites by allocated bytes\n");
+    print_top_call_sites(heap, names, options.top, false);
+
+    if (options.at_seconds >= 0.0) {
+        std::printf("\nHeap at %.3f s: %llu bytes in %lu blocks\n", options.at_seconds,
+            (unsigned long long)heap.live_bytes, (unsigned long)heap.blocks.size());
+    }
+    else {
+        std::printf("\nLeaks at exit: %llu bytes in %lu blocks\n", (unsigned long long)heap.live_bytes,
+            (unsigned long)heap.blocks.size());
+    }
+    print_top_call_sites(heap, names, options.top, true);
+
+    if (options.list_blocks) {
+        std::printf("\nLive blocks\n");
+        for (const std::pair<const uint64_t, LiveBlock>& block : heap.blocks) {
+            std::printf("  0x%llx %llu bytes, object ID %llu, %s\n", (unsigned long long)block.first,
+                (unsigned long long)block.second.size, (unsigned long long)block.second.object_id,
+                call_site_label(names, block.second.call_site_id).c_str());
+        }
+    }
+}
+
+/**
+ * @brief Replays the allocations of the trace on one thread, with the system allocator or with the tracker.
+ *
+ * The blocks of an ansi_c_mem_track_free_by_object_id call are freed by the FREE events that follow it, so both
+ * allocators replay the same calls. Reading the trace and mapping its addresses costs the same in both cases.
+ *
+ * @return The elapsed time in seconds.
+ */
+static double replay(TraceReader& reader, bool tracked, const std::vector<CallSiteNames>& names, uint64_t& operations) {
+    std::unordered_map<uint64_t, void*> addresses;
+    operations = 0;
+    reader.rewind();
+    TraceEvent event;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (reader.next(event)) {
+        if (event.op == TRACE_OP_MALLOC || event.op == TRACE_OP_REALLOC) {
+            void* old_ptr = NULL;
+            std::unordered_map<uint64_t, void*>::iterator it = addresses.find(event.op == TRACE_OP_MALLOC ? event.address : event.old_address);
+            if (it != addresses.end()) {
+                old_ptr = it->second;
+                addresses.erase(it);
+            }
+            void* ptr;
+            if (tracked) {
+                if (event.op == TRACE_OP_REALLOC && old_ptr) {
+                    ptr = ansi_c_mem_track_realloc(old_ptr, (size_t)event.size, (size_t)event.object_id);
+                }
+                else {
+                    if (old_ptr) {
+                        ansi_c_mem_track_free(old_ptr);
+                    }
+                    const CallSiteNames* site = event.call_site_id < names.size() && names[event.call_site_id].known
+                        ? &names[event.call_site_id] : NULL;
+                    ptr = ansi_c_mem_track_malloc((size_t)event.size, site ? site->file_name.c_str() : NULL,
+                        site ? site->comment.c_str() : NULL, site ? site->type.c_str() : NULL, (size_t)event.object_id);
+                }
+            }
+            else {
+                if (event.op == TRACE_OP_REALLOC && old_ptr) {
+                    ptr = std::realloc(old_ptr, (size_t)event.size);
+                }
+                else {
+                    std::free(old_ptr);
+                    ptr = std::malloc((size_t)event.size);
+                }
+            }
+            if (ptr) {
+                addresses[event.address] = ptr;
+            }
+            ++operations;
+        }
+        else if (event.op == TRACE_OP_FREE) {
+            std::unordered_map<uint64_t, void*>::iterator it = addresses.find(event.address);
+            if (it != addresses.end()) {
+                if (tracked) {
+                    ansi_c_mem_track_free(it->second);
+                }
+                else {
+                    std::free(it->second);
+                }
+                addresses.erase(it);
+                ++operations;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // The blocks leaked by the traced program are released outside the measurement
+    for (const std::pair<const uint64_t, void*>& address : addresses) {
+        if (tracked) {
+            ansi_c_mem_track_free(address.second);
+        }
+        else {
+            std::free(address.second);
+        }
+    }
+    return elapsed;
+}
+
+/**
+ * @brief Replays the trace with the system allocator, the tracker and the system allocator again, and prints the
+ * overhead of the tracker against the faster system run.
+ */
+static void replay_overhead(TraceReader& reader, const std::vector<CallSiteNames>& names) {
+    uint64_t operations = 0;
+    double system_seconds = replay(reader, false, names, operations);
+    if (!ansi_c_mem_track_init()) {
+        std::fprintf(stderr, "Cannot initialize the tracker\n");
+        return;
+    }
+    double tracked_seconds = replay(reader, true, names, operations);
+    ansi_c_mem_track_cleanup_allocations();
+    ansi_c_mem_track_deinit();
+    system_seconds = std::min(system_seconds, replay(reader, false, names, operations));
+    if (operations == 0) {
+        std::printf("\nReplay: the trace holds no operations\n");
+        return;
+    }
+    double system_ns = system_seconds * 1e9 / (double)operations;
+    double tracked_ns = tracked_seconds * 1e9 / (double)operations;
+    std::printf("\nReplay of %llu operations\n", (unsigned long long)operations);
+    std::printf("  system:  %10.1f ns/op\n", system_ns);
+    std::printf("  tracker: %10.1f ns/op\n", tracked_ns);
+    std::printf("  overhead: %9.1f ns/op (%.1f%%)\n", tracked_ns - system_ns,
+        system_ns > 0.0 ? (tracked_ns - system_ns) * 100.0 / system_ns : 0.0);
+}
+
+static void print_usage(void) {
+    std::fprintf(stderr,
+        "Usage: AnsiCMemTrackTrace <trace name> [--sites <file>] [--at <seconds>] [--blocks]\n"
+        "                          [--interval <seconds>] [--top <count>] [--replay]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sites" && has_value) {
+            options.sites_file_name = argv[++i];
+        }
+        else if (arg == "--at" && has_value) {
+            options.at_seconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--blocks") {
+            options.list_blocks = true;
+        }
+        else if (arg == "--interval" && has_value) {
+            options.interval_seconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--top" && has_value) {
+            options.top = (size_t)std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--replay") {
+            options.replay = true;
+        }
+        else if (!options.trace_name && arg[0] != '-') {
+            options.trace_name = argv[i];
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (!options.trace_name || options.interval_seconds <= 0.0) {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<CallSiteNames> names;
+    if (options.sites_file_name && !read_call_sites(options.sites_file_name, names)) {
+        std::fprintf(stderr, "Cannot read %s\n", options.sites_file_name);
+        return 1;
+    }
+    TraceReader reader;
+    if (!reader.open(options.trace_name)) {
+        std::fprintf(stderr, "No trace files named %s.0, %s.1, ...\n", options.trace_name, options.trace_name);
+        return 1;
+    }
+    analyze(reader, options, names);
+    if (options.replay) {
+        replay_overhead(reader, names);
+    }
+    return 0;
+}
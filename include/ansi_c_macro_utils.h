@@ -1,6 +1,31 @@
 #ifndef ANSI_C_MACRO_UTILS_H
 #define ANSI_C_MACRO_UTILS_H
 
+// The per-thread tracking tables find their owner through the inline header and need the locks
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    #ifndef ANSI_C_MEM_TRACK_THREAD_SAFE
+        #define ANSI_C_MEM_TRACK_THREAD_SAFE
+    #endif
+    #ifndef ANSI_C_MEM_TRACK_INLINE_HEADER
+        #define ANSI_C_MEM_TRACK_INLINE_HEADER
+    #endif
+#endif
+
+// The blocks that are not sampled carry their size in the inline header
+#if defined(ANSI_C_MEM_TRACK_SAMPLING) && !defined(ANSI_C_MEM_TRACK_INLINE_HEADER)
+    #define ANSI_C_MEM_TRACK_INLINE_HEADER
+#endif
+
+// The writer thread of the asynchronous log needs the thread and atomic helpers
+#if defined(ANSI_C_MEM_TRACK_ASYNC_LOG) && !defined(ANSI_C_MEM_TRACK_THREAD_SAFE)
+    #define ANSI_C_MEM_TRACK_THREAD_SAFE
+#endif
+
+// The interposed allocator is called by every thread of the program
+#if defined(ANSI_C_MEM_TRACK_PRELOAD) && !defined(ANSI_C_MEM_TRACK_THREAD_SAFE)
+    #define ANSI_C_MEM_TRACK_THREAD_SAFE
+#endif
+
 #ifdef _MSC_VER
     #define STRCPY(dest, destsz, src) strcpy_s(dest, destsz, src)
     #define STRDUP(dest, destsz, src, objid) { \
@@ -21,6 +46,8 @@
     #define SPRINTF sprintf_s
     #define FOPEN fopen_s
     #define localtime_func(time, timeinfo) localtime_s(timeinfo, time)
+    #define ALIGNED_MALLOC(ptr, alignment, size) ((ptr) = _aligned_malloc(size, alignment))
+    #define ALIGNED_FREE(ptr) _aligned_free(ptr)
 #else
     #define STRCPY(dest, destsz, src){ \
         STRNCPY(dest, destsz, src, strlen(src) + 1); \
@@ -33,10 +60,11 @@
         } \
     } 
     #define C_STRDUP(dest, destsz, src){ \
-        size_t _sz = strlen(src) + 1; \
-        dest = malloc(_sz); \
+        size_t _len = strlen(src); \
+        dest = malloc(_len + 1); \
         if (dest) { \
-            STRNCPY(dest, destsz, src, _sz); \
+            memcpy(dest, src, _len); \
+            dest[_len] = '\0'; \
         } \
     } 
     #define STRNCPY(dest, destsz, src, count) { \
@@ -45,12 +73,177 @@
         dest[_sz - 1] = '\0'; \
     } 
     #define SPRINTF sprintf
-    #define FOPEN fopen
+    #define FOPEN(file, file_name, mode) ((*(file) = fopen(file_name, mode)) == NULL)
     #ifdef _POSIX_C_SOURCE
         #define localtime_func(time, timeinfo) localtime_r(time, timeinfo)
     #else
         #define localtime_func(time, timeinfo) localtime(time)
     #endif
+    #define ALIGNED_MALLOC(ptr, alignment, size) { \
+        if (posix_memalign(&(ptr), alignment, size) != 0) { \
+            (ptr) = NULL; \
+        } \
+    }
+    #define ALIGNED_FREE(ptr) free(ptr)
+#endif
+
+/*
+ * Locking and atomic helpers of the thread-safe build. Without ANSI_C_MEM_TRACK_THREAD_SAFE the locks compile
+ * to nothing and the atomics to plain memory accesses.
+ */
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    #ifdef _WIN32
+        #include <windows.h>
+        #define MUTEX_TYPE SRWLOCK
+        #define MUTEX_STATIC_INIT SRWLOCK_INIT
+        #define MUTEX_INIT(m) InitializeSRWLock(m)
+        #define MUTEX_LOCK(m) AcquireSRWLockExclusive(m)
+        #define MUTEX_UNLOCK(m) ReleaseSRWLockExclusive(m)
+        #define MUTEX_DESTROY(m) ((void)(m))
+        #define RWLOCK_TYPE SRWLOCK
+        #define RWLOCK_STATIC_INIT SRWLOCK_INIT
+        #define RWLOCK_READ_LOCK(m) AcquireSRWLockShared(m)
+        #define RWLOCK_READ_UNLOCK(m) ReleaseSRWLockShared(m)
+        #define RWLOCK_WRITE_LOCK(m) AcquireSRWLockExclusive(m)
+        #define RWLOCK_WRITE_UNLOCK(m) ReleaseSRWLockExclusive(m)
+        #define THREAD_KEY_TYPE DWORD
+        #define THREAD_KEY_CREATE(key, destructor) ((*(key) = FlsAlloc(destructor)) != FLS_OUT_OF_INDEXES)
+        #define THREAD_KEY_SET(key, value) FlsSetValue(key, value)
+        #define THREAD_KEY_DELETE(key) FlsFree(key)
+        #define THREAD_KEY_DESTRUCTOR(name, arg) VOID WINAPI name(PVOID arg)
+        #define THREAD_TYPE HANDLE
+        #define THREAD_CREATE(thread, function, arg) ((*(thread) = CreateThread(NULL, 0, function, arg, 0, NULL)) != NULL)
+        #define THREAD_JOIN(thread) do { WaitForSingleObject(thread, INFINITE); CloseHandle(thread); } while (0)
+        #define THREAD_FUNCTION(name, arg) DWORD WINAPI name(LPVOID arg)
+        #define THREAD_RETURN return 0
+        #define THREAD_YIELD() SwitchToThread()
+        #define SLEEP_MS(ms) Sleep(ms)
+    #else
+        #include <pthread.h>
+        #define MUTEX_TYPE pthread_mutex_t
+        #define MUTEX_STATIC_INIT PTHREAD_MUTEX_INITIALIZER
+        #define MUTEX_INIT(m) pthread_mutex_init(m, NULL)
+        #define MUTEX_LOCK(m) pthread_mutex_lock(m)
+        #define MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+        #define MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+        #define RWLOCK_TYPE pthread_rwlock_t
+        #define RWLOCK_STATIC_INIT PTHREAD_RWLOCK_INITIALIZER
+        #define RWLOCK_READ_LOCK(m) pthread_rwlock_rdlock(m)
+        #define RWLOCK_READ_UNLOCK(m) pthread_rwlock_unlock(m)
+        #define RWLOCK_WRITE_LOCK(m) pthread_rwlock_wrlock(m)
+        #define RWLOCK_WRITE_UNLOCK(m) pthread_rwlock_unlock(m)
+        #define THREAD_KEY_TYPE pthread_key_t
+        #define THREAD_KEY_CREATE(key, destructor) (pthread_key_create(key, destructor) == 0)
+        #define THREAD_KEY_SET(key, value) pthread_setspecific(key, value)
+        #define THREAD_KEY_DELETE(key) pthread_key_delete(key)
+        #define THREAD_KEY_DESTRUCTOR(name, arg) void name(void* arg)
+        #include <sched.h>
+        #include <time.h>
+        #define THREAD_TYPE pthread_t
+        #define THREAD_CREATE(thread, function, arg) (pthread_create(thread, NULL, function, arg) == 0)
+        #define THREAD_JOIN(thread) pthread_join(thread, NULL)
+        #define THREAD_FUNCTION(name, arg) void* name(void* arg)
+        #define THREAD_RETURN return NULL
+        #define THREAD_YIELD() sched_yield()
+        #define SLEEP_MS(ms) do { \
+            struct timespec _ts = { (ms) / 1000, ((ms) % 1000) * 1000000L }; \
+            nanosleep(&_ts, NULL); \
+        } while (0)
+    #endif
+    #ifdef _MSC_VER
+        #ifdef _WIN64
+            #define ATOMIC_FETCH_ADD(p, v) ((size_t)InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v)))
+            #define ATOMIC_FETCH_ADD_ORDERED(p, v) ATOMIC_FETCH_ADD(p, v)
+            #define ATOMIC_STORE(p, v) ((void)InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v)))
+            #define ATOMIC_CAS(p, expected, desired) \
+                (InterlockedCompareExchange64((volatile LONG64*)(p), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+        #else
+            #define ATOMIC_FETCH_ADD(p, v) ((size_t)InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(v)))
+            #define ATOMIC_FETCH_ADD_ORDERED(p, v) ATOMIC_FETCH_ADD(p, v)
+            #define ATOMIC_STORE(p, v) ((void)InterlockedExchange((volatile LONG*)(p), (LONG)(v)))
+            #define ATOMIC_CAS(p, expected, desired) \
+                (InterlockedCompareExchange((volatile LONG*)(p), (LONG)(desired), (LONG)(expected)) == (LONG)(expected))
+        #endif
+        #define ATOMIC_LOAD(p) (*(volatile size_t*)(p))
+        #define ATOMIC_LOAD_BOOL(p) (*(volatile bool*)(p))
+        #define ATOMIC_STORE_BOOL(p, v) do { MemoryBarrier(); *(volatile bool*)(p) = (v); } while (0)
+        #define SINGLE_WRITER_ADD(p, v) ((void)(*(volatile size_t*)(p) = *(volatile size_t*)(p) + (v)))
+        #define ATOMIC_LOAD_PTR(p) (*(void* volatile*)(p))
+        #define ATOMIC_STORE_PTR(p, v) ((void)InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v)))
+        #define ATOMIC_EXCHANGE_PTR(p, v) InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v))
+        #define ATOMIC_CAS_PTR(p, expected, desired) \
+            (InterlockedCompareExchangePointer((PVOID volatile*)(p), (PVOID)(desired), (PVOID)(expected)) == (PVOID)(expected))
+    #else
+        #define ATOMIC_FETCH_ADD(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+        #define ATOMIC_FETCH_ADD_ORDERED(p, v) __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL)
+        #define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+        #define ATOMIC_CAS(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+        #define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+        #define ATOMIC_LOAD_BOOL(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+        #define ATOMIC_STORE_BOOL(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+        #define SINGLE_WRITER_ADD(p, v) __atomic_store_n(p, *(p) + (v), __ATOMIC_RELAXED)
+        #define ATOMIC_LOAD_PTR(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+        #define ATOMIC_STORE_PTR(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+        #define ATOMIC_EXCHANGE_PTR(p, v) __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+        #define ATOMIC_CAS_PTR(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+    #endif
+#else
+    #define MUTEX_TYPE char
+    #define MUTEX_STATIC_INIT 0
+    #define MUTEX_INIT(m) ((void)(m))
+    #define MUTEX_LOCK(m) ((void)(m))
+    #define MUTEX_UNLOCK(m) ((void)(m))
+    #define MUTEX_DESTROY(m) ((void)(m))
+    #define RWLOCK_TYPE char
+    #define RWLOCK_STATIC_INIT 0
+    #define RWLOCK_READ_LOCK(m) ((void)(m))
+    #define RWLOCK_READ_UNLOCK(m) ((void)(m))
+    #define RWLOCK_WRITE_LOCK(m) ((void)(m))
+    #define RWLOCK_WRITE_UNLOCK(m) ((void)(m))
+    #define ATOMIC_FETCH_ADD(p, v) ((*(p) += (v)) - (v))
+    #define ATOMIC_FETCH_ADD_ORDERED(p, v) ATOMIC_FETCH_ADD(p, v)
+    #define ATOMIC_STORE(p, v) (*(p) = (v))
+    #define ATOMIC_CAS(p, expected, desired) (*(p) == (expected) ? (*(p) = (desired), true) : false)
+    #define ATOMIC_LOAD(p) (*(p))
+    #define ATOMIC_LOAD_BOOL(p) (*(p))
+    #define ATOMIC_STORE_BOOL(p, v) (*(p) = (v))
+    #define SINGLE_WRITER_ADD(p, v) ((void)(*(p) += (v)))
+    #define ATOMIC_LOAD_PTR(p) (*(p))
+    #define ATOMIC_STORE_PTR(p, v) (*(p) = (v))
+    #define THREAD_YIELD() ((void)0)
+#endif
+
+#ifdef _MSC_VER
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
+// HIGHEST_BIT returns the index of the highest set bit of a nonzero size_t
+#if defined(__GNUC__)
+    #define HIGHEST_BIT(value) \
+        ((unsigned int)(sizeof(unsigned long long) * 8 - 1) - (unsigned int)__builtin_clzll((unsigned long long)(value)))
+#elif defined(_MSC_VER) && defined(_WIN64)
+    #include <intrin.h>
+    static __inline unsigned int highest_bit(size_t value) {
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return (unsigned int)index;
+    }
+    #define HIGHEST_BIT(value) highest_bit(value)
+#else
+    static unsigned int highest_bit(size_t value) {
+        unsigned int index = 0;
+        while (value >>= 1) {
+            index++;
+        }
+        return index;
+    }
+    #define HIGHEST_BIT(value) highest_bit(value)
 #endif
 
+// SINGLE_WRITER_ADD adds to a value that only the calling thread writes, but other threads may read atomically
+// ATOMIC_FETCH_ADD only makes the addition atomic, ATOMIC_FETCH_ADD_ORDERED also orders the surrounding accesses
+#define ATOMIC_ADD(p, v) ((void)ATOMIC_FETCH_ADD(p, v))
+
 #endif // ANSI_C_MACRO_UTILS_H
\ No newline at end of file
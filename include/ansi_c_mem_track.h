@@ -39,34 +39,229 @@
 #include <stdbool.h>
 
 #define DEFAULT_CAPACITY 100
+#define DEFAULT_INDEX_CAPACITY 256
+#define DEFAULT_OBJECT_INDEX_CAPACITY 64
+#define CALL_SITE_PAGE_SIZE 256
+#define CALL_SITE_PAGE_COUNT 1024
+#define SIZE_HISTOGRAM_SUB_BUCKET_BITS 2
+#define SIZE_HISTOGRAM_SUB_BUCKETS (1 << SIZE_HISTOGRAM_SUB_BUCKET_BITS)
+#define SIZE_HISTOGRAM_BUCKET_COUNT ((sizeof(size_t) * 8 - SIZE_HISTOGRAM_SUB_BUCKET_BITS + 1) * SIZE_HISTOGRAM_SUB_BUCKETS)
+
+/*
+ * Build options, define them when compiling the library:
+ *
+ * ANSI_C_MEM_TRACK_INLINE_HEADER - Stores a small header in front of every tracked memory block, which holds the
+ *     slot of the block in the tracking table. Free, realloc and get_block_info then reach the block by pointer
+ *     arithmetic instead of a lookup in the address index. Pointers that were not allocated by the tracker are
+ *     still recognized by a magic word in the header, but the bytes in front of them must be readable.
+ *
+ * ANSI_C_MEM_TRACK_THREAD_SAFE - Makes the tracker safe to use from several threads. The tracking table is split
+ *     into shards, every shard has its own lock, and a memory block is tracked by the shard its address hashes to,
+ *     so threads allocating and freeing different blocks rarely wait for each other. Every thread updates usage
+ *     counters of its own, on separate cache lines, which are summed when the usage information is queried.
+ *     Needs pthreads on POSIX systems.
+ *
+ * ANSI_C_MEM_TRACK_SHARD_COUNT - The number of shards, a power of two. Defaults to 16 in the thread-safe build
+ *     and to 1 otherwise.
+ *
+ * ANSI_C_MEM_TRACK_THREAD_CACHE - Gives every thread its own shard instead of hashing addresses to a fixed set of
+ *     shards, so allocations never contend. Blocks freed by another thread are pushed on a lock-free queue of the
+ *     owning shard and released by its owner. The shard of an exited thread is adopted by the next new thread.
+ *     Implies ANSI_C_MEM_TRACK_THREAD_SAFE and ANSI_C_MEM_TRACK_INLINE_HEADER; ANSI_C_MEM_TRACK_SHARD_COUNT is
+ *     ignored.
+ *
+ * ANSI_C_MEM_TRACK_SLAB - Serves memory blocks of up to SLAB_MAX_BLOCK_SIZE bytes (tracking header included) from
+ *     64 KiB slabs of fixed size classes instead of the system malloc. Freed blocks go back to the free list of
+ *     their slab, empty slabs are released except one per size class, and the slab usage is reported in
+ *     MemoryUsageInfo.
+ *
+ * ANSI_C_MEM_TRACK_ARENA - Gives the object IDs returned by ansi_c_mem_track_create_arena an arena. The blocks of
+ *     such an object ID are bump-allocated from chunks of ANSI_C_MEM_TRACK_ARENA_CHUNK_SIZE bytes (64 KiB by
+ *     default), a realloc of the last block grows it in place, and ansi_c_mem_track_free_by_object_id releases the
+ *     chunks at once. Freeing a single block reclaims its memory only if it was the last one allocated.
+ *
+ * ANSI_C_MEM_TRACK_ASYNC_LOG - The log functions format the message on the calling thread and queue it in a
+ *     lock-free ring buffer of ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE records (4096 by default). A background thread
+ *     writes the messages in batches and flushes the files every ANSI_C_MEM_TRACK_LOG_FLUSH_INTERVAL milliseconds
+ *     (50 by default). When the queue is full the caller waits, or with ANSI_C_MEM_TRACK_ASYNC_LOG_DROP the message
+ *     is dropped and counted. Implies ANSI_C_MEM_TRACK_THREAD_SAFE.
+ *
+ * ANSI_C_MEM_TRACK_TRACE - Enables ansi_c_mem_track_start_trace. Every tracked operation then appends a 48-byte
+ *     event to a memory-mapped file, claiming its space with a single atomic addition, so tracing can stay on
+ *     under load.
+ *
+ * ANSI_C_MEM_TRACK_SAMPLING - Tracks about one block per ANSI_C_MEM_TRACK_SAMPLING_INTERVAL allocated bytes
+ *     (512 KiB by default) with byte-weighted sampling, see ansi_c_mem_track_set_sampling_interval. The other
+ *     blocks only update the usage counters, which stay exact, and carry their size in the block header. Blocks
+ *     with an object ID are always tracked. Implies ANSI_C_MEM_TRACK_INLINE_HEADER; link with the math library.
+ *
+ * ANSI_C_MEM_TRACK_PEAK_SLACK - In the thread-safe build every thread publishes the change of its memory usage
+ *     for the global peak once it reaches this many bytes (64 KiB by default), or 64 blocks for the peak block
+ *     count, so the peaks may miss up to that much per thread. 1 publishes every change, at the price of an atomic
+ *     addition on a shared counter per operation.
+ *
+ * ANSI_C_MEM_TRACK_BACKTRACE - Captures the call stack of every tracked allocation, up to
+ *     ANSI_C_MEM_TRACK_BACKTRACE_DEPTH frames (16 by default). The stacks are deduplicated in a shared table and
+ *     a block stores only the stack ID; the frames are named only by ansi_c_mem_track_print_stack. With
+ *     ANSI_C_MEM_TRACK_SAMPLING only the sampled blocks pay for a capture. The stack is unwound with backtrace()
+ *     on POSIX systems and CaptureStackBackTrace on Windows; ANSI_C_MEM_TRACK_BACKTRACE_FRAME_POINTERS walks the
+ *     frame pointers instead, which is faster but needs code compiled with -fno-omit-frame-pointer.
+ *
+ * ANSI_C_MEM_TRACK_PRELOAD - Defines malloc, calloc, realloc, free, posix_memalign, aligned_alloc, memalign and
+ *     malloc_usable_size on top of the tracker, so the library built as a shared library tracks an unmodified
+ *     program under LD_PRELOAD and reports its usage at exit. Needs glibc, implies ANSI_C_MEM_TRACK_THREAD_SAFE and
+ *     cannot be combined with ANSI_C_MEM_TRACK_THREAD_CACHE. See src/ansi_c_mem_track_preload.h.
+ *
+ * ANSI_C_MEM_TRACK_DISABLE - Turns MEM_TRACK_MALLOC, MEM_TRACK_REALLOC and MEM_TRACK_FREE into plain malloc,
+ *     realloc and free calls. Unlike the options above, define it when compiling the code that uses the macros;
+ *     a release build made this way does not need the library at all.
+ */
 
 /**
- * @brief Memory block structure to store information about allocated memory blocks.
+ * @brief Call site structure to store where and why memory blocks were allocated.
+ *
+ * Every distinct (file_name, comment, type) triple passed to `ansi_c_mem_track_malloc` is stored only once,
+ * and the memory blocks refer to it by its ID. The call site with ID 0 has no file name, comment, or type,
+ * and is used when a call site cannot be recorded. The call sites of MEM_TRACK_MALLOC hold the name of the
+ * calling function as their comment and also know their line.
  */
 typedef struct {
-    void* address;        /**< The address of the memory block. */
-    size_t size;          /**< The size of the memory block. */
     const char* file_name;/**< The name of the source file where the memory block was allocated. */
     const char* comment;  /**< A comment to identify the memory allocation. */
     const char* type;     /**< The type of data stored in the memory block. */
+    unsigned int line;    /**< The line of the allocation in the source file, or 0 if it is not known. */
+} CallSite;
+
+/**
+ * @brief A call site known at compile time, see `ansi_c_mem_track_malloc_at` and MEM_TRACK_MALLOC.
+ *
+ * The descriptor is meant to be a static variable initialized with string literals. The tracker caches the ID
+ * of its call site in `cached_id`, so only the first allocation of a call site looks up or copies its strings.
+ */
+typedef struct {
+    const char* file_name;     /**< The name of the source file, usually __FILE__. */
+    const char* function_name; /**< The name of the calling function, usually __func__. */
+    const char* type;          /**< The type of data stored in the memory block. */
+    unsigned int line;         /**< The line of the allocation, usually __LINE__. */
+    size_t cached_id;          /**< Owned by the tracker, must be initialized to 0. */
+} CallSiteDescriptor;
+
+/**
+ * @brief The allocators that can provide the memory of a tracked block.
+ */
+typedef enum {
+    MEMORY_BACKEND_SYSTEM = 0, /**< The system malloc. */
+    MEMORY_BACKEND_SLAB = 1,   /**< The size-class slabs, see ANSI_C_MEM_TRACK_SLAB. */
+    MEMORY_BACKEND_ARENA = 2   /**< The arena of the object ID, see ANSI_C_MEM_TRACK_ARENA. */
+} MemoryBackend;
+
+/**
+ * @brief Memory block structure to store information about allocated memory blocks.
+ */
+typedef struct {
+    void* address;        /**< The address of the memory block. */
+    size_t size;          /**< The size of the memory block. */
+    size_t call_site_id;  /**< The ID of the call site of the allocation, see `ansi_c_mem_track_get_call_site`. */
     bool is_allocated;    /**< The status of the memory block: allocated, freed. */
+    bool is_sampled;      /**< The block was tracked by sampling and stands for more memory, see `ansi_c_mem_track_get_estimated_size`. */
     size_t optional_object_id;  /**< The optional object ID to identify memory allocations. */
+    size_t next_slot; /**< Next slot in the list of the block's object ID while allocated, or in the free-slot list while freed. */
+    size_t prev_slot; /**< Previous slot in the list of the block's object ID while allocated. */
+    MemoryBackend backend; /**< The allocator that provided the memory of the block. */
+    size_t stack_id; /**< The call stack of the allocation, see `ansi_c_mem_track_get_stack`, 0 if it was not captured. */
+    size_t estimated_size; /**< The bytes a sampled block stands for, fixed when it is tracked, see `ansi_c_mem_track_get_estimated_size`. */
 } MemoryBlock;
 
+/**
+ * @brief Matches any value in a field of a BlockFilter.
+ */
+#define BLOCK_FILTER_ANY ((size_t)-1)
+
+/**
+ * @brief Selects the memory blocks passed to a visitor or read by a cursor. A NULL filter selects all blocks.
+ */
+typedef struct {
+    size_t min_size;           /**< The smallest size of a block, 0 for no lower bound. */
+    size_t max_size;           /**< The largest size of a block, BLOCK_FILTER_ANY for no upper bound. */
+    size_t call_site_id;       /**< The call site of the blocks, or BLOCK_FILTER_ANY. */
+    size_t optional_object_id; /**< The object ID of the blocks, or BLOCK_FILTER_ANY. */
+} BlockFilter;
+
+/**
+ * @brief Initializer of a BlockFilter that selects all blocks.
+ */
+#define BLOCK_FILTER_INIT { 0, BLOCK_FILTER_ANY, BLOCK_FILTER_ANY, BLOCK_FILTER_ANY }
+
+/**
+ * @brief Called by `ansi_c_mem_track_visit_blocks` for every selected block.
+ *
+ * @param block The block, valid only during the call.
+ * @param context The context passed to `ansi_c_mem_track_visit_blocks`.
+ * @return true to continue, false to stop the visit.
+ */
+typedef bool (*MemoryBlockVisitor)(const MemoryBlock* block, void* context);
+
+/**
+ * @brief Shard of the tracking table, which holds the memory blocks whose addresses hash to it, their indexes and
+ * the lock that protects them.
+ */
+typedef struct MemoryShard MemoryShard;
+
+/**
+ * @brief Position of `ansi_c_mem_track_read_blocks` in the tracking table. Initialize it with BLOCK_CURSOR_INIT.
+ */
+typedef struct {
+    MemoryShard* shard; /**< The shard to read next, NULL before the first read. */
+    size_t slot;        /**< The slot to read next in the shard. */
+    bool is_done;       /**< All shards have been read. */
+} BlockCursor;
+
+#define BLOCK_CURSOR_INIT { NULL, 0, false }
+
+/**
+ * @brief Entry of the address index, which maps the address of a memory block to its slot in the blocks array.
+ */
+typedef struct AddressIndexEntry AddressIndexEntry;
+
+/**
+ * @brief Entry of the object index, which maps an object ID to the list of its memory blocks.
+ */
+typedef struct ObjectIndexEntry ObjectIndexEntry;
+
+/**
+ * @brief Entry of the call site index, which maps the hash of a call site to its ID.
+ */
+typedef struct CallSiteIndexEntry CallSiteIndexEntry;
+
+/**
+ * @brief The current and peak memory usage of a call site.
+ */
+typedef struct CallSiteUsage CallSiteUsage;
+
 /**
  * @brief Data structure for tracking memory usage.
+ *
+ * In the thread-safe build every thread counts in counters of its own, and the counters here only receive the
+ * updates of threads that could not get them; `ansi_c_mem_track_get_info` returns the sum.
  */
 typedef struct {
-    MemoryBlock* blocks; /**< Dynamically allocated array of memory blocks. */
-    size_t capacity; /**< Capacity of the `blocks` array. */
+    MemoryShard* shards; /**< The shards of the tracking table. */
+    size_t shard_count; /**< Number of items in `shards`. */
     size_t total_size; /**< Total size of all memory blocks allocated. */
     size_t size; /**< Number of memory blocks currently allocated. */
     size_t total_memory_usage; /**< Total memory usage (excluding overhead). */
     size_t memory_usage; /**< Memory usage (excluding overhead). */
     size_t total_freed_memory; /**< Total amount of memory freed so far. */
+    size_t peak_size; /**< The highest number of memory blocks allocated at once since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest memory usage since the last reset of the peaks. */
     bool is_initialized;        /**< The initialization status of the memory tracker. */
     MemoryBlock** get_unfreed_blocks_info_ptr; /**< A pointer to the array of MemoryBlock pointers representing the unfreed memory blocks */
     size_t get_unfreed_blocks_info_size; /**< Number items in unfreed blocks info array */
+    CallSite** call_site_pages; /**< Pages of interned call sites; a page never moves once it is allocated. */
+    size_t call_site_count; /**< Number of interned call sites, including the call site with ID 0. */
+    CallSiteIndexEntry* call_site_index; /**< Open addressing hash index from call site contents to call site ID. */
+    size_t call_site_index_capacity; /**< Number of entries in `call_site_index` (always a power of two). */
+    CallSiteUsage** call_site_usage_pages; /**< The usage of the call sites, in pages parallel to `call_site_pages`. */
 } MemoryInfo;
 
 /**
@@ -82,8 +277,113 @@ typedef struct {
     size_t total_user_memory_usage; /**< Total memory usage by the user's memory allocation functions. */
     size_t memory_usage; /**< Memory usage (excluding overhead). */
     size_t total_freed_memory; /**< Total amount of memory freed so far. */
+    size_t peak_size; /**< The highest number of memory blocks allocated at once since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest memory usage since the last reset of the peaks. */
+    size_t slab_count; /**< Number of slabs of the slab backend, 0 without ANSI_C_MEM_TRACK_SLAB. */
+    size_t partial_slab_count; /**< Number of slabs with both allocated and free blocks. */
+    size_t slab_memory; /**< Memory reserved by the slabs (overhead included). */
+    size_t slab_free_memory; /**< Memory of the free blocks in the slabs. */
+    size_t dropped_log_records; /**< Log records dropped because the log queue was full, see ANSI_C_MEM_TRACK_ASYNC_LOG. */
 } MemoryUsageInfo;
 
+/**
+ * @brief Struct for storing the memory usage of one object ID.
+ */
+typedef struct {
+    size_t size; /**< Number of memory blocks currently allocated with the object ID. */
+    size_t memory_usage; /**< Memory usage of the object ID (excluding overhead). */
+    size_t peak_size; /**< The highest number of memory blocks of the object ID since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest memory usage of the object ID since the last reset of the peaks. */
+} ObjectUsageInfo;
+
+/**
+ * @brief Log-linear histogram of the requested allocation sizes.
+ *
+ * Sizes below SIZE_HISTOGRAM_SUB_BUCKETS have a bucket each, and every power of two above is split into
+ * SIZE_HISTOGRAM_SUB_BUCKETS buckets of equal width, the spacing of the size classes of common allocators.
+ * `ansi_c_mem_track_size_histogram_bucket_min` returns the smallest size of a bucket.
+ */
+typedef struct {
+    size_t counts[SIZE_HISTOGRAM_BUCKET_COUNT]; /**< The number of allocations and reallocations per bucket. */
+} SizeHistogram;
+
+/**
+ * @brief Struct for storing the memory usage of one call site. Only the tracked blocks are counted, see
+ * ANSI_C_MEM_TRACK_SAMPLING.
+ */
+typedef struct {
+    size_t size; /**< Number of memory blocks currently allocated at the call site. */
+    size_t memory_usage; /**< Memory usage of the call site (excluding overhead). */
+    size_t peak_size; /**< The highest number of memory blocks of the call site since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest memory usage of the call site since the last reset of the peaks. */
+    size_t total_size; /**< Number of memory blocks allocated at the call site since the initialization. */
+    size_t total_memory_usage; /**< Bytes allocated at the call site since the initialization, including growth by realloc. */
+} CallSiteUsageInfo;
+
+/**
+ * @brief The column of CallSiteUsageInfo that orders a call site profile.
+ */
+typedef enum {
+    CALL_SITE_PROFILE_BY_MEMORY_USAGE = 0,      /**< The bytes currently allocated. */
+    CALL_SITE_PROFILE_BY_SIZE = 1,              /**< The blocks currently allocated. */
+    CALL_SITE_PROFILE_BY_TOTAL_MEMORY_USAGE = 2, /**< The bytes allocated since the initialization. */
+    CALL_SITE_PROFILE_BY_TOTAL_SIZE = 3         /**< The blocks allocated since the initialization. */
+} CallSiteProfileOrder;
+
+/**
+ * @brief One row of a call site profile.
+ */
+typedef struct {
+    size_t call_site_id;     /**< The ID of the call site, see `ansi_c_mem_track_get_call_site`. */
+    CallSiteUsageInfo usage; /**< The usage of the call site. */
+} CallSiteProfileEntry;
+
+/**
+ * @brief One memory block in a heap snapshot.
+ */
+typedef struct {
+    void* address;         /**< The address of the memory block. */
+    size_t size;           /**< The size of the memory block. */
+    size_t call_site_id;   /**< The ID of the call site of the allocation. */
+    size_t estimated_size; /**< The bytes the block stands for, see `ansi_c_mem_track_get_estimated_size`. */
+} HeapSnapshotBlock;
+
+/**
+ * @brief The allocated memory blocks at one point in time, see `ansi_c_mem_track_take_snapshot`.
+ */
+typedef struct {
+    HeapSnapshotBlock* blocks; /**< The blocks, sorted by address. */
+    size_t block_count;        /**< Number of items in `blocks`. */
+    size_t memory_usage;       /**< The sum of the estimated sizes of the blocks. */
+} HeapSnapshot;
+
+/**
+ * @brief The change of the memory usage of one call site between two heap snapshots. A sampled block counts as the
+ * blocks and the bytes it stands for, see `ansi_c_mem_track_get_estimated_size`.
+ */
+typedef struct {
+    size_t call_site_id;        /**< The ID of the call site. */
+    size_t before_size;         /**< Number of blocks of the call site in the earlier snapshot. */
+    size_t before_memory_usage; /**< Memory usage of the call site in the earlier snapshot. */
+    size_t after_size;          /**< Number of blocks of the call site in the later snapshot. */
+    size_t after_memory_usage;  /**< Memory usage of the call site in the later snapshot. */
+    size_t new_size;            /**< Number of blocks of the call site that are only in the later snapshot. */
+    size_t new_memory_usage;    /**< Memory usage of the blocks that are only in the later snapshot. */
+} CallSiteGrowth;
+
+/**
+ * @brief The difference of two heap snapshots, see `ansi_c_mem_track_diff_snapshots`.
+ */
+typedef struct {
+    CallSiteGrowth* call_sites; /**< The call sites with new or freed blocks, the one that grew most first. */
+    size_t call_site_count;     /**< Number of items in `call_sites`. */
+    HeapSnapshotBlock* new_blocks; /**< The blocks that are only in the later snapshot, sorted by address. */
+    size_t new_block_count;     /**< Number of items in `new_blocks`. */
+    size_t new_memory_usage;    /**< The sum of the estimated sizes of the new blocks. */
+    size_t freed_block_count;   /**< Number of blocks that are only in the earlier snapshot. */
+    size_t freed_memory_usage;  /**< The sum of the estimated sizes of the freed blocks. */
+} HeapSnapshotDiff;
+
  /**
   * @brief Initializes the AnsiCMemTrack library
   *
@@ -103,13 +403,29 @@ bool ansi_c_mem_track_init(void);
  */
 void* ansi_c_mem_track_malloc(size_t size, const char* file_name, const char* comment, const char* type, size_t optional_object_id);
 
+/**
+ * @brief Allocates memory and tracks it, with the call site given by a static descriptor.
+ *
+ * This is the function behind MEM_TRACK_MALLOC. After the first call with a descriptor the call site is found
+ * without hashing or copying its strings.
+ *
+ * @param size The size of the memory to be allocated.
+ * @param call_site The static descriptor of the call site, or NULL if the call site is not known.
+ * @param optional_object_id Optional object ID to identify memory allocations.
+ * @return A pointer to the allocated memory, or NULL if the allocation fails.
+ */
+void* ansi_c_mem_track_malloc_at(size_t size, CallSiteDescriptor* call_site, size_t optional_object_id);
+
 /**
  * @brief Reallocates memory and tracks it.
  *
  * @param ptr A pointer to the memory block to be reallocated.
  * @param size The size of the new memory block.
  * @param optional_object_id Optional object ID to identify memory allocations.
- * @return A pointer to the reallocated memory, or NULL if the reallocation fails.
+ * @return A pointer to the reallocated memory, or NULL if the reallocation fails. A size of 0 frees the block and
+ * returns NULL. If the block cannot be tracked any more because the tables of the tracker cannot grow, a block of
+ * the system malloc is returned untracked; a block behind a header or from the slabs or an arena is freed, NULL is
+ * returned and `ptr` must not be used any more.
  */
 void* ansi_c_mem_track_realloc(void* ptr, size_t size, size_t optional_object_id);
 
@@ -128,9 +444,133 @@ void ansi_c_mem_track_free(void* ptr);
  */
 void ansi_c_mem_track_free_by_object_id(size_t optional_object_id);
 
+/**
+ * @brief Returns information about the memory allocated with the given object ID.
+ *
+ * The cost of this function does not depend on the number of tracked memory blocks.
+ *
+ * @param optional_object_id The object ID to query.
+ * @return An ObjectUsageInfo struct with the number and the total size of the memory blocks currently
+ * allocated with the object ID, and their peaks.
+ */
+ObjectUsageInfo ansi_c_mem_track_get_object_info(size_t optional_object_id);
+
+/**
+ * @brief Returns the current and peak memory usage of the call site with the given ID.
+ *
+ * @param call_site_id The ID of the call site, e.g. the `call_site_id` of a MemoryBlock.
+ * @return A CallSiteUsageInfo struct, all zero if there is no call site with the given ID.
+ */
+CallSiteUsageInfo ansi_c_mem_track_get_call_site_info(size_t call_site_id);
+
+/**
+ * @brief Returns the call sites with the highest usage, ordered from the highest. The usage is aggregated per call
+ * site as the blocks are allocated and freed, so the profile costs one pass over the call sites and none over the
+ * memory blocks. Call sites that never allocated a tracked block are left out.
+ *
+ * @param entries Receives the profile, at least `max_entries` entries.
+ * @param max_entries The number of call sites to return at most.
+ * @param order The column to order by.
+ * @return The number of entries written.
+ */
+size_t ansi_c_mem_track_get_call_site_profile(CallSiteProfileEntry* entries, size_t max_entries, CallSiteProfileOrder order);
+
+/**
+ * @brief Prints the call sites with the highest usage to the specified file or to the standard output if the file
+ * name is NULL, see `ansi_c_mem_track_get_call_site_profile`.
+ *
+ * @param max_entries The number of call sites to print at most.
+ * @param order The column to order by.
+ * @return true if the profile was successfully printed, false otherwise.
+ */
+bool ansi_c_mem_track_print_call_site_profile(const char* file_name, size_t max_entries, CallSiteProfileOrder order);
+
+/**
+ * @brief Writes the usage of all call sites as an uncompressed pprof heap profile, with the sample types
+ * alloc_objects, alloc_space, inuse_objects and inuse_space. `go tool pprof` and the other pprof tools read it.
+ *
+ * @param file_name The file to write, it is overwritten.
+ * @return true if the file was written, false otherwise.
+ */
+bool ansi_c_mem_track_export_pprof(const char* file_name);
+
+/**
+ * @brief Writes the usage of all call sites in the folded stack format of flamegraph.pl and compatible tools, one
+ * line per call site with the frames `file:line;comment;type` and the value.
+ *
+ * @param file_name The file to write, it is overwritten.
+ * @param value The column of the call site usage to write as the value.
+ * @return true if the file was written, false otherwise.
+ */
+bool ansi_c_mem_track_export_folded(const char* file_name, CallSiteProfileOrder value);
+
+/**
+ * @brief Copies the frames of a captured call stack, see ANSI_C_MEM_TRACK_BACKTRACE.
+ *
+ * @param stack_id The ID of the stack, e.g. the `stack_id` of a MemoryBlock.
+ * @param frames Receives the return addresses, the innermost first. The first frames are in the tracker.
+ * @param max_frames The number of frames to copy at most.
+ * @return The number of frames copied, 0 if there is no stack with the given ID or the option is not enabled.
+ */
+size_t ansi_c_mem_track_get_stack(size_t stack_id, void** frames, size_t max_frames);
+
+/**
+ * @brief Prints a captured call stack with the names of its frames to the specified file or to the standard output
+ * if the file name is NULL. The frames are named only now, not when the stack is captured.
+ *
+ * @param stack_id The ID of the stack, e.g. the `stack_id` of a MemoryBlock.
+ * @return true if the stack was printed, false if there is no stack with the given ID or the option is not enabled.
+ */
+bool ansi_c_mem_track_print_stack(const char* file_name, size_t stack_id);
+
+/**
+ * @brief Returns the histogram of the sizes requested by all allocations and reallocations since the tracker was
+ * initialized.
+ *
+ * @param histogram Receives the histogram.
+ */
+void ansi_c_mem_track_get_size_histogram(SizeHistogram* histogram);
+
+/**
+ * @brief Returns the histogram of the sizes requested at a call site, by the allocations there and by the
+ * reallocations of their blocks. Only the tracked blocks are counted, see ANSI_C_MEM_TRACK_SAMPLING.
+ *
+ * @param call_site_id The ID of the call site, e.g. the `call_site_id` of a MemoryBlock.
+ * @param histogram Receives the histogram.
+ * @return true if successful, false if there is no call site with the given ID.
+ */
+bool ansi_c_mem_track_get_call_site_size_histogram(size_t call_site_id, SizeHistogram* histogram);
+
+/**
+ * @brief Returns the smallest size that falls into a bucket of a SizeHistogram.
+ *
+ * @param bucket The index of the bucket, less than SIZE_HISTOGRAM_BUCKET_COUNT. The largest size of the bucket is
+ * one less than the smallest size of the next bucket.
+ */
+size_t ansi_c_mem_track_size_histogram_bucket_min(size_t bucket);
+
+/**
+ * @brief Prints the nonempty buckets of a size histogram to the specified file or to the standard output if the
+ * file name is NULL.
+ *
+ * @return true if the histogram was successfully printed, false otherwise.
+ */
+bool ansi_c_mem_track_print_size_histogram(const char* file_name, const SizeHistogram* histogram);
+
+/**
+ * @brief Resets all peaks to the current usage, e.g. at the start of a new phase of the program.
+ *
+ * The global peaks, the peaks of every call site and the peaks of every object ID are reset. The object IDs that
+ * have no allocated memory blocks left are forgotten, so a program that uses many short-lived object IDs should
+ * reset the peaks from time to time.
+ */
+void ansi_c_mem_track_reset_peaks(void);
+
 /**
  * @brief Deinitializes the memory tracker and frees any remaining memory allocated by the library.
  *
+ * In the thread-safe build no other thread may use the tracker while it is deinitialized.
+ *
  * @return None.
  */
 void ansi_c_mem_track_deinit(void);
@@ -149,6 +589,8 @@ MemoryUsageInfo ansi_c_mem_track_get_info(void);
  *
  * This function writes a log message to the specified file or to the standard output if the file name is NULL.
  * The log message includes the current date and time, the message type, and the message text.
+ * A file is opened when it is logged to for the first time and stays open until `ansi_c_mem_track_deinit`.
+ * With ANSI_C_MEM_TRACK_ASYNC_LOG the message is queued for the writer thread, see `ansi_c_mem_track_log_flush`.
  *
  * @param file_name The name of the file to write the log message to. If NULL, the message will be written to the standard output.
  * @param message_type The type of the log message (e.g. INFO, WARNING, ERROR).
@@ -171,11 +613,22 @@ bool ansi_c_mem_track_log_message(const char* file_name, const char* message_typ
  */
 bool ansi_c_mem_track_print_info(const char* file_name, const MemoryUsageInfo* info);
 
+/**
+ * @brief Waits until the messages logged so far are written to their files, and flushes the files.
+ *
+ * The log files stay open between the calls of the log functions, and with ANSI_C_MEM_TRACK_ASYNC_LOG the
+ * messages are written by a background thread. This function makes the messages visible, for example before the
+ * files are read by another program. `ansi_c_mem_track_deinit` flushes and closes the log files.
+ */
+void ansi_c_mem_track_log_flush(void);
+
 /**
  * @brief Cleans up deallocated memory blocks from the memory usage tracking array.
  *
  * This function removes all memory blocks from the memory usage tracking array where the "is_allocated" flag is false.
  * It also shrinks the array if the number of unused elements exceeds a certain threshold.
+ * Freed slots are reused by later allocations anyway, so calling this function is optional; it is never called
+ * implicitly by the free functions.
  */
 void ansi_c_mem_track_cleanup_allocations(void);
 
@@ -187,14 +640,98 @@ void ansi_c_mem_track_cleanup_allocations(void);
  */
 size_t ansi_c_mem_track_get_next_object_id(void);
 
+/**
+ * @brief Returns a new object_id, like `ansi_c_mem_track_get_next_object_id`, and creates an arena for it when the
+ * library is built with ANSI_C_MEM_TRACK_ARENA.
+ * The blocks allocated with the object_id are then cut from the chunks of the arena, and
+ * `ansi_c_mem_track_free_by_object_id` releases all chunks at once and removes the arena. The blocks are tracked
+ * and accounted for one by one as usual.
+ * @return The generated object_id, or 0 if the arena could not be created.
+ */
+size_t ansi_c_mem_track_create_arena(void);
+
+/**
+ * @brief Starts recording every tracked malloc, realloc and free, and every call of
+ * `ansi_c_mem_track_free_by_object_id`, as a binary event in memory-mapped trace files.
+ * The trace rotates over `file_count` files named `<file_name>.0`, `<file_name>.1`, ..., each `file_size` bytes
+ * large, and overwrites the oldest file when all are full. The format is described in `src/ansi_c_mem_track_trace.h`.
+ * Requires ANSI_C_MEM_TRACK_TRACE.
+ * @param file_name The base name of the trace files.
+ * @param file_size The size of each trace file in bytes.
+ * @param file_count The number of trace files.
+ * @return true if the trace started, false if it runs already, the first file could not be created, or the library
+ * was built without ANSI_C_MEM_TRACK_TRACE.
+ */
+bool ansi_c_mem_track_start_trace(const char* file_name, size_t file_size, size_t file_count);
+
+/**
+ * @brief Stops the trace and completes the header of the current trace file. `ansi_c_mem_track_deinit` stops
+ * the trace as well. No other thread may use the tracker meanwhile.
+ */
+void ansi_c_mem_track_stop_trace(void);
+
+/**
+ * @brief Sets the sampling interval of ANSI_C_MEM_TRACK_SAMPLING: every allocated byte is sampled with the
+ * probability 1 / interval, and an allocation is tracked if one of its bytes is sampled. 0 tracks every
+ * allocation. Allocations with an object ID are always tracked. The usage counters count all allocations either
+ * way. Has no effect without ANSI_C_MEM_TRACK_SAMPLING.
+ * @param interval The mean number of bytes allocated between two tracked allocations.
+ */
+void ansi_c_mem_track_set_sampling_interval(size_t interval);
+
+/**
+ * @brief Returns the number of bytes a tracked block stands for. That is its size, unless the block was sampled;
+ * then it is the size scaled up by the inverse of the probability that a block of its size is sampled at the
+ * interval when the block was tracked, so the sum of the estimates is an unbiased estimate of the memory of all
+ * blocks. The usage of the call sites, the profiles and the snapshots count the sampled blocks with these estimates.
+ * @param block The block, e.g. from `ansi_c_mem_track_get_unfreed_blocks_info`.
+ * @return The estimated number of bytes.
+ */
+size_t ansi_c_mem_track_get_estimated_size(const MemoryBlock* block);
+
+/**
+ * @brief Writes the call sites interned so far to a text file, so that tools reading a trace can name the call
+ * site IDs of its events. Every line holds the ID, the file name, the comment and the type of a call site,
+ * separated by tabs; tabs, line breaks and backslashes in the strings are escaped as `\t`, `\n`, `\r` and `\\`.
+ * @param file_name The file to write, it is overwritten.
+ * @return true if the file was written, false otherwise.
+ */
+bool ansi_c_mem_track_dump_call_sites(const char* file_name);
+
 /*@brief Get information about a memory block with the given pointer.
 *
 * @param ptr A pointer to the memory block.
 *
 * @return A pointer to a const MemoryBlock struct with information about the memory block, or NULL if not found.
+* In the thread-safe build the pointer refers to a copy owned by the calling thread, which is overwritten by the
+* thread's next call of this function.
 */
 const MemoryBlock* ansi_c_mem_track_get_block_info(const void* ptr);
 
+/**
+ * @brief Gets the size of a memory block allocated by the tracker, like malloc_usable_size.
+ *
+ * Unlike `ansi_c_mem_track_get_block_info`, this also finds the blocks that were not sampled in the sampling build,
+ * and it copies nothing.
+ *
+ * @param ptr A pointer to the memory block. When a header is stored in front of the blocks
+ * (ANSI_C_MEM_TRACK_INLINE_HEADER, also implied by ANSI_C_MEM_TRACK_THREAD_CACHE and ANSI_C_MEM_TRACK_SAMPLING),
+ * it must have come from the tracker, because the header in front of it is read.
+ * @return The size requested for the block, or 0 if it is already freed or, without a header, if the tracker did
+ * not allocate it.
+ */
+size_t ansi_c_mem_track_get_block_size(const void* ptr);
+
+/**
+ * @brief Gets the call site with the given ID.
+ *
+ * @param call_site_id The ID of the call site, e.g. the `call_site_id` of a MemoryBlock.
+ *
+ * @return A pointer to the call site, or NULL if there is no call site with the given ID. The call site
+ * stays valid until `ansi_c_mem_track_deinit` is called.
+ */
+const CallSite* ansi_c_mem_track_get_call_site(size_t call_site_id);
+
 /**
  * @brief Logs information about the given memory block.
  *
@@ -223,7 +760,10 @@ bool ansi_c_mem_track_log_block_info(const char* file_name, const MemoryBlock* b
  * and its contents should not be modified or freed.
  *
  * @note The returned array and the memory it points to should be freed by
- * calling this function again or by calling `ansi_c_mem_track_deinit`.
+ * calling this function again or by calling `ansi_c_mem_track_deinit`. In the thread-safe build the blocks are
+ * collected consistently, but the array is shared, so only one thread at a time should call this function.
+ * With ANSI_C_MEM_TRACK_SAMPLING only the tracked blocks are returned; `ansi_c_mem_track_get_estimated_size`
+ * scales the sampled ones up to the memory they stand for.
  */
 const MemoryBlock** ansi_c_mem_track_get_unfreed_blocks_info(size_t* count);
 
@@ -239,6 +779,91 @@ const MemoryBlock** ansi_c_mem_track_get_unfreed_blocks_info(size_t* count);
  */
 bool ansi_c_mem_track_log_unfreed_blocks_info(const char* file_name, const MemoryBlock** blocks, size_t count);
 
+/**
+ * @brief Calls a visitor for every allocated memory block that the filter selects, without copying or allocating.
+ *
+ * The shards are visited one after the other, and the visitor runs while the shard of the block is locked, so it
+ * must not allocate or free memory through the tracker and should return quickly. With an object ID in the filter
+ * only the blocks of the object ID are visited, through its index.
+ *
+ * @param filter Selects the blocks, NULL for all blocks.
+ * @param visitor Called for every selected block.
+ * @param context Passed to the visitor.
+ * @return The number of blocks passed to the visitor.
+ */
+size_t ansi_c_mem_track_visit_blocks(const BlockFilter* filter, MemoryBlockVisitor visitor, void* context);
+
+/**
+ * @brief Copies the next allocated memory blocks that the filter selects into a buffer of the caller, and moves
+ * the cursor past them. Only one shard is locked at a time and none between two calls, so the caller may use the
+ * tracker in between; blocks allocated or freed meanwhile may be missed or seen.
+ *
+ * @param cursor The position, BLOCK_CURSOR_INIT to start.
+ * @param filter Selects the blocks, NULL for all blocks. Use the same filter for all calls with a cursor.
+ * @param blocks Receives the blocks.
+ * @param max_blocks The number of blocks the buffer holds.
+ * @return The number of blocks copied, 0 once all blocks have been read.
+ */
+size_t ansi_c_mem_track_read_blocks(BlockCursor* cursor, const BlockFilter* filter, MemoryBlock* blocks, size_t max_blocks);
+
+/**
+ * @brief Logs the allocated memory blocks that the filter selects to a file or stdout, like
+ * `ansi_c_mem_track_log_block_info`. The blocks are read in batches with a cursor, without heap allocation.
+ *
+ * @param file_name The name of the file to write the log to, or NULL to write to stdout.
+ * @param filter Selects the blocks, NULL for all blocks.
+ * @return True if the log was successfully written, false otherwise.
+ */
+bool ansi_c_mem_track_log_blocks(const char* file_name, const BlockFilter* filter);
+
+/**
+ * @brief Takes a snapshot of the allocated memory blocks that the filter selects, to compare it with a later one by
+ * `ansi_c_mem_track_diff_snapshots`.
+ *
+ * Only the address, the size and the call site of a block are kept, in one array sorted by address with a radix
+ * sort, so a snapshot takes linear time and 24 bytes per block on 64-bit systems. The shards are read one after
+ * the other, like by `ansi_c_mem_track_visit_blocks`.
+ *
+ * @param snapshot Receives the snapshot, which must be released with `ansi_c_mem_track_free_snapshot`.
+ * @param filter Selects the blocks, NULL for all blocks.
+ * @return true if the snapshot was taken, false if an allocation failed.
+ */
+bool ansi_c_mem_track_take_snapshot(HeapSnapshot* snapshot, const BlockFilter* filter);
+
+/**
+ * @brief Releases the memory of a heap snapshot and clears it.
+ */
+void ansi_c_mem_track_free_snapshot(HeapSnapshot* snapshot);
+
+/**
+ * @brief Compares two heap snapshots in one merge of their sorted blocks.
+ *
+ * A block of the later snapshot is new if the earlier one has no block with the same address, size and call site.
+ * A block that was freed and allocated again at the same address with the same size and call site between the
+ * snapshots is therefore not reported as new.
+ *
+ * @param before The earlier snapshot.
+ * @param after The later snapshot.
+ * @param diff Receives the difference, which must be released with `ansi_c_mem_track_free_snapshot_diff`.
+ * @return true if the snapshots were compared, false if an allocation failed.
+ */
+bool ansi_c_mem_track_diff_snapshots(const HeapSnapshot* before, const HeapSnapshot* after, HeapSnapshotDiff* diff);
+
+/**
+ * @brief Releases the memory of a snapshot difference and clears it.
+ */
+void ansi_c_mem_track_free_snapshot_diff(HeapSnapshotDiff* diff);
+
+/**
+ * @brief Logs the call sites that grew most between two heap snapshots.
+ *
+ * @param file_name The name of the file to write the log to, or NULL to write to stdout.
+ * @param diff The difference of the snapshots.
+ * @param max_entries The number of call sites to log at most.
+ * @return True if the log was successfully written, false otherwise.
+ */
+bool ansi_c_mem_track_print_snapshot_diff(const char* file_name, const HeapSnapshotDiff* diff, size_t max_entries);
+
 /**
  * @brief Checks if the ansi_c_mem_track library has been initialized.
  *
@@ -246,4 +871,38 @@ bool ansi_c_mem_track_log_unfreed_blocks_info(const char* file_name, const Memor
  */
 bool ansi_c_mem_track_is_initialized(void);
 
+/*
+ * Allocation macros that record their call site without any hand-written strings:
+ *
+ *     int* values = (int*)MEM_TRACK_MALLOC(sizeof(int) * count, int*, 0);
+ *     values = (int*)MEM_TRACK_REALLOC(values, sizeof(int) * count * 2, 0);
+ *     MEM_TRACK_FREE(values);
+ *
+ * The file, the line and the calling function are captured in a static CallSiteDescriptor, and `type` is
+ * stringized, so no string is built at run time. GCC and Clang keep the descriptor in a statement expression and
+ * cache its call site ID; other C compilers pass a compound literal, which is interned on every call, and other C++
+ * compilers fall back to `ansi_c_mem_track_malloc` without the line. With ANSI_C_MEM_TRACK_DISABLE the macros are
+ * plain malloc, realloc and free, and the object ID is not evaluated.
+ */
+#ifdef ANSI_C_MEM_TRACK_DISABLE
+    #define MEM_TRACK_MALLOC(size, type, optional_object_id) malloc(size)
+    #define MEM_TRACK_REALLOC(ptr, size, optional_object_id) realloc(ptr, size)
+    #define MEM_TRACK_FREE(ptr) free(ptr)
+#else
+    #if defined(__GNUC__)
+        #define MEM_TRACK_MALLOC(size, type, optional_object_id) __extension__({ \
+            static CallSiteDescriptor _mem_track_call_site = { __FILE__, __func__, #type, __LINE__, 0 }; \
+            ansi_c_mem_track_malloc_at(size, &_mem_track_call_site, optional_object_id); \
+        })
+    #elif !defined(__cplusplus)
+        #define MEM_TRACK_MALLOC(size, type, optional_object_id) \
+            ansi_c_mem_track_malloc_at(size, &(CallSiteDescriptor){ __FILE__, __func__, #type, __LINE__, 0 }, optional_object_id)
+    #else
+        #define MEM_TRACK_MALLOC(size, type, optional_object_id) \
+            ansi_c_mem_track_malloc(size, __FILE__, __FUNCTION__, #type, optional_object_id)
+    #endif
+    #define MEM_TRACK_REALLOC(ptr, size, optional_object_id) ansi_c_mem_track_realloc(ptr, size, optional_object_id)
+    #define MEM_TRACK_FREE(ptr) ansi_c_mem_track_free(ptr)
+#endif
+
 #endif /* ANSI_C_MEM_TRACK_H */
\ No newline at end of file
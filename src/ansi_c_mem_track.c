@@ -1,14 +1,1353 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 #include "../include/ansi_c_mem_track.h"
 #include "../include/ansi_c_macro_utils.h"
+#include "ansi_c_mem_track_slab.h"
+#include "ansi_c_mem_track_arena.h"
+#include "ansi_c_mem_track_log.h"
+#include "ansi_c_mem_track_trace.h"
+#include "ansi_c_mem_track_sample.h"
+#include "ansi_c_mem_track_profile.h"
+#include "ansi_c_mem_track_stack.h"
+
+#ifdef ANSI_C_MEM_TRACK_TRACE
+#define TRACE_EVENT(op, address, old_address, size, call_site_id, object_id) \
+    ansi_c_mem_track_trace_event(op, address, old_address, size, call_site_id, object_id)
+#else
+#define TRACE_EVENT(op, address, old_address, size, call_site_id, object_id) ((void)0)
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+#define STACK_CAPTURE() ansi_c_mem_track_stack_capture()
+#else
+#define STACK_CAPTURE() ((size_t)0)
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+#undef ANSI_C_MEM_TRACK_SHARD_COUNT
+#define ANSI_C_MEM_TRACK_SHARD_COUNT 1 // Not used, every thread gets its own shard
+#define SHARD_PAGE_SIZE 64
+#define SHARD_PAGE_COUNT 1024
+#define SHARD_LIMIT ((size_t)SHARD_PAGE_SIZE * SHARD_PAGE_COUNT)
+#endif
+
+#ifndef ANSI_C_MEM_TRACK_SHARD_COUNT
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+#define ANSI_C_MEM_TRACK_SHARD_COUNT 16
+#else
+#define ANSI_C_MEM_TRACK_SHARD_COUNT 1
+#endif
+#endif
+
+#if (ANSI_C_MEM_TRACK_SHARD_COUNT) < 1 || ((ANSI_C_MEM_TRACK_SHARD_COUNT) & ((ANSI_C_MEM_TRACK_SHARD_COUNT) - 1)) != 0
+#error ANSI_C_MEM_TRACK_SHARD_COUNT must be a power of two
+#endif
 
 MemoryInfo g_mem_info;
-static size_t free_calls = 0;
 static size_t next_object_id = 1;
+static size_t size_histogram[SIZE_HISTOGRAM_BUCKET_COUNT]; /**< The size histogram, or the shared share of it. */
+static MUTEX_TYPE init_lock = MUTEX_STATIC_INIT;
+static RWLOCK_TYPE call_site_lock = RWLOCK_STATIC_INIT;
+static size_t call_site_generation = 0; /**< Counts the initializations of the call site table, see CallSiteDescriptor. */
+
+#define CALL_SITE_LIMIT ((size_t)CALL_SITE_PAGE_SIZE * CALL_SITE_PAGE_COUNT)
+
+#define INVALID_INDEX ((size_t)-1)
+
+struct MemoryShard {
+    MUTEX_TYPE lock; /**< Protects the members of the shard, except the ones that are accessed atomically. */
+    MemoryShard* next; /**< The next shard in the list of all shards, which never changes once the shard is published. */
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    size_t index; /**< The index of the shard, see shard_at, which the block headers store instead of a pointer. */
+    void* remote_frees; /**< Lock-free stack of the headers of blocks freed by other threads, drained under the lock. */
+    size_t orphaned; /**< 1 if the thread that owned the shard has exited and the shard waits for a new owner. */
+#endif
+    MemoryBlock* blocks; /**< Dynamically allocated array of memory blocks. */
+    size_t capacity; /**< Capacity of the `blocks` array. */
+    size_t used; /**< Number of slots of the `blocks` array in use, including freed slots waiting for reuse. */
+    size_t free_slot; /**< Index of the first freed slot of the `blocks` array, or INVALID_INDEX if there is none. */
+    AddressIndexEntry* address_index; /**< Open addressing hash index from block address to slot in `blocks`. */
+    size_t address_index_capacity; /**< Number of entries in `address_index` (always a power of two). */
+    size_t address_index_count; /**< Number of used entries in `address_index`. */
+    ObjectIndexEntry* object_index; /**< Open addressing hash index from object ID to the blocks allocated with it. */
+    size_t object_index_capacity; /**< Number of entries in `object_index` (always a power of two). */
+    size_t object_index_count; /**< Number of object IDs with allocated memory blocks in this shard. */
+    char padding[64]; /**< Keeps the locks of neighbouring shards off the same cache line. */
+};
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+
+/**
+ * @brief State of a thread that uses the tracker.
+ *
+ * The counters are written only by the owning thread, without atomic read-modify-write operations, and are summed
+ * by `ansi_c_mem_track_get_info`. A thread that frees a block allocated by another thread decrements its own
+ * counters, so a single state may wrap below zero; only the sum is meaningful.
+ */
+typedef struct ThreadState ThreadState;
+struct ThreadState {
+    char padding_front[64]; /**< Keeps the counters off the cache lines of other allocations. */
+    size_t total_size; /**< The share of the thread in `MemoryUsageInfo.total_size`. */
+    size_t size; /**< The share of the thread in `MemoryUsageInfo.size`. */
+    size_t total_memory_usage; /**< The share of the thread in `MemoryUsageInfo.total_user_memory_usage`. */
+    size_t memory_usage; /**< The share of the thread in `MemoryUsageInfo.memory_usage`. */
+    size_t total_freed_memory; /**< The share of the thread in `MemoryUsageInfo.total_freed_memory`. */
+    size_t unpublished_size; /**< The change of `size` that is not yet published for the peak. */
+    size_t unpublished_memory_usage; /**< The change of `memory_usage` that is not yet published for the peak. */
+    size_t size_histogram[SIZE_HISTOGRAM_BUCKET_COUNT]; /**< The share of the thread in the size histogram. */
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    MemoryShard* shard; /**< The shard that tracks the blocks allocated by the thread. */
+#endif
+    size_t orphaned; /**< 1 if the thread has exited and the state waits for a new owner. */
+    ThreadState* next; /**< The next state in the list of all states, which never changes once the state is published. */
+    char padding_back[64]; /**< Keeps the counters off the cache lines of other allocations. */
+};
+
+static ThreadState* thread_states = NULL; /**< The list of all thread states. */
+static THREAD_LOCAL ThreadState* thread_state = NULL; /**< The state of the calling thread. */
+static THREAD_LOCAL size_t thread_state_generation = 0; /**< The value of `generation` when `thread_state` was set. */
+static size_t generation = 0; /**< Incremented by every initialization, so states of an earlier one are not reused. */
+static THREAD_KEY_TYPE thread_state_key; /**< Marks the state of an exiting thread as orphaned. */
+static size_t published_size = 0; /**< The sum of the published changes of `size`, see counters_update. */
+static size_t published_memory_usage = 0; /**< The sum of the published changes of `memory_usage`. */
+
+#ifndef ANSI_C_MEM_TRACK_PEAK_SLACK
+#define ANSI_C_MEM_TRACK_PEAK_SLACK (64 * 1024)
+#endif
+#if (ANSI_C_MEM_TRACK_PEAK_SLACK) < 1
+#error ANSI_C_MEM_TRACK_PEAK_SLACK must be at least 1
+#endif
+#define PEAK_SLACK_BLOCKS ((ANSI_C_MEM_TRACK_PEAK_SLACK) < 64 ? (size_t)(ANSI_C_MEM_TRACK_PEAK_SLACK) : (size_t)64)
+
+static ThreadState* thread_state_get(void);
+
+#endif // ANSI_C_MEM_TRACK_THREAD_SAFE
+
+#ifndef ANSI_C_MEM_TRACK_THREAD_CACHE
+/**
+ * @brief Hashes a block address for the address index and the shard selection.
+ *
+ * The low bits of heap addresses are mostly zero because of alignment, so they are shifted out and the
+ * remaining bits are mixed with a multiplicative hash.
+ *
+ * @param address The address to hash.
+ * @return The hash value.
+ */
+static size_t hash_address(const void* address) {
+    uintptr_t value = (uintptr_t)address >> 4;
+    value ^= value >> 16;
+    value *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+    value ^= value >> 15;
+    return (size_t)value;
+}
+#endif
+
+struct AddressIndexEntry {
+    const void* address; /**< The tracked address, or NULL if the entry is empty. */
+    size_t slot;         /**< The slot of the memory block in the shard blocks. */
+};
+
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+
+#define HEADER_MAGIC 0xA17CB10CU
+
+/**
+ * @brief Header stored in front of every tracked memory block in inline header mode.
+ *
+ * The union members only make the header as strictly aligned as the blocks returned by malloc, so the
+ * user block behind it keeps malloc's alignment.
+ */
+typedef union {
+    struct {
+        size_t slot;        /**< The slot of the memory block in the blocks of its shard. */
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+        size_t shard;       /**< The index of the shard of the thread that allocated the memory block. */
+        union {
+            size_t size;       /**< The size of the memory block while it is allocated. */
+            void* next_remote; /**< The next header in the remote-free stack of the shard once another thread freed the block. */
+        };
+        size_t magic;       /**< header_magic(slot, shard) while the block is tracked, anything else otherwise. */
+#else
+        unsigned int shard; /**< The index of the shard that tracks the memory block. */
+        unsigned int magic; /**< header_magic(slot, shard) while the block is tracked, anything else otherwise. */
+#endif
+    } info;
+    long double align_long_double;
+    long long align_long_long;
+    void* align_pointer;
+} MemoryBlockHeader;
+
+#define BLOCK_HEADER_SIZE sizeof(MemoryBlockHeader)
+
+static MemoryBlockHeader* header_of(const void* address) {
+    return (MemoryBlockHeader*)((char*)address - BLOCK_HEADER_SIZE);
+}
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+#define header_magic(slot, shard) (HEADER_MAGIC ^ (slot) ^ ((size_t)(shard) << (sizeof(size_t) * 4)))
+#else
+#define header_magic(slot, shard) (HEADER_MAGIC ^ (unsigned int)(slot) ^ (shard))
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+/*
+ * A block that is not sampled is not tracked. Its header has a shard that no tracked block has and holds its size
+ * and backend instead of a slot, so free and realloc handle it without a lock. In the thread cache build the shard
+ * is INVALID_INDEX and the slot holds the backend, otherwise the shard is UNSAMPLED_SHARD plus the backend and the slot
+ * holds the size.
+ */
+#define UNSAMPLED_SHARD 0xFFFFFFF0U
+
+static void unsampled_header_set(void* address, size_t size, MemoryBackend backend) {
+    MemoryBlockHeader* header = header_of(address);
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    header->info.slot = (size_t)backend;
+    header->info.shard = INVALID_INDEX;
+    header->info.size = size;
+#else
+    header->info.slot = size;
+    header->info.shard = UNSAMPLED_SHARD + (unsigned int)backend;
+#endif
+    header->info.magic = header_magic(header->info.slot, header->info.shard);
+}
+
+/**
+ * @brief Reads the size and backend of a block that was not sampled.
+ *
+ * @return true if the block was allocated without being sampled and is not freed yet.
+ */
+static bool unsampled_header_get(const void* address, size_t* size, MemoryBackend* backend) {
+    const MemoryBlockHeader* header = header_of(address);
+    if (header->info.magic != header_magic(header->info.slot, header->info.shard)) {
+        return false;
+    }
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    if (header->info.shard != INVALID_INDEX) {
+        return false;
+    }
+    *size = header->info.size;
+    *backend = (MemoryBackend)header->info.slot;
+#else
+    if (header->info.shard < UNSAMPLED_SHARD) {
+        return false;
+    }
+    *size = header->info.slot;
+    *backend = (MemoryBackend)(header->info.shard - UNSAMPLED_SHARD);
+#endif
+    return true;
+}
+#endif // ANSI_C_MEM_TRACK_SAMPLING
+
+#else
+
+#define BLOCK_HEADER_SIZE 0
+
+/**
+ * @brief Inserts an entry into the address index without checking the load factor.
+ */
+static void address_index_put(AddressIndexEntry* entries, size_t capacity, const void* address, size_t slot) {
+    size_t mask = capacity - 1;
+    size_t i = hash_address(address) & mask;
+    while (entries[i].address) {
+        if (entries[i].address == address) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    entries[i].address = address;
+    entries[i].slot = slot;
+}
+
+/**
+ * @brief Resizes the address index and rehashes its entries.
+ *
+ * @param capacity The new capacity, must be a power of two.
+ * @return true if the index was resized, false if the allocation failed.
+ */
+static bool address_index_resize(MemoryShard* shard, size_t capacity) {
+    AddressIndexEntry* entries = (AddressIndexEntry*)calloc(capacity, sizeof(AddressIndexEntry));
+    if (!entries) {
+        return false;
+    }
+    for (size_t i = 0; i < shard->address_index_capacity; ++i) {
+        if (shard->address_index[i].address) {
+            address_index_put(entries, capacity, shard->address_index[i].address, shard->address_index[i].slot);
+        }
+    }
+    free(shard->address_index);
+    shard->address_index = entries;
+    shard->address_index_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Makes sure the address index can take `count` entries while staying at most half full.
+ *
+ * @param count The number of entries the index must be able to hold.
+ * @return true if the index has enough room, false if growing it failed.
+ */
+static bool address_index_reserve(MemoryShard* shard, size_t count) {
+    if (count * 2 <= shard->address_index_capacity) {
+        return true;
+    }
+    size_t capacity = shard->address_index_capacity ? shard->address_index_capacity : DEFAULT_INDEX_CAPACITY;
+    while (count * 2 > capacity) {
+        capacity *= 2;
+    }
+    return address_index_resize(shard, capacity);
+}
+
+/**
+ * @brief Adds an address to the address index. The caller must have reserved room with `address_index_reserve`.
+ */
+static void address_index_insert(MemoryShard* shard, const void* address, size_t slot) {
+    address_index_put(shard->address_index, shard->address_index_capacity, address, slot);
+    shard->address_index_count++;
+}
+
+/**
+ * @brief Looks up the slot of a tracked address.
+ *
+ * @param address The address to look up.
+ * @return The slot of the memory block in the shard blocks, or INVALID_INDEX if the address is not tracked.
+ */
+static size_t address_index_find(MemoryShard* shard, const void* address) {
+    if (!address || !shard->address_index) {
+        return INVALID_INDEX;
+    }
+    size_t mask = shard->address_index_capacity - 1;
+    size_t i = hash_address(address) & mask;
+    while (shard->address_index[i].address) {
+        if (shard->address_index[i].address == address) {
+            return shard->address_index[i].slot;
+        }
+        i = (i + 1) & mask;
+    }
+    return INVALID_INDEX;
+}
+
+/**
+ * @brief Removes an address from the address index.
+ *
+ * Uses backward shift deletion, so the index never accumulates tombstones.
+ *
+ * @param address The address to remove.
+ */
+static void address_index_remove(MemoryShard* shard, const void* address) {
+    if (!address || !shard->address_index) {
+        return;
+    }
+    AddressIndexEntry* entries = shard->address_index;
+    size_t mask = shard->address_index_capacity - 1;
+    size_t i = hash_address(address) & mask;
+    while (entries[i].address != address) {
+        if (!entries[i].address) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!entries[j].address) {
+            break;
+        }
+        size_t home = hash_address(entries[j].address) & mask;
+        // Move the entry back if its home position is not cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            entries[i] = entries[j];
+            i = j;
+        }
+    }
+    entries[i].address = NULL;
+    entries[i].slot = 0;
+    shard->address_index_count--;
+}
+
+/**
+ * @brief Rebuilds the address index from the blocks array, e.g. after the blocks have been moved by compaction.
+ */
+static void address_index_rebuild(MemoryShard* shard) {
+    if (!shard->address_index) {
+        return;
+    }
+    memset(shard->address_index, 0, shard->address_index_capacity * sizeof(AddressIndexEntry));
+    shard->address_index_count = 0;
+    for (size_t i = 0; i < shard->used; ++i) {
+        if (shard->blocks[i].is_allocated) {
+            address_index_insert(shard, shard->blocks[i].address, i);
+        }
+    }
+}
+
+#endif // ANSI_C_MEM_TRACK_INLINE_HEADER
+
+/**
+ * @brief Returns the address returned by the system allocator for a tracked block.
+ */
+static void* raw_address(void* address) {
+    return (char*)address - BLOCK_HEADER_SIZE;
+}
+
+/**
+ * @brief Allocates the memory of a block from the arena of its object ID if there is one, otherwise from the slabs
+ * if it is small enough, otherwise from the system.
+ *
+ * @param size The size including the block header.
+ * @param object_id The object ID of the block.
+ * @param backend Receives the allocator that provided the memory.
+ */
+static void* backend_alloc(size_t size, size_t object_id, MemoryBackend* backend) {
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    void* arena_raw = ansi_c_mem_track_arena_alloc(object_id, size);
+    if (arena_raw) {
+        *backend = MEMORY_BACKEND_ARENA;
+        return arena_raw;
+    }
+#else
+    (void)object_id;
+#endif
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    if (size <= SLAB_MAX_BLOCK_SIZE) {
+        void* raw = ansi_c_mem_track_slab_alloc(size);
+        if (raw) {
+            *backend = MEMORY_BACKEND_SLAB;
+            return raw;
+        }
+    }
+#endif
+    *backend = MEMORY_BACKEND_SYSTEM;
+    return malloc(size);
+}
+
+/**
+ * @brief Releases the memory of a block to the allocator that provided it.
+ *
+ * @param raw The address returned by the allocator.
+ * @param block The block as it was tracked.
+ */
+static void backend_free(void* raw, const MemoryBlock* block) {
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    if (block->backend == MEMORY_BACKEND_SLAB) {
+        ansi_c_mem_track_slab_free(raw);
+        return;
+    }
+#endif
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    if (block->backend == MEMORY_BACKEND_ARENA) {
+        ansi_c_mem_track_arena_free(block->optional_object_id, raw, block->size + BLOCK_HEADER_SIZE);
+        return;
+    }
+#endif
+    (void)block;
+    free(raw);
+}
+
+/**
+ * @brief Resizes the memory of a block. A slab block stays in place while the new size belongs to the same size
+ * class and an arena block while it is the tip of its arena, otherwise the contents move to new memory.
+ *
+ * @param block The block as it is tracked.
+ * @param size The new size including the block header.
+ * @param backend Receives the allocator of the resized memory.
+ * @return The resized memory, or NULL if it could not be allocated and the block is unchanged.
+ */
+static void* backend_realloc(void* raw, const MemoryBlock* block, size_t size, MemoryBackend* backend) {
+    size_t old_size = block->size + BLOCK_HEADER_SIZE;
+    *backend = block->backend;
+    if (block->backend == MEMORY_BACKEND_SYSTEM) {
+        // Blocks of the system allocator stay there, the system realloc can often grow them in place
+        return realloc(raw, size);
+    }
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    if (block->backend == MEMORY_BACKEND_SLAB
+        && ansi_c_mem_track_slab_class_size(size) == ansi_c_mem_track_slab_block_size(raw)) {
+        return raw;
+    }
+#endif
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    if (block->backend == MEMORY_BACKEND_ARENA
+        && ansi_c_mem_track_arena_resize(block->optional_object_id, raw, old_size, size)) {
+        return raw;
+    }
+#endif
+    MemoryBackend new_backend;
+    void* new_raw = backend_alloc(size, block->optional_object_id, &new_backend);
+    if (!new_raw) {
+        return NULL;
+    }
+    memcpy(new_raw, raw, size < old_size ? size : old_size);
+    backend_free(raw, block);
+    *backend = new_backend;
+    return new_raw;
+}
+
+/**
+ * @brief Makes sure one more block can be added to the block index.
+ *
+ * @return true if there is room, false if growing the index failed.
+ */
+static bool block_index_reserve(MemoryShard* shard) {
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    (void)shard;
+    return true;
+#else
+    return address_index_reserve(shard, shard->address_index_count + 1);
+#endif
+}
+
+/**
+ * @brief Makes the block in the given slot findable by its address.
+ */
+static void block_index_insert(MemoryShard* shard, size_t slot) {
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    MemoryBlockHeader* header = header_of(shard->blocks[slot].address);
+    header->info.slot = slot;
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    header->info.shard = shard->index;
+    header->info.size = shard->blocks[slot].size;
+#else
+    header->info.shard = (unsigned int)(shard - g_mem_info.shards);
+#endif
+    header->info.magic = header_magic(slot, header->info.shard);
+#else
+    address_index_insert(shard, shard->blocks[slot].address, slot);
+#endif
+}
+
+/**
+ * @brief Makes the block in the given slot no longer findable by its address.
+ */
+static void block_index_remove(MemoryShard* shard, size_t slot) {
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    header_of(shard->blocks[slot].address)->info.magic = 0;
+#else
+    address_index_remove(shard, shard->blocks[slot].address);
+#endif
+}
+
+/**
+ * @brief Looks up the slot of a tracked block by its address.
+ *
+ * In inline header mode the slot is read from the header in front of the block and validated against the
+ * blocks array, so pointers that were not allocated by the tracker are recognized as long as the bytes
+ * in front of them are readable.
+ *
+ * @param address The address of the block.
+ * @return The slot of the block, or INVALID_INDEX if the address is not tracked.
+ */
+static size_t block_index_find(MemoryShard* shard, const void* address) {
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    if (!address || !shard->blocks) {
+        return INVALID_INDEX;
+    }
+    const MemoryBlockHeader* header = header_of(address);
+    size_t slot = header->info.slot;
+    if (header->info.magic != header_magic(slot, header->info.shard) || slot >= shard->used
+        || !shard->blocks[slot].is_allocated || shard->blocks[slot].address != address) {
+        return INVALID_INDEX;
+    }
+    return slot;
+#else
+    return address_index_find(shard, address);
+#endif
+}
+
+/**
+ * @brief Rebuilds the block index after the blocks have been moved by compaction.
+ */
+static void block_index_rebuild(MemoryShard* shard) {
+#ifdef ANSI_C_MEM_TRACK_INLINE_HEADER
+    for (size_t i = 0; i < shard->used; ++i) {
+        if (shard->blocks[i].is_allocated) {
+            block_index_insert(shard, i);
+        }
+    }
+#else
+    address_index_rebuild(shard);
+#endif
+}
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+
+/*
+ * The shards are stored in pages that never move, so the index in a block header is checked against the shard
+ * count and turned into a shard without the lock, and a damaged header cannot point the tracker outside the shards.
+ */
+static MemoryShard* shard_pages[SHARD_PAGE_COUNT];
+
+static MemoryShard* shard_at(size_t index) {
+    return &shard_pages[index / SHARD_PAGE_SIZE][index % SHARD_PAGE_SIZE];
+}
+
+/**
+ * @brief Selects the shard that tracks a newly allocated memory block, which is the shard of the calling thread.
+ *
+ * @return The shard, or NULL if the thread has no shard and one could not be created.
+ */
+static MemoryShard* shard_select(const void* address) {
+    (void)address;
+    ThreadState* state = thread_state_get();
+    return state ? state->shard : NULL;
+}
+
+/**
+ * @brief Returns the shard of the calling thread, or NULL if it has none yet.
+ */
+static MemoryShard* shard_of_thread(void) {
+    return thread_state && thread_state_generation == ATOMIC_LOAD(&generation) ? thread_state->shard : NULL;
+}
+
+#else
+
+/**
+ * @brief Selects the shard that tracks a newly allocated memory block.
+ *
+ * The high bits of the address hash are used, because the low bits select the entry in the address index.
+ */
+static MemoryShard* shard_select(const void* address) {
+    size_t hash = hash_address(address) >> (sizeof(size_t) * 4);
+    return &g_mem_info.shards[hash & (ANSI_C_MEM_TRACK_SHARD_COUNT - 1)];
+}
+
+#endif // ANSI_C_MEM_TRACK_THREAD_CACHE
+
+/**
+ * @brief Returns the shard that tracks a memory block, without locking it.
+ *
+ * In inline header mode the shard is read from the header, so a reallocated block stays in its shard even if its
+ * new address hashes to another one. The caller still has to look the block up under the lock of the shard.
+ *
+ * @return The shard, or NULL if the tracker is not initialized or the address cannot belong to a tracked block.
+ */
+static MemoryShard* shard_of(const void* address) {
+    if (!address || !ATOMIC_LOAD_PTR(&g_mem_info.shards)) {
+        return NULL;
+    }
+#if defined(ANSI_C_MEM_TRACK_THREAD_CACHE)
+    // The shard count is published after the shard, so a shard below it is initialized
+    const MemoryBlockHeader* header = header_of(address);
+    size_t shard = header->info.shard;
+    if (header->info.magic != header_magic(header->info.slot, shard) || shard >= ATOMIC_LOAD(&g_mem_info.shard_count)) {
+        return NULL;
+    }
+    return shard_at(shard);
+#elif defined(ANSI_C_MEM_TRACK_INLINE_HEADER)
+    unsigned int shard = header_of(address)->info.shard;
+    return shard < ANSI_C_MEM_TRACK_SHARD_COUNT ? &g_mem_info.shards[shard] : NULL;
+#else
+    return shard_select(address);
+#endif
+}
+
+typedef struct ObjectTotals ObjectTotals;
+
+struct ObjectIndexEntry {
+    size_t object_id;     /**< The object ID. */
+    size_t head;          /**< The first slot of the list of memory blocks allocated with the object ID. */
+    size_t size;          /**< Number of memory blocks in the list, or 0 if the entry is empty. */
+    size_t memory_usage;  /**< Total size of the memory blocks in the list. */
+    ObjectTotals* totals; /**< The totals of the object ID over all shards, NULL if they could not be recorded. */
+};
+
+static size_t hash_object_id(size_t object_id) {
+    uint64_t value = (uint64_t)object_id;
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    return (size_t)value;
+}
+
+/**
+ * @brief Resizes the object index and rehashes its entries.
+ *
+ * @param capacity The new capacity, must be a power of two.
+ * @return true if the index was resized, false if the allocation failed.
+ */
+static bool object_index_resize(MemoryShard* shard, size_t capacity) {
+    ObjectIndexEntry* entries = (ObjectIndexEntry*)calloc(capacity, sizeof(ObjectIndexEntry));
+    if (!entries) {
+        return false;
+    }
+    for (size_t i = 0; i < shard->object_index_capacity; ++i) {
+        if (shard->object_index[i].size) {
+            size_t j = hash_object_id(shard->object_index[i].object_id) & (capacity - 1);
+            while (entries[j].size) {
+                j = (j + 1) & (capacity - 1);
+            }
+            entries[j] = shard->object_index[i];
+        }
+    }
+    free(shard->object_index);
+    shard->object_index = entries;
+    shard->object_index_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Makes sure one more object ID can be added to the object index while keeping it at most half full.
+ *
+ * @return true if there is room, false if growing the index failed.
+ */
+static bool object_index_reserve(MemoryShard* shard) {
+    if ((shard->object_index_count + 1) * 2 <= shard->object_index_capacity) {
+        return true;
+    }
+    size_t capacity = shard->object_index_capacity ? shard->object_index_capacity * 2 : DEFAULT_OBJECT_INDEX_CAPACITY;
+    return object_index_resize(shard, capacity);
+}
+
+/**
+ * @brief Finds the position of an object ID in the object index.
+ *
+ * @return The position of the entry of the object ID, or the empty position where it would be inserted.
+ */
+static size_t object_index_position(MemoryShard* shard, size_t object_id) {
+    size_t mask = shard->object_index_capacity - 1;
+    size_t i = hash_object_id(object_id) & mask;
+    while (shard->object_index[i].size && shard->object_index[i].object_id != object_id) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Returns the object index entry of an object ID, or NULL if it has no allocated memory blocks.
+ */
+static ObjectIndexEntry* object_index_find(MemoryShard* shard, size_t object_id) {
+    if (!shard->object_index) {
+        return NULL;
+    }
+    ObjectIndexEntry* entry = &shard->object_index[object_index_position(shard, object_id)];
+    return entry->size ? entry : NULL;
+}
+
+/**
+ * @brief Removes the entry at the given position from the object index with backward shift deletion.
+ */
+static void object_index_remove_at(MemoryShard* shard, size_t i) {
+    ObjectIndexEntry* entries = shard->object_index;
+    size_t mask = shard->object_index_capacity - 1;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!entries[j].size) {
+            break;
+        }
+        size_t home = hash_object_id(entries[j].object_id) & mask;
+        // Move the entry back if its home position is not cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            entries[i] = entries[j];
+            i = j;
+        }
+    }
+    memset(&entries[i], 0, sizeof(ObjectIndexEntry));
+    shard->object_index_count--;
+}
+
+static ObjectTotals* object_totals_acquire(size_t object_id, size_t size);
+static void object_totals_update(ObjectTotals* totals, size_t blocks, size_t allocated, size_t freed);
+
+/**
+ * @brief Puts the block in the given slot at the head of the list of an object index entry.
+ */
+static void object_index_push(MemoryShard* shard, ObjectIndexEntry* entry, size_t slot) {
+    MemoryBlock* block = &shard->blocks[slot];
+    block->prev_slot = INVALID_INDEX;
+    block->next_slot = entry->head;
+    if (entry->head != INVALID_INDEX) {
+        shard->blocks[entry->head].prev_slot = slot;
+    }
+    entry->head = slot;
+}
+
+/**
+ * @brief Adds the block in the given slot to the list of its object ID and to the totals of the object ID. The
+ * caller must have reserved room with `object_index_reserve`.
+ */
+static void object_index_link(MemoryShard* shard, size_t slot) {
+    MemoryBlock* block = &shard->blocks[slot];
+    ObjectIndexEntry* entry = &shard->object_index[object_index_position(shard, block->optional_object_id)];
+    if (!entry->size) {
+        entry->object_id = block->optional_object_id;
+        entry->head = INVALID_INDEX;
+        entry->memory_usage = 0;
+        entry->totals = object_totals_acquire(block->optional_object_id, block->size);
+        shard->object_index_count++;
+    }
+    else if (entry->totals) {
+        object_totals_update(entry->totals, 1, block->size, 0);
+    }
+    object_index_push(shard, entry, slot);
+    entry->size++;
+    entry->memory_usage += block->size;
+}
+
+/**
+ * @brief Removes the block in the given slot from the list of its object ID.
+ */
+static void object_index_unlink(MemoryShard* shard, size_t slot) {
+    MemoryBlock* block = &shard->blocks[slot];
+    size_t i = object_index_position(shard, block->optional_object_id);
+    ObjectIndexEntry* entry = &shard->object_index[i];
+    if (!entry->size) {
+        return;
+    }
+    if (block->prev_slot != INVALID_INDEX) {
+        shard->blocks[block->prev_slot].next_slot = block->next_slot;
+    }
+    else {
+        entry->head = block->next_slot;
+    }
+    if (block->next_slot != INVALID_INDEX) {
+        shard->blocks[block->next_slot].prev_slot = block->prev_slot;
+    }
+    block->prev_slot = INVALID_INDEX;
+    block->next_slot = INVALID_INDEX;
+    // The last block of the shard gives up the totals, which may then be freed by `object_totals_reset`
+    if (entry->totals) {
+        object_totals_update(entry->totals, (size_t)-1, 0, block->size);
+    }
+    entry->memory_usage -= block->size;
+    if (--entry->size == 0) {
+        object_index_remove_at(shard, i);
+    }
+}
+
+/**
+ * @brief Rebuilds the lists of the object index after the blocks have been moved by compaction. The entries and
+ * their counts stay as they are.
+ */
+static void object_index_rebuild(MemoryShard* shard) {
+    if (!shard->object_index) {
+        return;
+    }
+    for (size_t i = 0; i < shard->object_index_capacity; ++i) {
+        shard->object_index[i].head = INVALID_INDEX;
+    }
+    for (size_t i = shard->used; i-- > 0; ) {
+        if (shard->blocks[i].is_allocated) {
+            size_t position = object_index_position(shard, shard->blocks[i].optional_object_id);
+            object_index_push(shard, &shard->object_index[position], i);
+        }
+    }
+}
+
+/**
+ * @brief Raises a peak to `value` if it is higher. The peak may be raised by several threads at once.
+ */
+static void peak_raise(size_t* peak, size_t value) {
+    size_t current = ATOMIC_LOAD(peak);
+    while (value > current && !ATOMIC_CAS(peak, current, value)) {
+        current = ATOMIC_LOAD(peak);
+    }
+}
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+#define OBJECT_TOTALS_STRIPE_COUNT 16
+#else
+#define OBJECT_TOTALS_STRIPE_COUNT 1
+#endif
+
+/**
+ * @brief The current and peak usage of an object ID over all shards.
+ *
+ * The totals are allocated once per object ID and do not move, so a shard keeps a pointer to them in its object
+ * index entry and updates them atomically without the lock of the stripe.
+ */
+struct ObjectTotals {
+    size_t object_id;         /**< The object ID. */
+    size_t size;              /**< Number of memory blocks currently allocated with the object ID. */
+    size_t memory_usage;      /**< Total size of the memory blocks currently allocated with the object ID. */
+    size_t peak_size;         /**< The highest `size` since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest `memory_usage` since the last reset of the peaks. */
+};
+
+/**
+ * @brief Open addressing hash table of the totals of the object IDs that hash to the stripe.
+ *
+ * The blocks of an object ID may be spread over several shards, so their peaks are kept here. The lock of the
+ * stripe is taken only when a shard sees an object ID for the first time, and by the readers. The totals are only
+ * freed by `ansi_c_mem_track_reset_peaks`, so the peak of an object ID outlives its last block.
+ */
+typedef struct {
+    MUTEX_TYPE lock;        /**< Protects the table of the stripe. */
+    ObjectTotals** entries; /**< The entries of the table, NULL until the first object ID is added. */
+    size_t capacity;        /**< Number of entries in `entries` (always a power of two). */
+    size_t count;           /**< Number of used entries in `entries`. */
+    char padding[64];       /**< Keeps the locks of neighbouring stripes off the same cache line. */
+} ObjectTotalsStripe;
+
+static ObjectTotalsStripe object_totals[OBJECT_TOTALS_STRIPE_COUNT];
+
+static ObjectTotalsStripe* object_totals_stripe(size_t object_id) {
+    return &object_totals[hash_object_id(object_id) % OBJECT_TOTALS_STRIPE_COUNT];
+}
+
+/**
+ * @brief Finds the position of an object ID in a stripe of the object totals. The caller must hold its lock.
+ *
+ * @return The position of the entry of the object ID, or the empty position where it would be inserted.
+ */
+static size_t object_totals_position(ObjectTotals* const* entries, size_t capacity, size_t object_id) {
+    size_t mask = capacity - 1;
+    size_t i = (hash_object_id(object_id) / OBJECT_TOTALS_STRIPE_COUNT) & mask;
+    while (entries[i] && entries[i]->object_id != object_id) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Rebuilds a stripe of the object totals with the given capacity. The totals for which `keep` is false
+ * are freed. The caller must hold the lock of the stripe.
+ *
+ * @return true if the stripe was rebuilt, false if the allocation failed.
+ */
+static bool object_totals_rebuild(ObjectTotalsStripe* stripe, size_t capacity, bool (*keep)(const ObjectTotals*)) {
+    ObjectTotals** entries = (ObjectTotals**)calloc(capacity, sizeof(ObjectTotals*));
+    if (!entries) {
+        return false;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < stripe->capacity; ++i) {
+        ObjectTotals* totals = stripe->entries[i];
+        if (totals && (!keep || keep(totals))) {
+            entries[object_totals_position(entries, capacity, totals->object_id)] = totals;
+            count++;
+        }
+        else {
+            free(totals);
+        }
+    }
+    free(stripe->entries);
+    stripe->entries = entries;
+    stripe->capacity = capacity;
+    stripe->count = count;
+    return true;
+}
+
+/**
+ * @brief Updates the totals of an object ID by a tracked block and raises its peaks.
+ *
+ * @param blocks 1 for a new block, (size_t)-1 for a freed block.
+ * @param allocated The number of bytes allocated.
+ * @param freed The number of bytes freed.
+ */
+static void object_totals_update(ObjectTotals* totals, size_t blocks, size_t allocated, size_t freed) {
+    size_t size = ATOMIC_FETCH_ADD(&totals->size, blocks) + blocks;
+    size_t memory_usage = ATOMIC_FETCH_ADD(&totals->memory_usage, allocated - freed) + allocated - freed;
+    if (allocated > freed) {
+        peak_raise(&totals->peak_size, size);
+        peak_raise(&totals->peak_memory_usage, memory_usage);
+    }
+}
+
+/**
+ * @brief Returns the totals of an object ID for a shard that sees the object ID for the first time, and adds the
+ * first block of the shard to them. The block is added under the lock of the stripe, so `object_totals_reset` never
+ * frees totals that a shard refers to.
+ *
+ * @return The totals, or NULL if there was no room for a new object ID. The allocation itself goes on without them.
+ */
+static ObjectTotals* object_totals_acquire(size_t object_id, size_t size) {
+    ObjectTotalsStripe* stripe = object_totals_stripe(object_id);
+    MUTEX_LOCK(&stripe->lock);
+    if ((stripe->count + 1) * 2 > stripe->capacity) {
+        object_totals_rebuild(stripe, stripe->capacity ? stripe->capacity * 2 : DEFAULT_OBJECT_INDEX_CAPACITY, NULL);
+    }
+    ObjectTotals* totals = NULL;
+    if (stripe->entries) {
+        size_t i = object_totals_position(stripe->entries, stripe->capacity, object_id);
+        if (!stripe->entries[i] && (stripe->count + 1) * 2 <= stripe->capacity) {
+            stripe->entries[i] = (ObjectTotals*)calloc(1, sizeof(ObjectTotals));
+            if (stripe->entries[i]) {
+                stripe->entries[i]->object_id = object_id;
+                stripe->count++;
+            }
+        }
+        totals = stripe->entries[i];
+    }
+    if (totals) {
+        object_totals_update(totals, 1, size, 0);
+    }
+    MUTEX_UNLOCK(&stripe->lock);
+    return totals;
+}
+
+static bool object_totals_is_allocated(const ObjectTotals* totals) {
+    return ATOMIC_LOAD(&totals->size) != 0;
+}
+
+/**
+ * @brief Resets the peaks of all object IDs to their current usage and forgets the object IDs without blocks.
+ */
+static void object_totals_reset(void) {
+    for (size_t i = 0; i < OBJECT_TOTALS_STRIPE_COUNT; ++i) {
+        ObjectTotalsStripe* stripe = &object_totals[i];
+        MUTEX_LOCK(&stripe->lock);
+        size_t allocated = 0;
+        for (size_t j = 0; j < stripe->capacity; ++j) {
+            ObjectTotals* totals = stripe->entries[j];
+            if (totals) {
+                ATOMIC_STORE(&totals->peak_size, ATOMIC_LOAD(&totals->size));
+                ATOMIC_STORE(&totals->peak_memory_usage, ATOMIC_LOAD(&totals->memory_usage));
+                allocated += object_totals_is_allocated(totals);
+            }
+        }
+        // The table shrinks with the forgotten object IDs; if the allocation fails they are kept
+        size_t capacity = DEFAULT_OBJECT_INDEX_CAPACITY;
+        while ((allocated + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        if (stripe->entries && capacity <= stripe->capacity) {
+            object_totals_rebuild(stripe, capacity, object_totals_is_allocated);
+        }
+        MUTEX_UNLOCK(&stripe->lock);
+    }
+}
+
+#define DEFAULT_CALL_SITE_INDEX_CAPACITY 64
+
+struct CallSiteIndexEntry {
+    size_t hash; /**< The hash of the call site contents. */
+    size_t id;   /**< The ID of the call site, or 0 if the entry is empty. */
+};
+
+/**
+ * @brief Hashes a string with FNV-1a, continuing from `hash`. A NULL string hashes differently from an empty one.
+ */
+static size_t hash_string(size_t hash, const char* str) {
+    if (!str) {
+        return (hash ^ 0xFF) * (size_t)0x100000001B3ULL;
+    }
+    for (; *str; ++str) {
+        hash = (hash ^ (unsigned char)*str) * (size_t)0x100000001B3ULL;
+    }
+    return (hash ^ 0) * (size_t)0x100000001B3ULL;
+}
+
+static size_t hash_call_site(const char* file_name, const char* comment, const char* type, unsigned int line) {
+    size_t hash = (size_t)0xCBF29CE484222325ULL;
+    hash = hash_string(hash, file_name);
+    hash = hash_string(hash, comment);
+    hash = hash_string(hash, type);
+    return (hash ^ line) * (size_t)0x100000001B3ULL;
+}
+
+static bool call_site_string_equals(const char* a, const char* b) {
+    if (a == b) {
+        return true;
+    }
+    if (!a || !b) {
+        return false;
+    }
+    return strcmp(a, b) == 0;
+}
+
+static CallSite* call_site_at(size_t id) {
+    return &g_mem_info.call_site_pages[id / CALL_SITE_PAGE_SIZE][id % CALL_SITE_PAGE_SIZE];
+}
+
+struct CallSiteUsage {
+    size_t size;              /**< Number of tracked memory blocks currently allocated at the call site. */
+    size_t memory_usage;      /**< Total size of the tracked memory blocks currently allocated at the call site. */
+    size_t peak_size;         /**< The highest `size` since the last reset of the peaks. */
+    size_t peak_memory_usage; /**< The highest `memory_usage` since the last reset of the peaks. */
+    size_t total_size;        /**< Number of tracked memory blocks allocated at the call site. */
+    size_t total_memory_usage; /**< Bytes allocated at the call site, including growth by realloc. */
+    size_t size_histogram[SIZE_HISTOGRAM_BUCKET_COUNT]; /**< The sizes requested at the call site. */
+};
+
+static CallSiteUsage* call_site_usage_at(size_t id) {
+    return &g_mem_info.call_site_usage_pages[id / CALL_SITE_PAGE_SIZE][id % CALL_SITE_PAGE_SIZE];
+}
+
+/**
+ * @brief Resizes the call site index and rehashes its entries.
+ *
+ * @param capacity The new capacity, must be a power of two.
+ * @return true if the index was resized, false if the allocation failed.
+ */
+static bool call_site_index_resize(size_t capacity) {
+    CallSiteIndexEntry* entries = (CallSiteIndexEntry*)calloc(capacity, sizeof(CallSiteIndexEntry));
+    if (!entries) {
+        return false;
+    }
+    for (size_t i = 0; i < g_mem_info.call_site_index_capacity; ++i) {
+        if (g_mem_info.call_site_index[i].id) {
+            size_t j = g_mem_info.call_site_index[i].hash & (capacity - 1);
+            while (entries[j].id) {
+                j = (j + 1) & (capacity - 1);
+            }
+            entries[j] = g_mem_info.call_site_index[i];
+        }
+    }
+    free(g_mem_info.call_site_index);
+    g_mem_info.call_site_index = entries;
+    g_mem_info.call_site_index_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Sets up the call site table with the empty call site (ID 0).
+ *
+ * @return true if successful, false if an allocation failed.
+ */
+static bool call_sites_init(void) {
+    g_mem_info.call_site_pages = (CallSite**)calloc(CALL_SITE_PAGE_COUNT, sizeof(CallSite*));
+    g_mem_info.call_site_usage_pages = (CallSiteUsage**)calloc(CALL_SITE_PAGE_COUNT, sizeof(CallSiteUsage*));
+    if (!g_mem_info.call_site_pages || !g_mem_info.call_site_usage_pages) {
+        free(g_mem_info.call_site_pages);
+        free(g_mem_info.call_site_usage_pages);
+        g_mem_info.call_site_pages = NULL;
+        g_mem_info.call_site_usage_pages = NULL;
+        return false;
+    }
+    g_mem_info.call_site_pages[0] = (CallSite*)calloc(CALL_SITE_PAGE_SIZE, sizeof(CallSite));
+    g_mem_info.call_site_usage_pages[0] = (CallSiteUsage*)calloc(CALL_SITE_PAGE_SIZE, sizeof(CallSiteUsage));
+    g_mem_info.call_site_index = NULL;
+    g_mem_info.call_site_index_capacity = 0;
+    if (!g_mem_info.call_site_pages[0] || !g_mem_info.call_site_usage_pages[0]
+        || !call_site_index_resize(DEFAULT_CALL_SITE_INDEX_CAPACITY)) {
+        free(g_mem_info.call_site_pages[0]);
+        free(g_mem_info.call_site_usage_pages[0]);
+        free(g_mem_info.call_site_pages);
+        free(g_mem_info.call_site_usage_pages);
+        g_mem_info.call_site_pages = NULL;
+        g_mem_info.call_site_usage_pages = NULL;
+        return false;
+    }
+    g_mem_info.call_site_count = 1;
+    // Invalidates the call site IDs cached in the call site descriptors
+    ATOMIC_STORE(&call_site_generation, call_site_generation + 1);
+    return true;
+}
+
+/**
+ * @brief Frees all interned call sites.
+ */
+static void call_sites_cleanup(void) {
+    if (g_mem_info.call_site_pages) {
+        for (size_t id = 1; id < g_mem_info.call_site_count; ++id) {
+            CallSite* call_site = call_site_at(id);
+            free((void*)call_site->file_name);
+            free((void*)call_site->comment);
+            free((void*)call_site->type);
+        }
+        for (size_t i = 0; i < CALL_SITE_PAGE_COUNT; ++i) {
+            free(g_mem_info.call_site_pages[i]);
+            free(g_mem_info.call_site_usage_pages[i]);
+        }
+        free(g_mem_info.call_site_pages);
+        free(g_mem_info.call_site_usage_pages);
+        g_mem_info.call_site_pages = NULL;
+        g_mem_info.call_site_usage_pages = NULL;
+    }
+    free(g_mem_info.call_site_index);
+    g_mem_info.call_site_index = NULL;
+    g_mem_info.call_site_index_capacity = 0;
+    g_mem_info.call_site_count = 0;
+}
+
+/**
+ * @brief Looks up a call site in the call site index. The caller must hold the call site lock.
+ *
+ * @param position Receives the position of the matching entry, or of the empty entry where the call site belongs.
+ * @return The ID of the call site, or 0 if it is not interned yet.
+ */
+static size_t call_site_find(size_t hash, const char* file_name, const char* comment, const char* type, unsigned int line,
+    size_t* position) {
+    size_t mask = g_mem_info.call_site_index_capacity - 1;
+    size_t i = hash & mask;
+    while (g_mem_info.call_site_index[i].id) {
+        if (g_mem_info.call_site_index[i].hash == hash) {
+            const CallSite* call_site = call_site_at(g_mem_info.call_site_index[i].id);
+            if (call_site->line == line && call_site_string_equals(call_site->file_name, file_name)
+                && call_site_string_equals(call_site->comment, comment) && call_site_string_equals(call_site->type, type)) {
+                break;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    *position = i;
+    return g_mem_info.call_site_index[i].id;
+}
+
+/**
+ * @brief Adds a new call site at the given position of the call site index. The caller must hold the call site
+ * lock for writing.
+ *
+ * @return The ID of the call site, or 0 if the call site could not be recorded.
+ */
+static size_t call_site_add(size_t hash, const char* file_name, const char* comment, const char* type, unsigned int line,
+    size_t i) {
+    size_t id = g_mem_info.call_site_count;
+    if (id >= CALL_SITE_LIMIT) {
+        return 0;
+    }
+    if ((g_mem_info.call_site_count + 1) * 2 > g_mem_info.call_site_index_capacity) {
+        if (!call_site_index_resize(g_mem_info.call_site_index_capacity * 2)) {
+            return 0;
+        }
+        size_t mask = g_mem_info.call_site_index_capacity - 1;
+        i = hash & mask;
+        while (g_mem_info.call_site_index[i].id) {
+            i = (i + 1) & mask;
+        }
+    }
+    CallSite** page = &g_mem_info.call_site_pages[id / CALL_SITE_PAGE_SIZE];
+    if (!*page) {
+        *page = (CallSite*)calloc(CALL_SITE_PAGE_SIZE, sizeof(CallSite));
+        if (!*page) {
+            return 0;
+        }
+    }
+    CallSiteUsage** usage_page = &g_mem_info.call_site_usage_pages[id / CALL_SITE_PAGE_SIZE];
+    if (!*usage_page) {
+        *usage_page = (CallSiteUsage*)calloc(CALL_SITE_PAGE_SIZE, sizeof(CallSiteUsage));
+        if (!*usage_page) {
+            return 0;
+        }
+    }
+    char *file_name_poi = NULL, *comment_poi = NULL, *type_poi = NULL;
+    if (file_name) {
+        C_STRDUP(file_name_poi, strlen(file_name), file_name);
+    }
+    if (comment) {
+        C_STRDUP(comment_poi, strlen(comment), comment);
+    }
+    if (type) {
+        C_STRDUP(type_poi, strlen(type), type);
+    }
+    if ((file_name && !file_name_poi) || (comment && !comment_poi) || (type && !type_poi)) {
+        free(file_name_poi);
+        free(comment_poi);
+        free(type_poi);
+        return 0;
+    }
+    CallSite* call_site = call_site_at(id);
+    call_site->file_name = file_name_poi;
+    call_site->comment = comment_poi;
+    call_site->type = type_poi;
+    call_site->line = line;
+    g_mem_info.call_site_index[i].hash = hash;
+    g_mem_info.call_site_index[i].id = id;
+    // Published last, so that ansi_c_mem_track_get_call_site can read the call site without the lock
+    ATOMIC_STORE(&g_mem_info.call_site_count, id + 1);
+    return id;
+}
+
+/**
+ * @brief Returns the ID of the call site with the given contents, interning it if it is new.
+ *
+ * The strings are copied the first time a call site is seen, afterwards the lookup needs no allocation and,
+ * in the thread-safe build, only a shared lock.
+ *
+ * @return The ID of the call site, or 0 if the call site could not be recorded.
+ */
+static size_t call_site_intern(const char* file_name, const char* comment, const char* type, unsigned int line) {
+    if ((!file_name && !comment && !type) || !g_mem_info.call_site_pages) {
+        return 0;
+    }
+    size_t hash = hash_call_site(file_name, comment, type, line);
+    size_t i;
+    RWLOCK_READ_LOCK(&call_site_lock);
+    size_t id = call_site_find(hash, file_name, comment, type, line, &i);
+    RWLOCK_READ_UNLOCK(&call_site_lock);
+    if (id) {
+        return id;
+    }
+
+    // Another thread may have added the call site since the lookup
+    RWLOCK_WRITE_LOCK(&call_site_lock);
+    id = call_site_find(hash, file_name, comment, type, line, &i);
+    if (!id) {
+        id = call_site_add(hash, file_name, comment, type, line, i);
+    }
+    RWLOCK_WRITE_UNLOCK(&call_site_lock);
+    return id;
+}
+
+/**
+ * @brief Returns the ID of the call site of a static call site descriptor, see `ansi_c_mem_track_malloc_at`.
+ *
+ * The ID is interned on the first call and cached in the descriptor together with the generation of the call site
+ * table, so the later calls need neither the hash nor the lock, and a cache filled before a reinitialization is
+ * recognized as stale.
+ *
+ * @return The ID of the call site, or 0 if the call site could not be recorded.
+ */
+static size_t call_site_intern_descriptor(CallSiteDescriptor* descriptor) {
+    size_t cached = ATOMIC_LOAD(&descriptor->cached_id);
+    size_t generation = ATOMIC_LOAD(&call_site_generation);
+    if (cached / CALL_SITE_LIMIT == generation) {
+        return cached % CALL_SITE_LIMIT;
+    }
+    size_t id = call_site_intern(descriptor->file_name, descriptor->function_name, descriptor->type, descriptor->line);
+    if (id) {
+        ATOMIC_STORE(&descriptor->cached_id, generation * CALL_SITE_LIMIT + id);
+    }
+    return id;
+}
+
+const CallSite* ansi_c_mem_track_get_call_site(size_t call_site_id) {
+    if (call_site_id >= ATOMIC_LOAD(&g_mem_info.call_site_count)) {
+        return NULL;
+    }
+    return call_site_at(call_site_id);
+}
+
+/**
+ * @brief Writes a string of a call site, with tabs, line breaks and backslashes escaped, so that every call site
+ * stays on one line.
+ */
+static void dump_call_site_string(FILE* file, const char* text) {
+    for (; text && *text; ++text) {
+        if (*text == '\t') {
+            fputs("\\t", file);
+        }
+        else if (*text == '\n') {
+            fputs("\\n", file);
+        }
+        else if (*text == '\r') {
+            fputs("\\r", file);
+        }
+        else if (*text == '\\') {
+            fputs("\\\\", file);
+        }
+        else {
+            fputc(*text, file);
+        }
+    }
+}
+
+bool ansi_c_mem_track_dump_call_sites(const char* file_name) {
+    FILE* file = NULL;
+    if (!file_name || FOPEN(&file, file_name, "w") != 0) {
+        return false;
+    }
+    size_t count = ATOMIC_LOAD(&g_mem_info.call_site_count);
+    for (size_t id = 1; id < count; ++id) {
+        const CallSite* call_site = call_site_at(id);
+        fprintf(file, "%lu\t", (unsigned long)id);
+        dump_call_site_string(file, call_site->file_name);
+        if (call_site->line) {
+            fprintf(file, ":%u", call_site->line);
+        }
+        fputc('\t', file);
+        dump_call_site_string(file, call_site->comment);
+        fputc('\t', file);
+        dump_call_site_string(file, call_site->type);
+        fputc('\n', file);
+    }
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
 
 MemoryBlock* ansi_c_mem_track_copy_memory_block(const MemoryBlock* mb) {
     if (!mb) {
@@ -21,36 +1360,24 @@ MemoryBlock* ansi_c_mem_track_copy_memory_block(const MemoryBlock* mb) {
         return NULL;
     }
 
-    // Copy the data to the new MemoryBlock
-    new_mb->address = mb->address;
-    C_STRDUP(new_mb->comment, strlen(mb->comment), mb->comment);
-    C_STRDUP(new_mb->file_name, strlen(mb->file_name), mb->file_name);
-    new_mb->is_allocated = mb->is_allocated;
-    new_mb->optional_object_id = mb->optional_object_id;
-    new_mb->size = mb->size;
-    C_STRDUP(new_mb->type, strlen(mb->type), mb->type);
+    // Copy the data to the new MemoryBlock, the call site is shared
+    *new_mb = *mb;
 
     return new_mb;
 }
 
-void ansi_c_mem_track_init_memory_block(MemoryBlock* mb, void* address, size_t size, bool is_allocated, const char* file_name, const char* comment, const char* type, size_t optional_object_id) {
+void ansi_c_mem_track_init_memory_block(MemoryBlock* mb, void* address, size_t size, bool is_allocated, size_t call_site_id, size_t optional_object_id) {
     mb->address = address;
     mb->size = size;
     mb->is_allocated = is_allocated;
-    char *file_name_poi=NULL, *comment_poi=NULL, *type_poi=NULL;
-    if (file_name) {
-        C_STRDUP(file_name_poi, strlen(file_name), file_name);
-    } 
-    mb->file_name = file_name_poi;
-    if (comment) {
-        C_STRDUP(comment_poi, strlen(comment), comment);
-    }
-    mb->comment = comment_poi;
-    if (type) {
-        C_STRDUP(type_poi, strlen(type), type);
-    }
-    mb->type = type_poi;
+    mb->is_sampled = false;
+    mb->call_site_id = call_site_id;
     mb->optional_object_id = optional_object_id;
+    mb->next_slot = INVALID_INDEX;
+    mb->prev_slot = INVALID_INDEX;
+    mb->backend = MEMORY_BACKEND_SYSTEM;
+    mb->stack_id = 0;
+    mb->estimated_size = size;
 }
 
 void ansi_c_mem_track_free_memory_block(MemoryBlock* mb) {
@@ -58,70 +1385,285 @@ void ansi_c_mem_track_free_memory_block(MemoryBlock* mb) {
         return;
     }
 
-    // Free the dynamically allocated memory in the MemoryBlock
-    if (mb->comment) {
-        free((void*)mb->comment);
-    };
-    if (mb->file_name) {
-        free((void*)mb->file_name);
+    // Free the MemoryBlock itself
+    free(mb);
+}
+
+/**
+ * @brief Sets up an empty shard.
+ *
+ * @return true if successful, false if an allocation failed.
+ */
+static bool shard_init(MemoryShard* shard) {
+    shard->blocks = (MemoryBlock*)malloc(DEFAULT_CAPACITY * sizeof(MemoryBlock));
+    if (!shard->blocks) {
+        return false;
+    }
+    for (size_t i = 0; i < DEFAULT_CAPACITY; ++i) {
+        ansi_c_mem_track_init_memory_block(&shard->blocks[i], NULL, 0, false, 0, 0);
+    }
+    shard->address_index = NULL;
+    shard->address_index_capacity = 0;
+    shard->address_index_count = 0;
+    shard->object_index = NULL;
+    shard->object_index_capacity = 0;
+    shard->object_index_count = 0;
+#ifndef ANSI_C_MEM_TRACK_INLINE_HEADER
+    if (!address_index_resize(shard, DEFAULT_INDEX_CAPACITY)) {
+        free(shard->blocks);
+        shard->blocks = NULL;
+        return false;
     }
-    if (mb->type) {
-        free((void*)mb->type);
+#endif
+    if (!object_index_resize(shard, DEFAULT_OBJECT_INDEX_CAPACITY)) {
+        free(shard->address_index);
+        shard->address_index = NULL;
+        free(shard->blocks);
+        shard->blocks = NULL;
+        return false;
     }
+    shard->capacity = DEFAULT_CAPACITY;
+    shard->used = 0;
+    shard->free_slot = INVALID_INDEX;
+    shard->next = NULL;
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    shard->remote_frees = NULL;
+    shard->orphaned = 0;
+#endif
+    MUTEX_INIT(&shard->lock);
+    return true;
+}
 
-    // Free the MemoryBlock itself
-    free(mb);
+/**
+ * @brief Frees the tables of a shard. The memory blocks still tracked by it are not freed.
+ */
+static void shard_cleanup(MemoryShard* shard) {
+    free(shard->blocks);
+    shard->blocks = NULL;
+    free(shard->address_index);
+    shard->address_index = NULL;
+    shard->address_index_capacity = 0;
+    shard->address_index_count = 0;
+    free(shard->object_index);
+    shard->object_index = NULL;
+    shard->object_index_capacity = 0;
+    shard->object_index_count = 0;
+    shard->capacity = 0;
+    shard->used = 0;
+    shard->free_slot = INVALID_INDEX;
+    MUTEX_DESTROY(&shard->lock);
 }
 
-bool ansi_c_mem_track_init(void) {
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+
+/**
+ * @brief Called when a thread that has a thread state exits. The counters of the state stay part of the totals,
+ * and the state, with its shard in the thread cache build, is adopted by the next thread that needs one.
+ */
+static THREAD_KEY_DESTRUCTOR(thread_state_release, state) {
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    ATOMIC_STORE(&((ThreadState*)state)->shard->orphaned, 1);
+#endif
+    ATOMIC_STORE(&((ThreadState*)state)->orphaned, 1);
+}
+
+/**
+ * @brief Gives the calling thread a thread state, adopting the state of an exited thread if there is one.
+ *
+ * @return The state, or NULL if the tracker is not initialized or a new state could not be created.
+ */
+static ThreadState* thread_state_acquire(void) {
+    ThreadState* state = NULL;
+    MUTEX_LOCK(&init_lock);
     if (g_mem_info.is_initialized) {
-        return true;
+        for (state = thread_states; state; state = state->next) {
+            if (ATOMIC_LOAD(&state->orphaned)) {
+                ATOMIC_STORE(&state->orphaned, 0);
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+                ATOMIC_STORE(&state->shard->orphaned, 0);
+#endif
+                break;
+            }
+        }
+        if (!state) {
+            state = (ThreadState*)calloc(1, sizeof(ThreadState));
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+            size_t index = g_mem_info.shard_count;
+            MemoryShard** page = index < SHARD_LIMIT ? &shard_pages[index / SHARD_PAGE_SIZE] : NULL;
+            if (page && !*page) {
+                *page = (MemoryShard*)calloc(SHARD_PAGE_SIZE, sizeof(MemoryShard));
+            }
+            MemoryShard* shard = state && page && *page ? shard_at(index) : NULL;
+            if (shard && shard_init(shard)) {
+                shard->index = index;
+                shard->next = g_mem_info.shards;
+                ATOMIC_STORE_PTR(&g_mem_info.shards, shard);
+                ATOMIC_STORE(&g_mem_info.shard_count, index + 1);
+                state->shard = shard;
+            }
+            else {
+                free(state);
+                state = NULL;
+            }
+#endif
+            if (state) {
+                state->next = thread_states;
+                ATOMIC_STORE_PTR(&thread_states, state);
+            }
+        }
+        if (state) {
+            THREAD_KEY_SET(thread_state_key, state);
+            thread_state = state;
+            thread_state_generation = generation;
+        }
+    }
+    MUTEX_UNLOCK(&init_lock);
+    return state;
+}
+
+/**
+ * @brief Returns the thread state of the calling thread, creating it if the thread has none yet.
+ */
+static ThreadState* thread_state_get(void) {
+    if (thread_state && thread_state_generation == ATOMIC_LOAD(&generation)) {
+        return thread_state;
     }
+    return thread_state_acquire();
+}
+
+#endif // ANSI_C_MEM_TRACK_THREAD_SAFE
 
-    g_mem_info.blocks = (MemoryBlock*)malloc(DEFAULT_CAPACITY * sizeof(MemoryBlock));
-    if (!g_mem_info.blocks) {
+/**
+ * @brief Initializes the memory tracker. The caller must hold the init lock.
+ *
+ * In the thread cache build the shards are created by the threads when they allocate their first memory block.
+ */
+static bool init_locked(void) {
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    if (!THREAD_KEY_CREATE(&thread_state_key, thread_state_release)) {
         return false;
     }
-    for (size_t i = 0; i < DEFAULT_CAPACITY; ++i) {
-        ansi_c_mem_track_init_memory_block(&g_mem_info.blocks[i], NULL, 0, false, NULL, NULL, NULL, 0);
+#endif
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    g_mem_info.shards = NULL;
+    g_mem_info.shard_count = 0;
+    if (!call_sites_init()) {
+        THREAD_KEY_DELETE(thread_state_key);
+        return false;
+    }
+#else
+    g_mem_info.shards = (MemoryShard*)calloc(ANSI_C_MEM_TRACK_SHARD_COUNT, sizeof(MemoryShard));
+    size_t count = 0;
+    while (g_mem_info.shards && count < ANSI_C_MEM_TRACK_SHARD_COUNT && shard_init(&g_mem_info.shards[count])) {
+        count++;
+    }
+    if (count < ANSI_C_MEM_TRACK_SHARD_COUNT || !call_sites_init()) {
+        while (count > 0) {
+            shard_cleanup(&g_mem_info.shards[--count]);
+        }
+        free(g_mem_info.shards);
+        g_mem_info.shards = NULL;
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+        THREAD_KEY_DELETE(thread_state_key);
+#endif
+        return false;
+    }
+    for (count = 1; count < ANSI_C_MEM_TRACK_SHARD_COUNT; ++count) {
+        g_mem_info.shards[count - 1].next = &g_mem_info.shards[count];
     }
-    g_mem_info.capacity = DEFAULT_CAPACITY;
+    g_mem_info.shard_count = ANSI_C_MEM_TRACK_SHARD_COUNT;
+#endif
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    thread_states = NULL;
+    published_size = 0;
+    published_memory_usage = 0;
+    ATOMIC_STORE(&generation, generation + 1);
+#endif
+    for (size_t i = 0; i < OBJECT_TOTALS_STRIPE_COUNT; ++i) {
+        MUTEX_INIT(&object_totals[i].lock);
+    }
+    g_mem_info.peak_size = 0;
+    g_mem_info.peak_memory_usage = 0;
+    memset(size_histogram, 0, sizeof(size_histogram));
     g_mem_info.total_size = 0;
     g_mem_info.size = 0;
     g_mem_info.total_memory_usage = 0;
     g_mem_info.memory_usage = 0;
     g_mem_info.total_freed_memory = 0;
-    g_mem_info.is_initialized = true;
     g_mem_info.get_unfreed_blocks_info_ptr = NULL;
     g_mem_info.get_unfreed_blocks_info_size = 0;
+    ATOMIC_STORE_BOOL(&g_mem_info.is_initialized, true);
     return true;
 }
 
+bool ansi_c_mem_track_init(void) {
+    if (ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized)) {
+        return true;
+    }
+
+    // Threads calling the tracker for the first time at once must not initialize it twice
+    MUTEX_LOCK(&init_lock);
+    bool initialized = g_mem_info.is_initialized || init_locked();
+    MUTEX_UNLOCK(&init_lock);
+    return initialized;
+}
+
 /**
  * @brief Cleans up the memory allocated by the MemoryInfo struct.
  *
- * This function frees the dynamically allocated array of MemoryBlock structs and resets the MemoryInfo struct's
+ * This function frees the shards with their arrays of MemoryBlock structs and resets the MemoryInfo struct's
  * values to their default state.
  *
  * @param mem_info A pointer to the MemoryInfo struct.
  */
 static void cleanup_memory(MemoryInfo* mem_info) {
-    if (mem_info->blocks) {
-        for (size_t i=0; i < mem_info->size; ++i) {
-            if (mem_info->blocks[i].is_allocated) {
-                ansi_c_mem_track_free_memory_block(&mem_info->blocks[i]);
-            }
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    // Exiting threads must not touch the thread states once they are freed
+    THREAD_KEY_DELETE(thread_state_key);
+    while (thread_states) {
+        ThreadState* next = thread_states->next;
+        free(thread_states);
+        thread_states = next;
+    }
+#endif
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    for (size_t i = 0; i < mem_info->shard_count; ++i) {
+        shard_cleanup(shard_at(i));
+    }
+    mem_info->shards = NULL;
+    for (size_t i = 0; i < SHARD_PAGE_COUNT; ++i) {
+        free(shard_pages[i]);
+        shard_pages[i] = NULL;
+    }
+#else
+    if (mem_info->shards) {
+        for (size_t i = 0; i < mem_info->shard_count; ++i) {
+            shard_cleanup(&mem_info->shards[i]);
+        }
+        free(mem_info->shards);
+        mem_info->shards = NULL;
+    }
+#endif
+    mem_info->shard_count = 0;
+    call_sites_cleanup();
+    for (size_t i = 0; i < OBJECT_TOTALS_STRIPE_COUNT; ++i) {
+        for (size_t j = 0; j < object_totals[i].capacity; ++j) {
+            free(object_totals[i].entries[j]);
         }
-        free(mem_info->blocks);
-        mem_info->blocks = NULL;
+        free(object_totals[i].entries);
+        object_totals[i].entries = NULL;
+        object_totals[i].capacity = 0;
+        object_totals[i].count = 0;
+        MUTEX_DESTROY(&object_totals[i].lock);
     }
 
-    mem_info->capacity = 0;
     mem_info->total_size = 0;
     mem_info->size = 0;
     mem_info->total_memory_usage = 0;
     mem_info->memory_usage = 0;
     mem_info->total_freed_memory = 0;
+    mem_info->peak_size = 0;
+    mem_info->peak_memory_usage = 0;
 }
 
 void ansi_c_mem_track_free_unfreed_blocks_info() {
@@ -142,112 +1684,488 @@ void ansi_c_mem_track_free_unfreed_blocks_info() {
 
 
 void ansi_c_mem_track_deinit(void) {
-    if (!g_mem_info.is_initialized || !g_mem_info.blocks) {
+    MUTEX_LOCK(&init_lock);
+    if (g_mem_info.is_initialized) {
+        ansi_c_mem_track_free_unfreed_blocks_info();
+        cleanup_memory(&g_mem_info);
+        ATOMIC_STORE_BOOL(&g_mem_info.is_initialized, false);
+    }
+    ansi_c_mem_track_stop_trace();
+    // The pending log records are written and the log files closed
+    ansi_c_mem_track_log_close();
+    MUTEX_UNLOCK(&init_lock);
+}
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+/**
+ * @brief Returns true if a change that wraps below zero when negative is at least `slack` in either direction.
+ */
+static bool peak_slack_exceeded(size_t change, size_t slack) {
+    return change + (slack - 1) > 2 * (slack - 1);
+}
+
+/**
+ * @brief Adds the changes of a thread to the published sums and raises the global peaks to them.
+ */
+static void peak_publish(size_t size_change, size_t memory_usage_change) {
+    size_t size = ATOMIC_FETCH_ADD(&published_size, size_change) + size_change;
+    size_t memory_usage = ATOMIC_FETCH_ADD(&published_memory_usage, memory_usage_change) + memory_usage_change;
+    // The sums wrap below zero while a free is published before the allocation it belongs to
+    if (size <= (size_t)PTRDIFF_MAX) {
+        peak_raise(&g_mem_info.peak_size, size);
+    }
+    if (memory_usage <= (size_t)PTRDIFF_MAX) {
+        peak_raise(&g_mem_info.peak_memory_usage, memory_usage);
+    }
+}
+#endif
+
+/**
+ * @brief Updates the usage counters and the global peaks.
+ *
+ * In the thread-safe build the counters of the calling thread are updated, which no other thread writes, so the
+ * hot path needs no atomic read-modify-write and shares no cache line with other threads. The changes are
+ * published for the global peaks only once they reach ANSI_C_MEM_TRACK_PEAK_SLACK, so the peaks stay cheap too.
+ *
+ * @param allocations The number of new memory blocks.
+ * @param frees The number of freed memory blocks.
+ * @param allocated The number of bytes allocated.
+ * @param freed The number of bytes freed.
+ */
+static void counters_update(size_t allocations, size_t frees, size_t allocated, size_t freed) {
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    ThreadState* state = thread_state_get();
+    if (state) {
+        SINGLE_WRITER_ADD(&state->total_size, allocations);
+        SINGLE_WRITER_ADD(&state->size, allocations - frees);
+        SINGLE_WRITER_ADD(&state->total_memory_usage, allocated);
+        SINGLE_WRITER_ADD(&state->memory_usage, allocated - freed);
+        SINGLE_WRITER_ADD(&state->total_freed_memory, freed);
+        state->unpublished_size += allocations - frees;
+        state->unpublished_memory_usage += allocated - freed;
+        if (peak_slack_exceeded(state->unpublished_memory_usage, ANSI_C_MEM_TRACK_PEAK_SLACK)
+            || peak_slack_exceeded(state->unpublished_size, PEAK_SLACK_BLOCKS)) {
+            peak_publish(state->unpublished_size, state->unpublished_memory_usage);
+            state->unpublished_size = 0;
+            state->unpublished_memory_usage = 0;
+        }
         return;
     }
-    ansi_c_mem_track_free_unfreed_blocks_info();
-    for (size_t i = 0; i < g_mem_info.size; i++) {
-        if (g_mem_info.blocks[i].is_allocated) {
-            ansi_c_mem_track_free_memory_block(&g_mem_info.blocks[i]);
+#endif
+    // Without a thread state the shared counters are used
+    ATOMIC_ADD(&g_mem_info.total_size, allocations);
+    size_t size = ATOMIC_FETCH_ADD(&g_mem_info.size, allocations - frees) + allocations - frees;
+    ATOMIC_ADD(&g_mem_info.total_memory_usage, allocated);
+    size_t memory_usage = ATOMIC_FETCH_ADD(&g_mem_info.memory_usage, allocated - freed) + allocated - freed;
+    ATOMIC_ADD(&g_mem_info.total_freed_memory, freed);
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    // The shared counters are only a share of the totals, like the counters of a thread
+    (void)size;
+    (void)memory_usage;
+    peak_publish(allocations - frees, allocated - freed);
+#else
+    peak_raise(&g_mem_info.peak_size, size);
+    peak_raise(&g_mem_info.peak_memory_usage, memory_usage);
+#endif
+}
+
+/**
+ * @brief Fixes the estimate of a block that is about to be tracked, from its size and the current interval.
+ */
+static void block_estimate(MemoryBlock* block) {
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    block->estimated_size = block->is_sampled ? ansi_c_mem_track_sample_estimate(block->size) : block->size;
+#else
+    block->estimated_size = block->size;
+#endif
+}
+
+/**
+ * @brief Returns the number of blocks a tracked block stands for, 1 unless it was sampled.
+ */
+static size_t block_estimated_count(const MemoryBlock* block) {
+    if (!block->is_sampled || block->size == 0) {
+        return 1;
+    }
+    size_t count = (block->estimated_size + block->size / 2) / block->size;
+    return count ? count : 1;
+}
+
+/**
+ * @brief Updates the usage of the call site of a tracked memory block and raises its peaks. A sampled block counts
+ * with its estimates. The totals of the object ID are updated by the object index.
+ *
+ * @param is_allocated true for a new block, false for a freed block.
+ */
+static void usage_update(const MemoryBlock* block, bool is_allocated) {
+    CallSiteUsage* usage = call_site_usage_at(block->call_site_id);
+    size_t blocks = block_estimated_count(block);
+    size_t bytes = ansi_c_mem_track_get_estimated_size(block);
+    if (!is_allocated) {
+        ATOMIC_ADD(&usage->size, (size_t)0 - blocks);
+        ATOMIC_ADD(&usage->memory_usage, (size_t)0 - bytes);
+        return;
+    }
+    peak_raise(&usage->peak_size, ATOMIC_FETCH_ADD(&usage->size, blocks) + blocks);
+    peak_raise(&usage->peak_memory_usage, ATOMIC_FETCH_ADD(&usage->memory_usage, bytes) + bytes);
+}
+
+/**
+ * @brief Returns the bucket of a SizeHistogram that counts a size.
+ */
+static size_t size_histogram_bucket(size_t size) {
+    if (size < SIZE_HISTOGRAM_SUB_BUCKETS) {
+        return size;
+    }
+    // The highest bit selects the power of two, the bits below it the sub-bucket
+    unsigned int exponent = HIGHEST_BIT(size);
+    return (size_t)(exponent - SIZE_HISTOGRAM_SUB_BUCKET_BITS + 1) * SIZE_HISTOGRAM_SUB_BUCKETS
+        + (size >> (exponent - SIZE_HISTOGRAM_SUB_BUCKET_BITS)) - SIZE_HISTOGRAM_SUB_BUCKETS;
+}
+
+/**
+ * @brief Counts a requested size in the size histogram and in the histogram of a call site.
+ *
+ * @param usage The usage of the call site of a tracked block, NULL for a block that was not sampled.
+ */
+static void size_histogram_record(size_t size, CallSiteUsage* usage) {
+    size_t bucket = size_histogram_bucket(size);
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    ThreadState* state = thread_state_get();
+    if (state) {
+        SINGLE_WRITER_ADD(&state->size_histogram[bucket], 1);
+    }
+    else {
+        ATOMIC_ADD(&size_histogram[bucket], 1);
+    }
+#else
+    size_histogram[bucket]++;
+#endif
+    if (usage) {
+        ATOMIC_ADD(&usage->size_histogram[bucket], 1);
+    }
+}
+
+/**
+ * @brief Adds a memory block to a shard. The caller must hold the lock of the shard.
+ *
+ * @return The slot of the block, or INVALID_INDEX if the tables of the shard could not grow.
+ */
+static size_t shard_track(MemoryShard* shard, const MemoryBlock* block) {
+    if (shard->free_slot == INVALID_INDEX && shard->capacity == shard->used) {
+        // Grow geometrically, so that filling the table costs amortized O(1) per allocation
+        size_t new_capacity = shard->capacity < DEFAULT_CAPACITY ? DEFAULT_CAPACITY : shard->capacity * 2;
+        MemoryBlock* new_blocks = (MemoryBlock*)realloc(shard->blocks, sizeof(MemoryBlock) * new_capacity);
+        if (!new_blocks) {
+            return INVALID_INDEX;
         }
+        shard->blocks = new_blocks;
+        shard->capacity = new_capacity;
+    }
+    if (!block_index_reserve(shard) || !object_index_reserve(shard)) {
+        return INVALID_INDEX;
     }
-    cleanup_memory(&g_mem_info);
-    g_mem_info.is_initialized = false;
+
+    // Reuse a freed slot if there is one, otherwise take the next unused slot
+    size_t index = shard->free_slot;
+    if (index != INVALID_INDEX) {
+        shard->free_slot = shard->blocks[index].next_slot;
+    }
+    else {
+        index = shard->used++;
+    }
+    shard->blocks[index] = *block;
+    shard->blocks[index].next_slot = INVALID_INDEX;
+    shard->blocks[index].prev_slot = INVALID_INDEX;
+    block_index_insert(shard, index);
+    object_index_link(shard, index);
+    usage_update(block, true);
+    return index;
 }
 
-void* ansi_c_mem_track_malloc(size_t size, const char* file_name, const char* comment, const char* type, size_t optional_object_id) {
-    if (!g_mem_info.is_initialized) {
-        ansi_c_mem_track_init();
+/**
+ * @brief Removes the memory block in the given slot from its shard and releases the slot. The caller must hold
+ * the lock of the shard, and is responsible for freeing the memory and for the global counters.
+ *
+ * @return The address returned by the system allocator for the block.
+ */
+static void* shard_untrack(MemoryShard* shard, size_t index) {
+    void* raw = raw_address(shard->blocks[index].address);
+    usage_update(&shard->blocks[index], false);
+    object_index_unlink(shard, index);
+    block_index_remove(shard, index);
+    shard->blocks[index].is_allocated = false;
+    shard->blocks[index].address = NULL;
+    shard->blocks[index].size = 0;
+    shard->blocks[index].call_site_id = 0;
+    shard->blocks[index].next_slot = shard->free_slot;
+    shard->free_slot = index;
+    return raw;
+}
+
+/**
+ * @brief Locks a shard. In the thread cache build the blocks that other threads freed meanwhile are released
+ * first, so the shard is up to date when the caller uses it.
+ */
+static void shard_lock(MemoryShard* shard) {
+    MUTEX_LOCK(&shard->lock);
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    if (ATOMIC_LOAD_PTR(&shard->remote_frees)) {
+        MemoryBlockHeader* header = (MemoryBlockHeader*)ATOMIC_EXCHANGE_PTR(&shard->remote_frees, NULL);
+        while (header) {
+            MemoryBlockHeader* next = (MemoryBlockHeader*)header->info.next_remote;
+            size_t slot = header->info.slot;
+            if (slot < shard->used && shard->blocks[slot].is_allocated && shard->blocks[slot].address == header + 1) {
+                MemoryBlock block = shard->blocks[slot];
+                TRACE_EVENT(TRACE_OP_FREE, block.address, NULL, block.size, block.call_site_id, block.optional_object_id);
+                backend_free(shard_untrack(shard, slot), &block);
+            }
+            header = next;
+        }
     }
+#endif
+}
 
-    if (size == 0) {
+static void shard_unlock(MemoryShard* shard) {
+    MUTEX_UNLOCK(&shard->lock);
+}
+
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+/**
+ * @brief Frees a block that belongs to the shard of another thread without taking the lock of that shard.
+ *
+ * The block is pushed on the remote-free stack of the shard, and is released by the next thread that locks it,
+ * normally the owner on its next allocation. The counters are updated immediately, the free is traced when the
+ * block is released, with the call site and the object ID of its tracked copy.
+ */
+static void shard_remote_free(MemoryShard* shard, void* address) {
+    MemoryBlockHeader* header = header_of(address);
+    size_t size = header->info.size;
+    header->info.magic = 0;
+    void* head;
+    do {
+        head = ATOMIC_LOAD_PTR(&shard->remote_frees);
+        header->info.next_remote = head;
+    } while (!ATOMIC_CAS_PTR(&shard->remote_frees, head, header));
+    counters_update(0, 1, 0, size);
+}
+#endif
+
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+/**
+ * @brief Allocates a block that was not sampled. It is only counted, and its header holds its size.
+ */
+static void* unsampled_malloc(size_t size) {
+    MemoryBackend backend;
+    void* raw = backend_alloc(size + BLOCK_HEADER_SIZE, 0, &backend);
+    if (!raw) {
         return NULL;
     }
+    void* address = (char*)raw + BLOCK_HEADER_SIZE;
+    unsampled_header_set(address, size, backend);
+    counters_update(1, 0, size, 0);
+    size_histogram_record(size, NULL);
+    TRACE_EVENT(TRACE_OP_MALLOC, address, NULL, size, 0, 0);
+    return address;
+}
 
-    if (g_mem_info.capacity == g_mem_info.size) {
-        MemoryBlock* new_blocks = (MemoryBlock*)realloc(g_mem_info.blocks, sizeof(MemoryBlock) * (g_mem_info.capacity + DEFAULT_CAPACITY));
-        if (!new_blocks) {
-            return NULL;
+/**
+ * @brief Frees a block that was not sampled.
+ */
+static void unsampled_free(void* address, size_t size, MemoryBackend backend) {
+    MemoryBlock block = { address, size, 0, true, false, 0, INVALID_INDEX, INVALID_INDEX, backend, 0, 0 };
+    header_of(address)->info.magic = 0;
+    TRACE_EVENT(TRACE_OP_FREE, address, NULL, size, 0, 0);
+    backend_free(raw_address(address), &block);
+    // A block may outlive the tracker, then only its memory is released
+    if (ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized)) {
+        counters_update(0, 1, 0, size);
+    }
+}
+
+/**
+ * @brief Resizes a block that was not sampled. The bytes it grows by count towards the next sample like a new
+ * allocation, and if they are sampled the block is tracked from then on, without a call site.
+ */
+static void* unsampled_realloc(void* address, size_t old_size, MemoryBackend old_backend, size_t size) {
+    MemoryBlock block = { address, old_size, 0, true, false, 0, INVALID_INDEX, INVALID_INDEX, old_backend, 0, 0 };
+    MemoryBackend backend;
+    void* raw = backend_realloc(raw_address(address), &block, size + BLOCK_HEADER_SIZE, &backend);
+    if (!raw) {
+        return NULL;
+    }
+    void* new_address = (char*)raw + BLOCK_HEADER_SIZE;
+    TRACE_EVENT(TRACE_OP_REALLOC, new_address, address, size, 0, 0);
+    size_histogram_record(size, NULL);
+    if (size > old_size) {
+        counters_update(0, 0, size - old_size, 0);
+    }
+    else {
+        counters_update(0, 0, 0, old_size - size);
+    }
+
+    if (size > old_size && ansi_c_mem_track_sample_take(size - old_size)) {
+        MemoryBlock tracked = {
+            new_address, size, 0, true, true, 0, INVALID_INDEX, INVALID_INDEX, backend, STACK_CAPTURE(), 0
+        };
+        block_estimate(&tracked);
+        MemoryShard* shard = shard_select(new_address);
+        size_t index = INVALID_INDEX;
+        if (shard) {
+            shard_lock(shard);
+            index = shard_track(shard, &tracked);
+            shard_unlock(shard);
+        }
+        if (index != INVALID_INDEX) {
+            // The block enters the usage of call site 0 like a new allocation
+            CallSiteUsage* usage = call_site_usage_at(0);
+            ATOMIC_ADD(&usage->total_size, block_estimated_count(&tracked));
+            ATOMIC_ADD(&usage->total_memory_usage, tracked.estimated_size);
+            return new_address;
         }
-        g_mem_info.blocks = new_blocks;
-        g_mem_info.capacity += DEFAULT_CAPACITY;
     }
+    unsampled_header_set(new_address, size, backend);
+    return new_address;
+}
+#endif // ANSI_C_MEM_TRACK_SAMPLING
 
-    void* address = malloc(size);
-    if (!address) {
+/**
+ * @brief Allocates and tracks a memory block, the call site is given either by its contents or by a descriptor.
+ */
+static void* malloc_tracked(size_t size, const char* file_name, const char* comment, const char* type,
+    CallSiteDescriptor* descriptor, size_t optional_object_id) {
+    if (!ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized) && !ansi_c_mem_track_init()) {
         return NULL;
     }
 
-    char *file_name_poi = NULL, *comment_poi=NULL, *type_poi=NULL;
-    if (file_name) {
-        C_STRDUP(file_name_poi, strlen(file_name), file_name);
+    if (size == 0 || size > (size_t)-1 - BLOCK_HEADER_SIZE) {
+        return NULL;
     }
-    if (comment) {
-        C_STRDUP(comment_poi, strlen(comment), comment);
+
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    // The blocks of an object ID are always tracked, ansi_c_mem_track_free_by_object_id has to find all of them
+    if (optional_object_id == 0 && !ansi_c_mem_track_sample_take(size)) {
+        return unsampled_malloc(size);
     }
-    if (type) {
-        C_STRDUP(type_poi, strlen(type), type);
+    bool is_sampled = optional_object_id == 0 && ansi_c_mem_track_sample_get_interval() != 0;
+#else
+    bool is_sampled = false;
+#endif
+
+    // The system allocator is called outside of the shard lock, the new address selects the shard
+    MemoryBackend backend;
+    void* raw = backend_alloc(size + BLOCK_HEADER_SIZE, optional_object_id, &backend);
+    if (!raw) {
+        return NULL;
     }
+    void* address = (char*)raw + BLOCK_HEADER_SIZE;
+
+    size_t call_site_id = descriptor ? call_site_intern_descriptor(descriptor) : call_site_intern(file_name, comment, type, 0);
     MemoryBlock block = { 
-        address, size, file_name_poi, comment_poi, type_poi, true, optional_object_id
+        address, size, call_site_id, true, is_sampled, optional_object_id, INVALID_INDEX, INVALID_INDEX, backend,
+        STACK_CAPTURE(), 0
     };
-    g_mem_info.blocks[g_mem_info.size] = block;
-    g_mem_info.total_size++;
-    g_mem_info.size++;
-    g_mem_info.memory_usage += size;
-    g_mem_info.total_memory_usage += size;
+    block_estimate(&block);
+
+    MemoryShard* shard = shard_select(address);
+    size_t index = INVALID_INDEX;
+    if (shard) {
+        shard_lock(shard);
+        index = shard_track(shard, &block);
+        shard_unlock(shard);
+    }
+    if (index == INVALID_INDEX) {
+        backend_free(raw, &block);
+        return NULL;
+    }
+    counters_update(1, 0, size, 0);
+    CallSiteUsage* usage = call_site_usage_at(call_site_id);
+    ATOMIC_ADD(&usage->total_size, block_estimated_count(&block));
+    ATOMIC_ADD(&usage->total_memory_usage, block.estimated_size);
+    size_histogram_record(size, usage);
+    TRACE_EVENT(TRACE_OP_MALLOC, address, NULL, size, block.call_site_id, optional_object_id);
 
     return address;
 }
 
+void* ansi_c_mem_track_malloc(size_t size, const char* file_name, const char* comment, const char* type, size_t optional_object_id) {
+    return malloc_tracked(size, file_name, comment, type, NULL, optional_object_id);
+}
+
+void* ansi_c_mem_track_malloc_at(size_t size, CallSiteDescriptor* call_site, size_t optional_object_id) {
+    return malloc_tracked(size, NULL, NULL, NULL, call_site, optional_object_id);
+}
+
 MemoryUsageInfo ansi_c_mem_track_get_info(void) {
     MemoryUsageInfo info = {
-        .size = g_mem_info.size,
-        .total_size = g_mem_info.total_size,
-        .total_user_memory_usage = g_mem_info.total_memory_usage,
-        .memory_usage = g_mem_info.memory_usage,
-        .total_freed_memory = g_mem_info.total_freed_memory
+        .size = ATOMIC_LOAD(&g_mem_info.size),
+        .total_size = ATOMIC_LOAD(&g_mem_info.total_size),
+        .total_user_memory_usage = ATOMIC_LOAD(&g_mem_info.total_memory_usage),
+        .memory_usage = ATOMIC_LOAD(&g_mem_info.memory_usage),
+        .total_freed_memory = ATOMIC_LOAD(&g_mem_info.total_freed_memory)
     };
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    // The counters are summed with wrap-around arithmetic, the shares of single threads may be "negative"
+    for (const ThreadState* state = ATOMIC_LOAD_PTR(&thread_states); state; state = state->next) {
+        info.size += ATOMIC_LOAD(&state->size);
+        info.total_size += ATOMIC_LOAD(&state->total_size);
+        info.total_user_memory_usage += ATOMIC_LOAD(&state->total_memory_usage);
+        info.memory_usage += ATOMIC_LOAD(&state->memory_usage);
+        info.total_freed_memory += ATOMIC_LOAD(&state->total_freed_memory);
+    }
+
+    // The threads are read one after the other, so a free may be seen without the allocation it belongs to
+    if (info.size > info.total_size) {
+        info.size = 0;
+    }
+    if (info.memory_usage > info.total_user_memory_usage) {
+        info.memory_usage = 0;
+    }
+#endif
+    // The exact sums also count as a point of the peaks, the published changes of the threads may lag behind them
+    peak_raise(&g_mem_info.peak_size, info.size);
+    peak_raise(&g_mem_info.peak_memory_usage, info.memory_usage);
+    info.peak_size = ATOMIC_LOAD(&g_mem_info.peak_size);
+    info.peak_memory_usage = ATOMIC_LOAD(&g_mem_info.peak_memory_usage);
+#ifdef ANSI_C_MEM_TRACK_SLAB
+    SlabInfo slab_info = ansi_c_mem_track_slab_get_info();
+    info.slab_count = slab_info.slab_count;
+    info.partial_slab_count = slab_info.partial_slab_count;
+    info.slab_memory = slab_info.slab_memory;
+    info.slab_free_memory = slab_info.slab_free_memory;
+#endif
+    info.dropped_log_records = ansi_c_mem_track_log_dropped();
     return info;
 }
 
 bool ansi_c_mem_track_log_message(const char* file_name, const char* message_type, const char* message_text) {
-    FILE* output_file;
-    time_t raw_time;
-    struct tm time_info;
-    char timestamp[20];
-    char* message;
-
-    // Get the current time
-    time(&raw_time);
-    localtime_func(&raw_time, &time_info);
-
-    // Format the timestamp
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &time_info);
-
-    // Format the message
-    size_t message_size = snprintf(NULL, 0, "%s [%s] %s\n", timestamp, message_type, message_text);
-    message = (char*)malloc(message_size + 1);
-    if (!message) {
-        return false;
+    return ansi_c_mem_track_log_write(file_name, "[%s] %s\n", message_type, message_text);
+}
+
+/**
+ * @brief Formats the nonempty buckets of a size histogram, one line each.
+ *
+ * @return The text, which the caller must free, or NULL if the allocation failed.
+ */
+static char* size_histogram_format(const SizeHistogram* histogram) {
+    size_t line_size = 128;
+    char* text = (char*)malloc(SIZE_HISTOGRAM_BUCKET_COUNT * line_size + 1);
+    if (!text) {
+        return NULL;
     }
-    snprintf(message, message_size + 1, "%s [%s] %s\n", timestamp, message_type, message_text);
-
-    // Write the message to the file or to the standard output
-    if (file_name) {
-        if (FOPEN(&output_file, file_name, "a") != 0) {
-            free(message);
-            return false;
+    size_t length = 0;
+    text[0] = '\0';
+    for (size_t bucket = 0; bucket < SIZE_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        if (histogram->counts[bucket] == 0) {
+            continue;
         }
-        fprintf(output_file, "%s", message);
-        fclose(output_file);
+        size_t max = bucket + 1 < SIZE_HISTOGRAM_BUCKET_COUNT
+            ? ansi_c_mem_track_size_histogram_bucket_min(bucket + 1) - 1 : (size_t)-1;
+        length += (size_t)snprintf(text + length, line_size, "                             %llu-%llu bytes: %lu\n",
+            (unsigned long long)ansi_c_mem_track_size_histogram_bucket_min(bucket), (unsigned long long)max,
+            (unsigned long)histogram->counts[bucket]);
     }
-    else {
-        printf("%s", message);
-    }
-
-    free(message);
-    return true;
+    return text;
 }
 
 /**
@@ -263,86 +2181,48 @@ bool ansi_c_mem_track_log_message(const char* file_name, const char* message_typ
  * @return true if the information was successfully printed, false otherwise.
  */
 bool ansi_c_mem_track_print_info(const char* file_name, const MemoryUsageInfo* mem_info) {
-    FILE* output_file;
-
-    // Get the current time
-    time_t raw_time;
-    struct tm time_info;
-    time(&raw_time);
-    localtime_func(&raw_time, &time_info);
-
-    // Format the timestamp
-    char timestamp[20];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &time_info);
-
-    // Get the required size of the message buffer
-    const char* formatstr= "%s [MEMORY] Memory usage information:\n"
+    SizeHistogram histogram;
+    ansi_c_mem_track_get_size_histogram(&histogram);
+    char* sizes = size_histogram_format(&histogram);
+    bool result = ansi_c_mem_track_log_write(file_name, "[MEMORY] Memory usage information:\n"
         "                             Current memory usage: %lu bytes\n"
         "                             Current allocations: %lu\n"
+        "                             Peak memory usage: %lu bytes\n"
+        "                             Peak allocations: %lu\n"
         "                             Total memory usage: %lu bytes\n"
         "                             Total allocations: %lu\n"
-        "                             Total freed memory: %lu bytes\n";
-    size_t message_size = snprintf(NULL, 0, formatstr,
-        timestamp, (unsigned long)mem_info->memory_usage, (unsigned long)mem_info->size,(unsigned long)mem_info->total_user_memory_usage, 
-        (unsigned long)mem_info->total_size, (unsigned long)mem_info->total_freed_memory);
-
-    // Allocate the message buffer
-    char* message = (char*)malloc(message_size + 1);
-    if (!message) {
-        return false;
-    }
-
-    // Format the message
-    snprintf(message, message_size + 1, formatstr,
-        timestamp, (unsigned long)mem_info->memory_usage, (unsigned long)mem_info->size, (unsigned long)mem_info->total_user_memory_usage,
-        (unsigned long)mem_info->total_size, (unsigned long)mem_info->total_freed_memory);
-
-    // Write the message to the file or to the standard output
-    if (file_name) {
-        if (FOPEN(&output_file, file_name, "a") != 0) {
-            return false;
-        }
-        fprintf(output_file, "%s", message);
-        fclose(output_file);
-    }
-    else {
-        printf("%s", message);
-    }
-
-    if (message) {
-        free(message);
-    }
-    return true;
+        "                             Total freed memory: %lu bytes\n"
+        "                             Allocation sizes:\n%s",
+        (unsigned long)mem_info->memory_usage, (unsigned long)mem_info->size, (unsigned long)mem_info->peak_memory_usage,
+        (unsigned long)mem_info->peak_size, (unsigned long)mem_info->total_user_memory_usage,
+        (unsigned long)mem_info->total_size, (unsigned long)mem_info->total_freed_memory, sizes ? sizes : "");
+    free(sizes);
+    return result;
 }
 
-void ansi_c_mem_track_free_block(size_t index) {
-    if (g_mem_info.blocks[index].is_allocated) {
-        g_mem_info.memory_usage -= g_mem_info.blocks[index].size;
-        g_mem_info.total_freed_memory += g_mem_info.blocks[index].size;
-        g_mem_info.blocks[index].is_allocated = false;
-        free(g_mem_info.blocks[index].address);
-        g_mem_info.blocks[index].address = NULL;
-        g_mem_info.blocks[index].size = 0;
-        if (g_mem_info.blocks[index].file_name) {
-            free((void*)g_mem_info.blocks[index].file_name);
-            g_mem_info.blocks[index].file_name = NULL;
-        }
-        if (g_mem_info.blocks[index].comment) {
-            free((void*)g_mem_info.blocks[index].comment);
-            g_mem_info.blocks[index].comment = NULL;
-        }
-        if (g_mem_info.blocks[index].type) {
-            free((void*)g_mem_info.blocks[index].type);
-            g_mem_info.blocks[index].type = NULL;
-        }
+bool ansi_c_mem_track_print_size_histogram(const char* file_name, const SizeHistogram* histogram) {
+    char* text = size_histogram_format(histogram);
+    if (!text) {
+        return false;
     }
+    bool result = ansi_c_mem_track_log_write(file_name, "[MEMORY] Allocation size histogram:\n%s", text);
+    free(text);
+    return result;
 }
 
-void cleanup_allocations_if_needed() {
-    free_calls++;
-    if (free_calls >= DEFAULT_CAPACITY) {
-        ansi_c_mem_track_cleanup_allocations();
-        free_calls = 0;
+/**
+ * @brief Frees the memory block in the given slot of a shard for `ansi_c_mem_track_free_by_object_id`. The caller
+ * must hold the lock of the shard. The memory of an arena block is left to the release of the arena.
+ */
+static void free_block(MemoryShard* shard, size_t index) {
+    if (shard->blocks[index].is_allocated) {
+        MemoryBlock block = shard->blocks[index];
+        void* raw = shard_untrack(shard, index);
+        TRACE_EVENT(TRACE_OP_FREE, block.address, NULL, block.size, block.call_site_id, block.optional_object_id);
+        if (block.backend != MEMORY_BACKEND_ARENA) {
+            backend_free(raw, &block);
+        }
+        counters_update(0, 1, 0, block.size);
     }
 }
 
@@ -351,45 +2231,79 @@ void ansi_c_mem_track_free(void* ptr) {
         return;
     }
 
-    size_t index = -1;
-    for (size_t i = 0; i < g_mem_info.size; i++) {
-        if (g_mem_info.blocks[i].address == ptr) {
-            index = i;
-            break;
-        }
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    size_t unsampled_size;
+    MemoryBackend unsampled_backend;
+    if (unsampled_header_get(ptr, &unsampled_size, &unsampled_backend)) {
+        unsampled_free(ptr, unsampled_size, unsampled_backend);
+        return;
     }
-
-    if (index == -1) {
+#endif
+    MemoryShard* shard = shard_of(ptr);
+    if (!shard) {
         free(ptr);
         return;
     }
-    
-    ansi_c_mem_track_free_block(index);
-    cleanup_allocations_if_needed();
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+    // The owner confirms the slot and the address of the block under its lock when it drains the stack
+    if (shard != shard_of_thread() && !ATOMIC_LOAD(&shard->orphaned)) {
+        shard_remote_free(shard, ptr);
+        return;
+    }
+#endif
+    shard_lock(shard);
+    size_t index = block_index_find(shard, ptr);
+    if (index == INVALID_INDEX) {
+        shard_unlock(shard);
+        free(ptr);
+        return;
+    }
+    MemoryBlock block = shard->blocks[index];
+    void* raw = shard_untrack(shard, index);
+    shard_unlock(shard);
+
+    // The event is recorded before the memory can be reused, so it precedes the allocation that reuses it
+    TRACE_EVENT(TRACE_OP_FREE, ptr, NULL, block.size, block.call_site_id, block.optional_object_id);
+    backend_free(raw, &block);
+    counters_update(0, 1, 0, block.size);
 }
 
-void ansi_c_mem_track_cleanup_allocations(void) {
-    int index = 0;
-    for (size_t i = 0; i < g_mem_info.size; i++) {
-        if (g_mem_info.blocks[i].is_allocated) {
-            g_mem_info.blocks[index] = g_mem_info.blocks[i];
+/**
+ * @brief Removes the freed slots of a shard and shrinks its blocks array. The caller must hold the lock of the shard.
+ */
+static void shard_compact(MemoryShard* shard) {
+    size_t index = 0;
+    for (size_t i = 0; i < shard->used; i++) {
+        if (shard->blocks[i].is_allocated) {
+            shard->blocks[index] = shard->blocks[i];
             index++;
         }
     }    
     
-    g_mem_info.size = index;
+    shard->used = index;
+    shard->free_slot = INVALID_INDEX;
+    block_index_rebuild(shard);
+    object_index_rebuild(shard);
     
     if (index < DEFAULT_CAPACITY) {
         index = DEFAULT_CAPACITY;
     } 
     
-    if (g_mem_info.capacity > index) {
-        MemoryBlock* new_blocks = (MemoryBlock*)realloc(g_mem_info.blocks, sizeof(MemoryBlock) * index);
+    if (shard->capacity > index) {
+        MemoryBlock* new_blocks = (MemoryBlock*)realloc(shard->blocks, sizeof(MemoryBlock) * index);
         if (!new_blocks) {
             return;
         }
-        g_mem_info.blocks = new_blocks;
-        g_mem_info.capacity = index;
+        shard->blocks = new_blocks;
+        shard->capacity = index;
+    }
+}
+
+void ansi_c_mem_track_cleanup_allocations(void) {
+    for (MemoryShard* shard = ATOMIC_LOAD_PTR(&g_mem_info.shards); shard; shard = shard->next) {
+        shard_lock(shard);
+        shard_compact(shard);
+        shard_unlock(shard);
     }
 }
 
@@ -397,37 +2311,84 @@ void* ansi_c_mem_track_realloc(void* ptr, size_t size, size_t optional_object_id
     if (!ptr) {
         return ansi_c_mem_track_malloc(size, __FILE__, "ansi_c_mem_track_realloc()", "Allocation with malloc because prt=NULL", optional_object_id);
     }
-
-    size_t index = -1;
-    for (size_t i = 0; i < g_mem_info.size; i++) {
-        if (g_mem_info.blocks[i].address == ptr) {
-            index = i;
-            break;
-        }
+    if (size == 0) {
+        // The system realloc may free the block for 0 bytes, so the block is freed here and never reaches it
+        ansi_c_mem_track_free(ptr);
+        return NULL;
     }
 
-    if (index == -1) {
+    if (size > (size_t)-1 - BLOCK_HEADER_SIZE) {
         return NULL;
     }
-
-    void* new_ptr = realloc(ptr, size);
-    size_t sizechange=llabs(size- g_mem_info.blocks[index].size);
-    bool increase = true; // increase or decrease
-    if (size < g_mem_info.blocks[index].size) {
-        increase = false;
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    size_t unsampled_size;
+    MemoryBackend unsampled_backend;
+    if (unsampled_header_get(ptr, &unsampled_size, &unsampled_backend)) {
+        return unsampled_realloc(ptr, unsampled_size, unsampled_backend, size);
+    }
+#endif
+    MemoryShard* shard = shard_of(ptr);
+    if (!shard) {
+        return NULL;
+    }
+    shard_lock(shard);
+    size_t index = block_index_find(shard, ptr);
+    if (index == INVALID_INDEX) {
+        shard_unlock(shard);
+        return NULL;
     }
 
+    // The block is untracked while the backend resizes it, so the shard is not locked during the system realloc.
+    // Another thread may briefly miss the block in a visit or a snapshot, but only the caller may use its address.
+    MemoryBlock block = shard->blocks[index];
+    shard_untrack(shard, index);
+    shard_unlock(shard);
+
+    MemoryBackend backend;
+    void* new_raw = backend_realloc(raw_address(ptr), &block, size + BLOCK_HEADER_SIZE, &backend);
+    void* new_ptr = new_raw ? (char*)new_raw + BLOCK_HEADER_SIZE : NULL;
+    size_t old_size = block.size;
+    size_t old_estimated_size = block.estimated_size;
     if (new_ptr) {
-        g_mem_info.blocks[index].address = new_ptr;
-        g_mem_info.blocks[index].size = size;        
-        if (increase) {
-            g_mem_info.memory_usage += sizechange;
-            g_mem_info.total_memory_usage += sizechange;
-        }
-        else {
-            g_mem_info.memory_usage -= sizechange;
-            g_mem_info.total_freed_memory += sizechange;
+        block.address = new_ptr;
+        block.size = size;
+        block.backend = backend;
+        block_estimate(&block);
+        TRACE_EVENT(TRACE_OP_REALLOC, new_ptr, ptr, size, block.call_site_id, block.optional_object_id);
+    }
+    size_t call_site_id = block.call_site_id;
+    MemoryShard* new_shard = shard;
+#ifndef ANSI_C_MEM_TRACK_INLINE_HEADER
+    new_shard = shard_select(block.address);
+#endif
+    shard_lock(new_shard);
+    size_t new_index = shard_track(new_shard, &block);
+    shard_unlock(new_shard);
+    if (new_index == INVALID_INDEX) {
+        // The block cannot be tracked any more and is accounted for as freed. Only a plain malloc block stays valid
+        // for the caller, because free passes an untracked pointer to the system free.
+        counters_update(0, 1, 0, old_size);
+        TRACE_EVENT(TRACE_OP_FREE, block.address, NULL, block.size, block.call_site_id, block.optional_object_id);
+        if (BLOCK_HEADER_SIZE == 0 && block.backend == MEMORY_BACKEND_SYSTEM) {
+            return new_ptr;
         }
+        backend_free(raw_address(block.address), &block);
+        return NULL;
+    }
+    if (!new_ptr) {
+        return NULL;
+    }
+
+    CallSiteUsage* usage = call_site_usage_at(call_site_id);
+    size_histogram_record(size, usage);
+    if (block.estimated_size > old_estimated_size) {
+        ATOMIC_ADD(&usage->total_memory_usage, block.estimated_size - old_estimated_size);
+    }
+    if (size > old_size) {
+        counters_update(0, 0, size - old_size, 0);
+    }
+    else {
+        counters_update(0, 0, 0, old_size - size);
     }
 
     return new_ptr;
@@ -440,18 +2401,374 @@ void* ansi_c_mem_track_realloc(void* ptr, size_t size, size_t optional_object_id
  * @return None.
  */
 void ansi_c_mem_track_free_by_object_id(size_t optional_object_id) {
+    TRACE_EVENT(TRACE_OP_FREE_OBJECT_ID, NULL, NULL, 0, 0, optional_object_id);
+    for (MemoryShard* shard = ATOMIC_LOAD_PTR(&g_mem_info.shards); shard; shard = shard->next) {
+        shard_lock(shard);
+        ObjectIndexEntry* entry = object_index_find(shard, optional_object_id);
+        if (entry) {
+            // The entry is removed from the index together with the last block
+            size_t slot = entry->head;
+            while (slot != INVALID_INDEX) {
+                size_t next_slot = shard->blocks[slot].next_slot;
+                free_block(shard, slot);
+                slot = next_slot;
+            }
+        }
+        shard_unlock(shard);
+    }
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    // None of the blocks is tracked any more, so all chunks of the arena go at once
+    ansi_c_mem_track_arena_release(optional_object_id);
+#endif
+}
+
+ObjectUsageInfo ansi_c_mem_track_get_object_info(size_t optional_object_id) {
+    ObjectUsageInfo info = { 0, 0, 0, 0 };
+    for (MemoryShard* shard = ATOMIC_LOAD_PTR(&g_mem_info.shards); shard; shard = shard->next) {
+        shard_lock(shard);
+        const ObjectIndexEntry* entry = object_index_find(shard, optional_object_id);
+        if (entry) {
+            info.size += entry->size;
+            info.memory_usage += entry->memory_usage;
+        }
+        shard_unlock(shard);
+    }
+    if (optional_object_id && ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized)) {
+        ObjectTotalsStripe* stripe = object_totals_stripe(optional_object_id);
+        MUTEX_LOCK(&stripe->lock);
+        const ObjectTotals* totals = stripe->entries
+            ? stripe->entries[object_totals_position(stripe->entries, stripe->capacity, optional_object_id)] : NULL;
+        if (totals) {
+            info.peak_size = ATOMIC_LOAD(&totals->peak_size);
+            info.peak_memory_usage = ATOMIC_LOAD(&totals->peak_memory_usage);
+        }
+        MUTEX_UNLOCK(&stripe->lock);
+    }
+    // The blocks may have changed between the two lookups
+    if (info.peak_size < info.size) {
+        info.peak_size = info.size;
+    }
+    if (info.peak_memory_usage < info.memory_usage) {
+        info.peak_memory_usage = info.memory_usage;
+    }
+    return info;
+}
+
+CallSiteUsageInfo ansi_c_mem_track_get_call_site_info(size_t call_site_id) {
+    CallSiteUsageInfo info = { 0, 0, 0, 0, 0, 0 };
+    if (call_site_id >= ATOMIC_LOAD(&g_mem_info.call_site_count)) {
+        return info;
+    }
+    const CallSiteUsage* usage = call_site_usage_at(call_site_id);
+    info.size = ATOMIC_LOAD(&usage->size);
+    info.memory_usage = ATOMIC_LOAD(&usage->memory_usage);
+    info.peak_size = ATOMIC_LOAD(&usage->peak_size);
+    info.peak_memory_usage = ATOMIC_LOAD(&usage->peak_memory_usage);
+    info.total_size = ATOMIC_LOAD(&usage->total_size);
+    info.total_memory_usage = ATOMIC_LOAD(&usage->total_memory_usage);
+    // A reset of the peaks may overlap with an allocation
+    if (info.peak_size < info.size) {
+        info.peak_size = info.size;
+    }
+    if (info.peak_memory_usage < info.memory_usage) {
+        info.peak_memory_usage = info.memory_usage;
+    }
+    return info;
+}
+
+/**
+ * @brief Returns the column of a call site usage that orders a profile.
+ */
+static size_t call_site_profile_key(const CallSiteProfileEntry* entry, CallSiteProfileOrder order) {
+    if (order == CALL_SITE_PROFILE_BY_SIZE) {
+        return entry->usage.size;
+    }
+    else if (order == CALL_SITE_PROFILE_BY_TOTAL_MEMORY_USAGE) {
+        return entry->usage.total_memory_usage;
+    }
+    else if (order == CALL_SITE_PROFILE_BY_TOTAL_SIZE) {
+        return entry->usage.total_size;
+    }
+    return entry->usage.memory_usage;
+}
+
+/**
+ * @brief Returns true if entry a ranks below entry b in a profile. Of two equal call sites the older one ranks
+ * higher, so the profile does not depend on the order of the scan.
+ */
+static bool call_site_profile_below(const CallSiteProfileEntry* a, const CallSiteProfileEntry* b,
+    CallSiteProfileOrder order) {
+    size_t key_a = call_site_profile_key(a, order);
+    size_t key_b = call_site_profile_key(b, order);
+    return key_a < key_b || (key_a == key_b && a->call_site_id > b->call_site_id);
+}
+
+/**
+ * @brief Restores the heap below the given position, the lowest ranking entry is on the top of the heap.
+ */
+static void call_site_profile_sift_down(CallSiteProfileEntry* heap, size_t count, size_t position,
+    CallSiteProfileOrder order) {
+    for (;;) {
+        size_t lowest = position;
+        size_t left = position * 2 + 1;
+        size_t right = left + 1;
+        if (left < count && call_site_profile_below(&heap[left], &heap[lowest], order)) {
+            lowest = left;
+        }
+        if (right < count && call_site_profile_below(&heap[right], &heap[lowest], order)) {
+            lowest = right;
+        }
+        if (lowest == position) {
+            return;
+        }
+        CallSiteProfileEntry entry = heap[position];
+        heap[position] = heap[lowest];
+        heap[lowest] = entry;
+        position = lowest;
+    }
+}
+
+size_t ansi_c_mem_track_get_call_site_profile(CallSiteProfileEntry* entries, size_t max_entries, CallSiteProfileOrder order) {
+    if (!entries || max_entries == 0) {
+        return 0;
+    }
+    // The entries hold a heap of the highest call sites so far, with the lowest of them on the top
+    size_t count = 0;
+    size_t call_site_count = ATOMIC_LOAD(&g_mem_info.call_site_count);
+    for (size_t id = 0; id < call_site_count; ++id) {
+        CallSiteProfileEntry entry;
+        entry.call_site_id = id;
+        entry.usage = ansi_c_mem_track_get_call_site_info(id);
+        if (entry.usage.total_size == 0) {
+            continue;
+        }
+        if (count < max_entries) {
+            size_t position = count++;
+            entries[position] = entry;
+            while (position > 0 && call_site_profile_below(&entries[position], &entries[(position - 1) / 2], order)) {
+                CallSiteProfileEntry parent = entries[(position - 1) / 2];
+                entries[(position - 1) / 2] = entries[position];
+                entries[position] = parent;
+                position = (position - 1) / 2;
+            }
+        }
+        else if (call_site_profile_below(&entries[0], &entry, order)) {
+            entries[0] = entry;
+            call_site_profile_sift_down(entries, count, 0, order);
+        }
+    }
+
+    // Taking the lowest entry off the heap one by one leaves the entries ordered from the highest
+    for (size_t heap_size = count; heap_size > 1; --heap_size) {
+        CallSiteProfileEntry lowest = entries[0];
+        entries[0] = entries[heap_size - 1];
+        entries[heap_size - 1] = lowest;
+        call_site_profile_sift_down(entries, heap_size - 1, 0, order);
+    }
+    return count;
+}
+
+bool ansi_c_mem_track_print_call_site_profile(const char* file_name, size_t max_entries, CallSiteProfileOrder order) {
+    size_t line_size = 512;
+    // At most the interned call sites can be printed, which also keeps the sizes below from overflowing
+    size_t call_site_count = ATOMIC_LOAD(&g_mem_info.call_site_count);
+    size_t limit = call_site_count < max_entries ? call_site_count : max_entries;
+    CallSiteProfileEntry* entries = (CallSiteProfileEntry*)malloc(sizeof(CallSiteProfileEntry) * (limit ? limit : 1));
+    char* text = (char*)malloc(line_size * (limit ? limit : 1) + 1);
+    if (!entries || !text) {
+        free(entries);
+        free(text);
+        return false;
+    }
+    size_t count = ansi_c_mem_track_get_call_site_profile(entries, limit, order);
+    size_t length = 0;
+    text[0] = '\0';
+    for (size_t i = 0; i < count; ++i) {
+        const CallSite* call_site = ansi_c_mem_track_get_call_site(entries[i].call_site_id);
+        char line[16] = "";
+        if (call_site->line) {
+            snprintf(line, sizeof(line), ":%u", call_site->line);
+        }
+        int written = snprintf(text + length, line_size,
+            "                             %lu bytes in %lu blocks, %lu bytes in %lu blocks in total: %s%s %s %s\n",
+            (unsigned long)entries[i].usage.memory_usage, (unsigned long)entries[i].usage.size,
+            (unsigned long)entries[i].usage.total_memory_usage, (unsigned long)entries[i].usage.total_size,
+            call_site->file_name ? call_site->file_name : "(unknown)", line,
+            call_site->comment ? call_site->comment : "", call_site->type ? call_site->type : "");
+        if (written < 0) {
+            text[length] = '\0';
+            continue;
+        }
+        if ((size_t)written >= line_size) {
+            // A line that does not fit is cut
+            written = (int)line_size - 1;
+            text[length + written - 1] = '\n';
+        }
+        length += (size_t)written;
+    }
+    bool result = ansi_c_mem_track_log_write(file_name, "[MEMORY] Call site profile, top %lu:\n%s",
+        (unsigned long)limit, text);
+    free(entries);
+    free(text);
+    return result;
+}
+
+/**
+ * @brief Opens a profile file with a large buffer, so the profile is written in few system calls.
+ *
+ * @return The file, or NULL if it could not be opened.
+ */
+static FILE* profile_open(const char* file_name) {
+    FILE* file = NULL;
+    if (!file_name || FOPEN(&file, file_name, "wb") != 0) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, PROFILE_BUFFER_SIZE);
+    return file;
+}
+
+bool ansi_c_mem_track_export_pprof(const char* file_name) {
+    FILE* file = profile_open(file_name);
+    if (!file) {
+        return false;
+    }
+    bool written = ansi_c_mem_track_profile_write_pprof(file);
+    return fclose(file) == 0 && written;
+}
 
-    for (size_t i = 0; i < g_mem_info.size;  i++) {
-        if (g_mem_info.blocks[i].optional_object_id == optional_object_id) {
-            ansi_c_mem_track_free_block(i);
+bool ansi_c_mem_track_export_folded(const char* file_name, CallSiteProfileOrder value) {
+    FILE* file = profile_open(file_name);
+    if (!file) {
+        return false;
+    }
+    bool written = ansi_c_mem_track_profile_write_folded(file, value);
+    return fclose(file) == 0 && written;
+}
+
+void ansi_c_mem_track_get_size_histogram(SizeHistogram* histogram) {
+    for (size_t bucket = 0; bucket < SIZE_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        histogram->counts[bucket] = ATOMIC_LOAD(&size_histogram[bucket]);
+    }
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+    for (const ThreadState* state = ATOMIC_LOAD_PTR(&thread_states); state; state = state->next) {
+        for (size_t bucket = 0; bucket < SIZE_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+            histogram->counts[bucket] += ATOMIC_LOAD(&state->size_histogram[bucket]);
         }
     }
-    cleanup_allocations_if_needed();
+#endif
+}
+
+bool ansi_c_mem_track_get_call_site_size_histogram(size_t call_site_id, SizeHistogram* histogram) {
+    if (call_site_id >= ATOMIC_LOAD(&g_mem_info.call_site_count)) {
+        return false;
+    }
+    const CallSiteUsage* usage = call_site_usage_at(call_site_id);
+    for (size_t bucket = 0; bucket < SIZE_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        histogram->counts[bucket] = ATOMIC_LOAD(&usage->size_histogram[bucket]);
+    }
+    return true;
+}
+
+size_t ansi_c_mem_track_size_histogram_bucket_min(size_t bucket) {
+    if (bucket < SIZE_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t exponent = bucket / SIZE_HISTOGRAM_SUB_BUCKETS + SIZE_HISTOGRAM_SUB_BUCKET_BITS - 1;
+    size_t mantissa = bucket % SIZE_HISTOGRAM_SUB_BUCKETS + SIZE_HISTOGRAM_SUB_BUCKETS;
+    return mantissa << (exponent - SIZE_HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+void ansi_c_mem_track_reset_peaks(void) {
+    MemoryUsageInfo info = ansi_c_mem_track_get_info();
+    ATOMIC_STORE(&g_mem_info.peak_size, info.size);
+    ATOMIC_STORE(&g_mem_info.peak_memory_usage, info.memory_usage);
+    size_t count = ATOMIC_LOAD(&g_mem_info.call_site_count);
+    for (size_t id = 0; id < count; ++id) {
+        CallSiteUsage* usage = call_site_usage_at(id);
+        ATOMIC_STORE(&usage->peak_size, ATOMIC_LOAD(&usage->size));
+        ATOMIC_STORE(&usage->peak_memory_usage, ATOMIC_LOAD(&usage->memory_usage));
+    }
+    if (ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized)) {
+        object_totals_reset();
+    }
 }
 
 size_t ansi_c_mem_track_get_next_object_id(void)
 {
-    return next_object_id++;
+    return ATOMIC_FETCH_ADD(&next_object_id, 1);
+}
+
+bool ansi_c_mem_track_start_trace(const char* file_name, size_t file_size, size_t file_count)
+{
+#ifdef ANSI_C_MEM_TRACK_TRACE
+    return ansi_c_mem_track_trace_start(file_name, file_size, file_count);
+#else
+    (void)file_name;
+    (void)file_size;
+    (void)file_count;
+    return false;
+#endif
+}
+
+void ansi_c_mem_track_stop_trace(void)
+{
+#ifdef ANSI_C_MEM_TRACK_TRACE
+    ansi_c_mem_track_trace_stop();
+#endif
+}
+
+void ansi_c_mem_track_set_sampling_interval(size_t interval)
+{
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    ansi_c_mem_track_sample_set_interval(interval);
+#else
+    (void)interval;
+#endif
+}
+
+size_t ansi_c_mem_track_get_estimated_size(const MemoryBlock* block)
+{
+    return block->is_sampled ? block->estimated_size : block->size;
+}
+
+size_t ansi_c_mem_track_get_stack(size_t stack_id, void** frames, size_t max_frames)
+{
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+    return ansi_c_mem_track_stack_get(stack_id, frames, max_frames);
+#else
+    (void)stack_id;
+    (void)frames;
+    (void)max_frames;
+    return 0;
+#endif
+}
+
+bool ansi_c_mem_track_print_stack(const char* file_name, size_t stack_id)
+{
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+    char* text = ansi_c_mem_track_stack_format(stack_id);
+    if (!text) {
+        return false;
+    }
+    bool result = ansi_c_mem_track_log_write(file_name, "[MEMORY] Call stack %lu:\n%s", (unsigned long)stack_id, text);
+    free(text);
+    return result;
+#else
+    (void)file_name;
+    (void)stack_id;
+    return false;
+#endif
+}
+
+size_t ansi_c_mem_track_create_arena(void)
+{
+    size_t object_id = ansi_c_mem_track_get_next_object_id();
+#ifdef ANSI_C_MEM_TRACK_ARENA
+    if (!ansi_c_mem_track_arena_create(object_id)) {
+        return 0;
+    }
+#endif
+    return object_id;
 }
 
 /**
@@ -463,114 +2780,140 @@ size_t ansi_c_mem_track_get_next_object_id(void)
  */
 const MemoryBlock* find_block_by_ptr(void* ptr)
 {
-    for (size_t i = 0; i < g_mem_info.size; ++i) {
-        if (g_mem_info.blocks[i].address == ptr) {
-            return &g_mem_info.blocks[i];
-        }
-    }
-
-    return NULL;
+    return ansi_c_mem_track_get_block_info(ptr);
 }
 
 const MemoryBlock* ansi_c_mem_track_get_block_info(const void* ptr) {
-    for (size_t i = 0; i < g_mem_info.size; ++i) {
-        if (g_mem_info.blocks[i].address == ptr) {
-            return &g_mem_info.blocks[i];
-        }
+    MemoryShard* shard = shard_of(ptr);
+    if (!shard) {
+        return NULL;
+    }
+    shard_lock(shard);
+    size_t index = block_index_find(shard, ptr);
+    const MemoryBlock* block = NULL;
+    if (index != INVALID_INDEX) {
+#ifdef ANSI_C_MEM_TRACK_THREAD_SAFE
+        // The blocks array may be moved by other threads once the lock is released
+        static THREAD_LOCAL MemoryBlock block_copy;
+        block_copy = shard->blocks[index];
+        block = &block_copy;
+#else
+        block = &shard->blocks[index];
+#endif
     }
-    return NULL;
+    shard_unlock(shard);
+    return block;
 }
 
-bool ansi_c_mem_track_log_block_info(const char* file_name, const MemoryBlock* block) {
-    FILE* output_file;
-
-    // Get the current time
-    time_t raw_time;
-    struct tm time_info;
-    time(&raw_time);
-    localtime_func(&raw_time, &time_info);
+size_t ansi_c_mem_track_get_block_size(const void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+    size_t unsampled_size;
+    MemoryBackend unsampled_backend;
+    if (unsampled_header_get(ptr, &unsampled_size, &unsampled_backend)) {
+        return unsampled_size;
+    }
+#endif
+    MemoryShard* shard = shard_of(ptr);
+    if (!shard) {
+        return 0;
+    }
+    shard_lock(shard);
+    size_t index = block_index_find(shard, ptr);
+    size_t size = index != INVALID_INDEX ? shard->blocks[index].size : 0;
+    shard_unlock(shard);
+    return size;
+}
 
-    // Format the timestamp
-    char timestamp[20];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &time_info);
+bool ansi_c_mem_track_log_block_info(const char* file_name, const MemoryBlock* block) {
+    const CallSite* call_site = ansi_c_mem_track_get_call_site(block->call_site_id);
+    const char* block_file_name = call_site ? call_site->file_name : NULL;
+    const char* block_comment = call_site ? call_site->comment : NULL;
+    const char* block_type = call_site ? call_site->type : NULL;
+    char block_line[16] = "";
+    if (call_site && call_site->line) {
+        snprintf(block_line, sizeof(block_line), ":%u", call_site->line);
+    }
 
-    // Get the required size of the message buffer
-    const char* formatstr = "%s [MEMORY] Memory Block Information:\n"
+    if (block->is_sampled) {
+        return ansi_c_mem_track_log_write(file_name, "[MEMORY] Memory Block Information:\n"
+            "                             Address: 0x%lx\n"
+            "                             Size: %lu bytes (sampled, stands for about %lu bytes)\n"
+            "                             File: %s%s\n"
+            "                             Comment: %s\n"
+            "                             Type: %s\n"
+            "                             Is allocated: %s\n"
+            "                             Object ID: %lu\n",
+            (unsigned long)(uintptr_t)block->address, (unsigned long)block->size,
+            (unsigned long)ansi_c_mem_track_get_estimated_size(block), block_file_name, block_line, block_comment,
+            block_type,
+            (block->is_allocated ? "True" : "False"), (unsigned long)block->optional_object_id);
+    }
+    return ansi_c_mem_track_log_write(file_name, "[MEMORY] Memory Block Information:\n"
         "                             Address: 0x%lx\n"
         "                             Size: %lu bytes\n"
-        "                             File: %s\n"
+        "                             File: %s%s\n"
         "                             Comment: %s\n"
         "                             Type: %s\n"
         "                             Is allocated: %s\n"
-        "                             Object ID: %lu\n";
-    size_t message_size = snprintf(NULL, 0, formatstr,
-        timestamp, (uintptr_t)block->address, (unsigned long)block->size, block->file_name, block->comment, block->type, 
-        (block->is_allocated?"True":"False"), block->optional_object_id);
-
-    // Allocate the message buffer
-    char* message = (char*)malloc(message_size + 1);
-    if (!message) {
-        return false;
-    }
+        "                             Object ID: %lu\n",
+        (unsigned long)(uintptr_t)block->address, (unsigned long)block->size, block_file_name, block_line, block_comment,
+        block_type, (block->is_allocated ? "True" : "False"), (unsigned long)block->optional_object_id);
+}
 
-    // Format the message
-    snprintf(message, message_size + 1, formatstr,
-        timestamp, (uintptr_t)block->address, (unsigned long)block->size, block->file_name, block->comment, block->type,
-        (block->is_allocated ? "True" : "False"), block->optional_object_id);
+const MemoryBlock** ansi_c_mem_track_get_unfreed_blocks_info(size_t* count)
+{
+    *count = 0;
 
-    // Write the message to the file or to the standard output
-    if (file_name) {
-        if (FOPEN(&output_file, file_name, "a") != 0) {
-            return false;
-        }
-        fprintf(output_file, "%s", message);
-        fclose(output_file);
-    }
-    else {
-        printf("%s", message);
-    }
+    // free if necessary
+    ansi_c_mem_track_free_unfreed_blocks_info();
 
-    if (message) {
-        free(message);
+    // All shards are locked, in list order, so that the blocks are collected at a single point in time
+    MemoryShard* shards = ATOMIC_LOAD_PTR(&g_mem_info.shards);
+    for (MemoryShard* shard = shards; shard; shard = shard->next) {
+        shard_lock(shard);
     }
-    return true;
-}
 
-const MemoryBlock** ansi_c_mem_track_get_unfreed_blocks_info(size_t* count)
-{
     // Count the number of unfreed blocks
     size_t unfreed_count = 0;
-    for (size_t i = 0; i < g_mem_info.size; ++i) {
-        if (g_mem_info.blocks[i].is_allocated) {
-            ++unfreed_count;
+    for (const MemoryShard* shard = shards; shard; shard = shard->next) {
+        for (size_t i = 0; i < shard->used; ++i) {
+            if (shard->blocks[i].is_allocated) {
+                ++unfreed_count;
+            }
         }
     }
 
-    *count = 0;
-
-    // free if necessary
-    ansi_c_mem_track_free_unfreed_blocks_info();
-
     // Allocate memory for the unfreed blocks array
-    g_mem_info.get_unfreed_blocks_info_ptr = (MemoryBlock**)malloc(sizeof(MemoryBlock) * unfreed_count);
-    if (!g_mem_info.get_unfreed_blocks_info_ptr) {
-        return NULL;
-    }
+    g_mem_info.get_unfreed_blocks_info_ptr = (MemoryBlock**)malloc(sizeof(MemoryBlock*) * (unfreed_count ? unfreed_count : 1));
 
     // Copy the unfreed blocks into the array
-    for (size_t i = 0; i < g_mem_info.size && g_mem_info.get_unfreed_blocks_info_size < unfreed_count; ++i) {
-        if (g_mem_info.blocks[i].is_allocated) {
-            MemoryBlock* mb_ptr=ansi_c_mem_track_copy_memory_block(&g_mem_info.blocks[i]);
-            if (mb_ptr) {
-                g_mem_info.get_unfreed_blocks_info_ptr[g_mem_info.get_unfreed_blocks_info_size++] = mb_ptr;
-                
-            } else {
-                return NULL;
+    bool copied = g_mem_info.get_unfreed_blocks_info_ptr != NULL;
+    for (const MemoryShard* shard = shards; shard && copied; shard = shard->next) {
+        for (size_t i = 0; i < shard->used && g_mem_info.get_unfreed_blocks_info_size < unfreed_count; ++i) {
+            if (shard->blocks[i].is_allocated) {
+                MemoryBlock* mb_ptr=ansi_c_mem_track_copy_memory_block(&shard->blocks[i]);
+                if (mb_ptr) {
+                    g_mem_info.get_unfreed_blocks_info_ptr[g_mem_info.get_unfreed_blocks_info_size++] = mb_ptr;
+                    
+                } else {
+                    copied = false;
+                    break;
+                }
             }
         }
     }
+
+    for (MemoryShard* shard = shards; shard; shard = shard->next) {
+        shard_unlock(shard);
+    }
+    if (!copied) {
+        return NULL;
+    }
     *count = g_mem_info.get_unfreed_blocks_info_size;
-    return g_mem_info.get_unfreed_blocks_info_ptr;
+    return (const MemoryBlock**)g_mem_info.get_unfreed_blocks_info_ptr;
 }
 
 bool ansi_c_mem_track_log_unfreed_blocks_info(const char* file_name, const MemoryBlock** blocks, size_t count)
@@ -582,6 +2925,93 @@ bool ansi_c_mem_track_log_unfreed_blocks_info(const char* file_name, const Memor
     return retval;
 }
 
+/**
+ * @brief Returns true if a block is allocated and the filter selects it.
+ */
+static bool block_filter_match(const MemoryBlock* block, const BlockFilter* filter)
+{
+    if (!block->is_allocated) {
+        return false;
+    }
+    return !filter || (block->size >= filter->min_size && block->size <= filter->max_size
+        && (filter->call_site_id == BLOCK_FILTER_ANY || block->call_site_id == filter->call_site_id)
+        && (filter->optional_object_id == BLOCK_FILTER_ANY || block->optional_object_id == filter->optional_object_id));
+}
+
+size_t ansi_c_mem_track_visit_blocks(const BlockFilter* filter, MemoryBlockVisitor visitor, void* context)
+{
+    size_t visited = 0;
+    bool is_stopped = false;
+    for (MemoryShard* shard = ATOMIC_LOAD_PTR(&g_mem_info.shards); shard && !is_stopped; shard = shard->next) {
+        shard_lock(shard);
+        if (filter && filter->optional_object_id != BLOCK_FILTER_ANY) {
+            // The blocks of an object ID are linked, the other blocks of the shard are skipped
+            const ObjectIndexEntry* entry = object_index_find(shard, filter->optional_object_id);
+            for (size_t slot = entry ? entry->head : INVALID_INDEX; slot != INVALID_INDEX && !is_stopped;
+                slot = shard->blocks[slot].next_slot) {
+                if (block_filter_match(&shard->blocks[slot], filter)) {
+                    ++visited;
+                    is_stopped = !visitor(&shard->blocks[slot], context);
+                }
+            }
+        }
+        else {
+            for (size_t slot = 0; slot < shard->used && !is_stopped; ++slot) {
+                if (block_filter_match(&shard->blocks[slot], filter)) {
+                    ++visited;
+                    is_stopped = !visitor(&shard->blocks[slot], context);
+                }
+            }
+        }
+        shard_unlock(shard);
+    }
+    return visited;
+}
+
+size_t ansi_c_mem_track_read_blocks(BlockCursor* cursor, const BlockFilter* filter, MemoryBlock* blocks, size_t max_blocks)
+{
+    if (cursor->is_done) {
+        return 0;
+    }
+    if (!cursor->shard) {
+        cursor->shard = ATOMIC_LOAD_PTR(&g_mem_info.shards);
+        cursor->slot = 0;
+    }
+    size_t count = 0;
+    while (cursor->shard && count < max_blocks) {
+        MemoryShard* shard = cursor->shard;
+        shard_lock(shard);
+        for (; cursor->slot < shard->used && count < max_blocks; ++cursor->slot) {
+            if (block_filter_match(&shard->blocks[cursor->slot], filter)) {
+                blocks[count++] = shard->blocks[cursor->slot];
+            }
+        }
+        bool is_shard_done = cursor->slot >= shard->used;
+        shard_unlock(shard);
+        if (is_shard_done) {
+            cursor->shard = shard->next;
+            cursor->slot = 0;
+        }
+    }
+    cursor->is_done = !cursor->shard;
+    return count;
+}
+
+bool ansi_c_mem_track_log_blocks(const char* file_name, const BlockFilter* filter)
+{
+    MemoryBlock blocks[64];
+    BlockCursor cursor = BLOCK_CURSOR_INIT;
+    size_t count;
+    while ((count = ansi_c_mem_track_read_blocks(&cursor, filter, blocks, sizeof(blocks) / sizeof(blocks[0]))) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!ansi_c_mem_track_log_block_info(file_name, &blocks[i])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 bool ansi_c_mem_track_is_initialized(void) {
-    return g_mem_info.is_initialized;
+    return ATOMIC_LOAD_BOOL(&g_mem_info.is_initialized);
 }
@@ -0,0 +1,248 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "ansi_c_mem_track_arena.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_ARENA
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+typedef struct ArenaChunk ArenaChunk;
+
+/**
+ * @brief Header at the start of every chunk.
+ */
+struct ArenaChunk {
+    ArenaChunk* next; /**< The next chunk of the arena. */
+};
+
+#define ARENA_CHUNK_HEADER_SIZE ARENA_ROUND(sizeof(ArenaChunk))
+
+/**
+ * @brief Blocks larger than this get a chunk of their own, so they do not waste the rest of the current chunk.
+ */
+#define ARENA_LARGE_BLOCK_SIZE ((ANSI_C_MEM_TRACK_ARENA_CHUNK_SIZE - ARENA_CHUNK_HEADER_SIZE) / 4)
+
+/**
+ * @brief Arena of an object ID.
+ */
+typedef struct {
+    size_t object_id;   /**< The object ID that owns the arena. */
+    MUTEX_TYPE lock;    /**< Protects the chunks and the tip. */
+    ArenaChunk* chunks; /**< All chunks of the arena, the current chunk first. */
+    char* tip;          /**< The next free byte of the current chunk, NULL before the first chunk. */
+    char* end;          /**< The end of the current chunk. */
+} Arena;
+
+/*
+ * The arenas are found by their object ID in an open addressing hash table with linear probing. Allocations
+ * look up their arena under the read lock, creating and releasing an arena takes the write lock.
+ */
+static RWLOCK_TYPE arena_table_lock = RWLOCK_STATIC_INIT;
+static Arena** arena_table = NULL;
+static size_t arena_table_capacity = 0;
+static size_t arena_count = 0;
+
+static size_t hash_object_id(size_t object_id) {
+    uint64_t value = (uint64_t)object_id;
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    return (size_t)value;
+}
+
+/**
+ * @brief Returns the slot of the arena of the object ID, or the empty slot where it would be inserted. The table
+ * must not be empty. The caller must hold the table lock.
+ */
+static size_t arena_slot(size_t object_id) {
+    size_t mask = arena_table_capacity - 1;
+    size_t i = hash_object_id(object_id) & mask;
+    while (arena_table[i] && arena_table[i]->object_id != object_id) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static Arena* arena_find(size_t object_id) {
+    return arena_table_capacity ? arena_table[arena_slot(object_id)] : NULL;
+}
+
+/**
+ * @brief Resizes the table and rehashes its arenas. The caller must hold the write lock.
+ */
+static bool arena_table_resize(size_t capacity) {
+    Arena** old_table = arena_table;
+    size_t old_capacity = arena_table_capacity;
+    Arena** new_table = (Arena**)calloc(capacity, sizeof(Arena*));
+    if (!new_table) {
+        return false;
+    }
+    arena_table = new_table;
+    arena_table_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_table[i]) {
+            arena_table[arena_slot(old_table[i]->object_id)] = old_table[i];
+        }
+    }
+    free(old_table);
+    return true;
+}
+
+bool ansi_c_mem_track_arena_create(size_t object_id) {
+    RWLOCK_WRITE_LOCK(&arena_table_lock);
+    // The load factor is kept at or below 0.5, so the probe sequences stay short
+    if ((arena_count + 1) * 2 > arena_table_capacity
+        && !arena_table_resize(arena_table_capacity ? arena_table_capacity * 2 : 16)) {
+        RWLOCK_WRITE_UNLOCK(&arena_table_lock);
+        return false;
+    }
+    size_t slot = arena_slot(object_id);
+    Arena* arena = arena_table[slot] ? NULL : (Arena*)malloc(sizeof(Arena));
+    if (!arena) {
+        RWLOCK_WRITE_UNLOCK(&arena_table_lock);
+        return false;
+    }
+    arena->object_id = object_id;
+    MUTEX_INIT(&arena->lock);
+    arena->chunks = NULL;
+    arena->tip = NULL;
+    arena->end = NULL;
+    arena_table[slot] = arena;
+    ATOMIC_STORE(&arena_count, arena_count + 1);
+    RWLOCK_WRITE_UNLOCK(&arena_table_lock);
+    return true;
+}
+
+/**
+ * @brief Allocates a chunk for a block that does not fit in the current chunk. The caller must hold the lock of
+ * the arena.
+ */
+static void* arena_grow(Arena* arena, size_t size) {
+    bool large = size > ARENA_LARGE_BLOCK_SIZE;
+    size_t chunk_size = large ? ARENA_CHUNK_HEADER_SIZE + size : ANSI_C_MEM_TRACK_ARENA_CHUNK_SIZE;
+    void* memory = NULL;
+    ALIGNED_MALLOC(memory, ARENA_ALIGNMENT, chunk_size);
+    if (!memory) {
+        return NULL;
+    }
+    ArenaChunk* chunk = (ArenaChunk*)memory;
+    char* block = (char*)memory + ARENA_CHUNK_HEADER_SIZE;
+    if (large && arena->chunks) {
+        // The large block is linked behind the current chunk, which stays current
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return block;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->tip = block + size;
+    arena->end = (char*)memory + chunk_size;
+    return block;
+}
+
+void* ansi_c_mem_track_arena_alloc(size_t object_id, size_t size) {
+    if (ATOMIC_LOAD(&arena_count) == 0 || size > (size_t)-1 - ARENA_CHUNK_HEADER_SIZE - ARENA_ALIGNMENT) {
+        return NULL;
+    }
+    size = ARENA_ROUND(size);
+    RWLOCK_READ_LOCK(&arena_table_lock);
+    Arena* arena = arena_find(object_id);
+    if (!arena) {
+        RWLOCK_READ_UNLOCK(&arena_table_lock);
+        return NULL;
+    }
+    MUTEX_LOCK(&arena->lock);
+    void* block;
+    if (arena->tip && (size_t)(arena->end - arena->tip) >= size) {
+        block = arena->tip;
+        arena->tip += size;
+    }
+    else {
+        block = arena_grow(arena, size);
+    }
+    MUTEX_UNLOCK(&arena->lock);
+    RWLOCK_READ_UNLOCK(&arena_table_lock);
+    return block;
+}
+
+bool ansi_c_mem_track_arena_resize(size_t object_id, void* address, size_t old_size, size_t size) {
+    if (size > (size_t)-1 - ARENA_CHUNK_HEADER_SIZE - ARENA_ALIGNMENT) {
+        return false;
+    }
+    old_size = ARENA_ROUND(old_size);
+    size = ARENA_ROUND(size);
+    bool resized = false;
+    RWLOCK_READ_LOCK(&arena_table_lock);
+    Arena* arena = arena_find(object_id);
+    if (arena) {
+        MUTEX_LOCK(&arena->lock);
+        char* block = (char*)address;
+        if (arena->tip && block + old_size == arena->tip && (size_t)(arena->end - block) >= size) {
+            arena->tip = block + size;
+            resized = true;
+        }
+        MUTEX_UNLOCK(&arena->lock);
+    }
+    RWLOCK_READ_UNLOCK(&arena_table_lock);
+    return resized;
+}
+
+void ansi_c_mem_track_arena_free(size_t object_id, void* address, size_t size) {
+    size = ARENA_ROUND(size);
+    RWLOCK_READ_LOCK(&arena_table_lock);
+    Arena* arena = arena_find(object_id);
+    if (arena) {
+        MUTEX_LOCK(&arena->lock);
+        if (arena->tip && (char*)address + size == arena->tip) {
+            arena->tip = (char*)address;
+        }
+        MUTEX_UNLOCK(&arena->lock);
+    }
+    RWLOCK_READ_UNLOCK(&arena_table_lock);
+}
+
+void ansi_c_mem_track_arena_release(size_t object_id) {
+    RWLOCK_WRITE_LOCK(&arena_table_lock);
+    Arena* arena = arena_find(object_id);
+    if (!arena) {
+        RWLOCK_WRITE_UNLOCK(&arena_table_lock);
+        return;
+    }
+
+    // Backward-shift deletion keeps the probe sequences of the other arenas intact
+    size_t mask = arena_table_capacity - 1;
+    size_t i = arena_slot(object_id);
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!arena_table[j]) {
+            break;
+        }
+        size_t home = hash_object_id(arena_table[j]->object_id) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            arena_table[i] = arena_table[j];
+            i = j;
+        }
+    }
+    arena_table[i] = NULL;
+    ATOMIC_STORE(&arena_count, arena_count - 1);
+    RWLOCK_WRITE_UNLOCK(&arena_table_lock);
+
+    // No other thread can reach the arena any more
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        ALIGNED_FREE(chunk);
+        chunk = next;
+    }
+    MUTEX_DESTROY(&arena->lock);
+    free(arena);
+}
+
+#endif // ANSI_C_MEM_TRACK_ARENA
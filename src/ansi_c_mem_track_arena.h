@@ -0,0 +1,59 @@
+#ifndef ANSI_C_MEM_TRACK_ARENA_H
+#define ANSI_C_MEM_TRACK_ARENA_H
+
+/**
+ * @file ansi_c_mem_track_arena.h
+ * @brief Object ID scoped arenas of the memory tracker, used when ANSI_C_MEM_TRACK_ARENA is defined.
+ *
+ * An arena belongs to a single object ID. The blocks allocated with the object ID are cut from the chunks of the
+ * arena by bumping a pointer, and all chunks are released at once when the object ID is released. A single block
+ * is never returned to the arena, except when it is the last one that was cut.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifndef ANSI_C_MEM_TRACK_ARENA_CHUNK_SIZE
+#define ANSI_C_MEM_TRACK_ARENA_CHUNK_SIZE 65536
+#endif
+
+/**
+ * @brief The alignment of the blocks cut from an arena.
+ */
+#define ARENA_ALIGNMENT 16
+
+/**
+ * @brief Creates an empty arena for the object ID. The first chunk is allocated by the first block.
+ *
+ * @return true if the arena was created, false if the allocation failed or the object ID has an arena already.
+ */
+bool ansi_c_mem_track_arena_create(size_t object_id);
+
+/**
+ * @brief Cuts a block from the arena of the object ID.
+ *
+ * @return The block, or NULL if the object ID has no arena or a new chunk could not be allocated.
+ */
+void* ansi_c_mem_track_arena_alloc(size_t object_id, size_t size);
+
+/**
+ * @brief Resizes a block in place, which is possible if it is the last block cut from the current chunk and the
+ * new size fits in the chunk.
+ *
+ * @return true if the block was resized, false if it has to move.
+ */
+bool ansi_c_mem_track_arena_resize(size_t object_id, void* address, size_t old_size, size_t size);
+
+/**
+ * @brief Gives a block back to its arena. Only the last block cut from the current chunk is reused, the memory of
+ * the others is reclaimed when the arena is released.
+ */
+void ansi_c_mem_track_arena_free(size_t object_id, void* address, size_t size);
+
+/**
+ * @brief Releases all chunks of the arena of the object ID and removes the arena. Must not run concurrently with
+ * other calls for the same object ID.
+ */
+void ansi_c_mem_track_arena_release(size_t object_id);
+
+#endif // ANSI_C_MEM_TRACK_ARENA_H
@@ -0,0 +1,362 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include "ansi_c_mem_track_log.h"
+#include "../include/ansi_c_mem_track.h"
+#include "../include/ansi_c_macro_utils.h"
+
+/**
+ * @brief An open log output. The first output is the standard output.
+ */
+typedef struct {
+    char* name; /**< The file name. */
+    FILE* file; /**< The file, opened for appending. */
+} LogOutput;
+
+/*
+ * The outputs are only appended while the log is open, so they are looked up without a lock. The lock serializes
+ * opening the outputs and starting and stopping the writer thread.
+ */
+static LogOutput log_outputs[LOG_OUTPUT_COUNT];
+static size_t log_output_count = 1;
+static MUTEX_TYPE log_lock = MUTEX_STATIC_INIT;
+static size_t log_dropped_count = 0;
+
+static FILE* log_output_file(size_t output) {
+    return output == 0 ? stdout : log_outputs[output].file;
+}
+
+/**
+ * @brief Returns the output of the file, and opens the file when it is used for the first time.
+ *
+ * @param file_name The file name, or NULL for the standard output.
+ * @return The index of the output, or LOG_OUTPUT_COUNT if the file could not be opened.
+ */
+static size_t log_output_open(const char* file_name) {
+    if (!file_name) {
+        return 0;
+    }
+    size_t count = ATOMIC_LOAD(&log_output_count);
+    for (size_t i = 1; i < count; ++i) {
+        if (strcmp(log_outputs[i].name, file_name) == 0) {
+            return i;
+        }
+    }
+
+    MUTEX_LOCK(&log_lock);
+    // Another thread may have opened the file meanwhile
+    size_t output = LOG_OUTPUT_COUNT;
+    for (size_t i = count; i < log_output_count; ++i) {
+        if (strcmp(log_outputs[i].name, file_name) == 0) {
+            output = i;
+        }
+    }
+    if (output == LOG_OUTPUT_COUNT && log_output_count < LOG_OUTPUT_COUNT) {
+        size_t name_size = strlen(file_name) + 1;
+        char* name = (char*)malloc(name_size);
+        FILE* file;
+        if (name && FOPEN(&file, file_name, "a") == 0) {
+            memcpy(name, file_name, name_size);
+            log_outputs[log_output_count].name = name;
+            log_outputs[log_output_count].file = file;
+            output = log_output_count;
+            ATOMIC_STORE(&log_output_count, log_output_count + 1);
+        }
+        else {
+            free(name);
+        }
+    }
+    MUTEX_UNLOCK(&log_lock);
+    return output;
+}
+
+/**
+ * @brief Writes the current date and time, followed by a space, to the buffer. The text is formatted once per
+ * second and thread.
+ *
+ * @return The length of the text.
+ */
+static size_t log_timestamp(char* buffer) {
+    static THREAD_LOCAL time_t cached_time = (time_t)-1;
+    static THREAD_LOCAL char cached_text[32];
+    static THREAD_LOCAL size_t cached_length = 0;
+    time_t raw_time = time(NULL);
+    if (raw_time != cached_time) {
+        struct tm time_info;
+        localtime_func(&raw_time, &time_info);
+        cached_length = strftime(cached_text, sizeof(cached_text), "%Y-%m-%d %H:%M:%S ", &time_info);
+        cached_time = raw_time;
+    }
+    memcpy(buffer, cached_text, cached_length);
+    return cached_length;
+}
+
+/**
+ * @brief Formats a record into the buffer of LOG_RECORD_TEXT_SIZE bytes, or into heap memory if it is longer.
+ *
+ * @param length Receives the length of the record.
+ * @return The buffer, the heap memory, or NULL if the record could not be formatted.
+ */
+static char* log_format(char* buffer, size_t* length, const char* format, va_list args) {
+    va_list retry;
+    va_copy(retry, args);
+    size_t prefix_length = log_timestamp(buffer);
+    int text_length = vsnprintf(buffer + prefix_length, LOG_RECORD_TEXT_SIZE - prefix_length, format, args);
+    char* text = buffer;
+    if (text_length < 0) {
+        text = NULL;
+    }
+    else if (prefix_length + (size_t)text_length >= LOG_RECORD_TEXT_SIZE) {
+        text = (char*)malloc(prefix_length + (size_t)text_length + 1);
+        if (text) {
+            memcpy(text, buffer, prefix_length);
+            vsnprintf(text + prefix_length, (size_t)text_length + 1, format, retry);
+        }
+    }
+    va_end(retry);
+    *length = prefix_length + (size_t)text_length;
+    return text;
+}
+
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG
+
+/**
+ * @brief A slot of the log queue.
+ */
+typedef struct {
+    size_t sequence;  /**< The position the slot is ready for: to be filled at `position`, to be written at `position + 1`. */
+    size_t output;    /**< The output of the record. */
+    size_t length;    /**< The length of the record. */
+    char* long_text;  /**< The record if it does not fit in `text`, otherwise NULL. */
+    char text[LOG_RECORD_TEXT_SIZE]; /**< The record. */
+} LogRecord;
+
+/*
+ * The queue is a bounded multi-producer, single-consumer ring buffer. A producer claims a position with a
+ * compare-and-swap and publishes the record through the sequence of its slot, so producers never wait for each
+ * other and the writer thread needs no lock at all.
+ */
+static LogRecord* log_queue = NULL;
+static struct {
+    char padding_front[64];
+    size_t enqueue_position; /**< The next position to be claimed by a producer. */
+    char padding_middle[64];
+    size_t written_position; /**< The records before this position are written and flushed. */
+    char padding_back[64];
+} log_positions;
+static bool log_running = false;
+static bool log_flush_requested = false;
+static bool log_exit_registered = false;
+static THREAD_TYPE log_writer_thread;
+
+/**
+ * @brief Writes the published records from the position on, then flushes the outputs that were written to.
+ *
+ * @return The position after the last written record.
+ */
+static size_t log_drain(size_t position) {
+    unsigned written_outputs = 0;
+    for (;;) {
+        LogRecord* record = &log_queue[position & (ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE - 1)];
+        if (ATOMIC_LOAD(&record->sequence) != position + 1) {
+            break;
+        }
+        fwrite(record->long_text ? record->long_text : record->text, 1, record->length, log_output_file(record->output));
+        free(record->long_text);
+        written_outputs |= 1u << record->output;
+        ATOMIC_STORE(&record->sequence, position + ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE);
+        position++;
+    }
+    for (size_t i = 0; written_outputs; ++i, written_outputs >>= 1) {
+        if (written_outputs & 1u) {
+            fflush(log_output_file(i));
+        }
+    }
+    ATOMIC_STORE(&log_positions.written_position, position);
+    return position;
+}
+
+/**
+ * @brief Waits up to the flush interval, less if a flush is requested, the log stops or the queue fills up.
+ */
+static void log_wait(size_t position) {
+    for (unsigned waited = 0; waited < ANSI_C_MEM_TRACK_LOG_FLUSH_INTERVAL; ++waited) {
+        if (ATOMIC_LOAD_BOOL(&log_flush_requested) || !ATOMIC_LOAD_BOOL(&log_running)
+            || ATOMIC_LOAD(&log_positions.enqueue_position) - position >= ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE / 2) {
+            break;
+        }
+        SLEEP_MS(1);
+    }
+    ATOMIC_STORE_BOOL(&log_flush_requested, false);
+}
+
+static THREAD_FUNCTION(log_writer, arg) {
+    (void)arg;
+    size_t position = 0;
+    bool running = true;
+    while (running) {
+        // The flag is read before draining, so the records queued before the stop are written
+        running = ATOMIC_LOAD_BOOL(&log_running);
+        position = log_drain(position);
+        if (running) {
+            log_wait(position);
+        }
+    }
+    THREAD_RETURN;
+}
+
+/**
+ * @brief Starts the writer thread unless it runs already.
+ *
+ * @return true if the writer thread runs, false if it could not be started.
+ */
+static bool log_start(void) {
+    if (ATOMIC_LOAD_BOOL(&log_running)) {
+        return true;
+    }
+    MUTEX_LOCK(&log_lock);
+    if (!log_running) {
+        log_queue = (LogRecord*)malloc(ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE * sizeof(LogRecord));
+        if (log_queue) {
+            for (size_t i = 0; i < ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE; ++i) {
+                log_queue[i].sequence = i;
+            }
+            log_positions.enqueue_position = 0;
+            log_positions.written_position = 0;
+            ATOMIC_STORE_BOOL(&log_running, true);
+            if (!THREAD_CREATE(&log_writer_thread, log_writer, NULL)) {
+                ATOMIC_STORE_BOOL(&log_running, false);
+                free(log_queue);
+                log_queue = NULL;
+            }
+            else if (!log_exit_registered) {
+                // The records still queued when the program exits are written
+                log_exit_registered = atexit(ansi_c_mem_track_log_flush) == 0;
+            }
+        }
+    }
+    bool running = log_running;
+    MUTEX_UNLOCK(&log_lock);
+    return running;
+}
+
+/**
+ * @brief Queues a record for the writer thread. When the queue is full, the record is dropped with
+ * ANSI_C_MEM_TRACK_ASYNC_LOG_DROP, otherwise the caller waits for room.
+ *
+ * @param long_text The record if it is in heap memory, the queue takes it over. NULL if the record is in `text`.
+ * @return true if the record was queued, false if it was dropped.
+ */
+static bool log_enqueue(size_t output, const char* text, size_t length, char* long_text) {
+    for (;;) {
+        size_t position = ATOMIC_LOAD(&log_positions.enqueue_position);
+        LogRecord* record = &log_queue[position & (ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE - 1)];
+        size_t sequence = ATOMIC_LOAD(&record->sequence);
+        if (sequence == position) {
+            if (ATOMIC_CAS(&log_positions.enqueue_position, position, position + 1)) {
+                record->output = output;
+                record->length = length;
+                record->long_text = long_text;
+                if (!long_text) {
+                    memcpy(record->text, text, length);
+                }
+                ATOMIC_STORE(&record->sequence, position + 1);
+                return true;
+            }
+        }
+        else if ((intptr_t)(sequence - position) < 0) {
+            // The slot still holds the record from one round ago, the queue is full
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG_DROP
+            ATOMIC_ADD(&log_dropped_count, 1);
+            free(long_text);
+            return false;
+#else
+            ATOMIC_STORE_BOOL(&log_flush_requested, true);
+            THREAD_YIELD();
+#endif
+        }
+    }
+}
+
+#endif // ANSI_C_MEM_TRACK_ASYNC_LOG
+
+bool ansi_c_mem_track_log_write(const char* file_name, const char* format, ...) {
+    size_t output = log_output_open(file_name);
+    if (output == LOG_OUTPUT_COUNT) {
+        return false;
+    }
+
+    char buffer[LOG_RECORD_TEXT_SIZE];
+    size_t length;
+    va_list args;
+    va_start(args, format);
+    char* text = log_format(buffer, &length, format, args);
+    va_end(args);
+    if (!text) {
+        return false;
+    }
+    char* long_text = text != buffer ? text : NULL;
+
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG
+    if (log_start()) {
+        return log_enqueue(output, text, length, long_text);
+    }
+#endif
+    // A single write per record, so records of concurrent callers do not interleave
+    FILE* file = log_output_file(output);
+    fwrite(text, 1, length, file);
+    if (output != 0) {
+        fflush(file);
+    }
+    free(long_text);
+    return true;
+}
+
+void ansi_c_mem_track_log_flush(void) {
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG
+    if (ATOMIC_LOAD_BOOL(&log_running)) {
+        size_t position = ATOMIC_LOAD(&log_positions.enqueue_position);
+        while (ATOMIC_LOAD(&log_positions.written_position) < position) {
+            ATOMIC_STORE_BOOL(&log_flush_requested, true);
+            SLEEP_MS(1);
+        }
+        return;
+    }
+#endif
+    size_t count = ATOMIC_LOAD(&log_output_count);
+    for (size_t i = 0; i < count; ++i) {
+        fflush(log_output_file(i));
+    }
+}
+
+void ansi_c_mem_track_log_close(void) {
+    MUTEX_LOCK(&log_lock);
+#ifdef ANSI_C_MEM_TRACK_ASYNC_LOG
+    if (log_running) {
+        ATOMIC_STORE_BOOL(&log_running, false);
+        THREAD_JOIN(log_writer_thread);
+        free(log_queue);
+        log_queue = NULL;
+    }
+#endif
+    fflush(stdout);
+    for (size_t i = 1; i < log_output_count; ++i) {
+        fclose(log_outputs[i].file);
+        free(log_outputs[i].name);
+        log_outputs[i].file = NULL;
+        log_outputs[i].name = NULL;
+    }
+    ATOMIC_STORE(&log_output_count, 1);
+    MUTEX_UNLOCK(&log_lock);
+}
+
+size_t ansi_c_mem_track_log_dropped(void) {
+    return ATOMIC_LOAD(&log_dropped_count);
+}
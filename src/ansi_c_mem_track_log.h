@@ -0,0 +1,61 @@
+#ifndef ANSI_C_MEM_TRACK_LOG_H
+#define ANSI_C_MEM_TRACK_LOG_H
+
+/**
+ * @file ansi_c_mem_track_log.h
+ * @brief Log output of the memory tracker.
+ *
+ * The log files are opened once and stay open until `ansi_c_mem_track_log_close`. The records are formatted on
+ * the calling thread, without heap allocation unless they are longer than LOG_RECORD_TEXT_SIZE. With
+ * ANSI_C_MEM_TRACK_ASYNC_LOG the records are queued in a lock-free ring buffer and written in batches by a
+ * background thread, otherwise they are written at once.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @brief The number of records the queue of the asynchronous log holds, a power of two.
+ */
+#ifndef ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE
+#define ANSI_C_MEM_TRACK_LOG_QUEUE_SIZE 4096
+#endif
+
+/**
+ * @brief The time in milliseconds the writer thread of the asynchronous log waits for records between batches.
+ */
+#ifndef ANSI_C_MEM_TRACK_LOG_FLUSH_INTERVAL
+#define ANSI_C_MEM_TRACK_LOG_FLUSH_INTERVAL 50
+#endif
+
+/**
+ * @brief Records up to this size, including the terminating zero, are formatted without heap allocation.
+ */
+#define LOG_RECORD_TEXT_SIZE 512
+
+/**
+ * @brief The number of distinct outputs that can be open at once, the standard output included.
+ */
+#define LOG_OUTPUT_COUNT 16
+
+/**
+ * @brief Formats a record, prefixed with the current date and time, and writes it to the output.
+ *
+ * @param file_name The file to append the record to, or NULL for the standard output.
+ * @param format The printf format of the record.
+ * @return true if the record was written or queued, false if the file could not be opened, the record could not
+ * be formatted, or it was dropped because the queue was full.
+ */
+bool ansi_c_mem_track_log_write(const char* file_name, const char* format, ...);
+
+/**
+ * @brief Writes the pending records, stops the writer thread and closes the log files.
+ */
+void ansi_c_mem_track_log_close(void);
+
+/**
+ * @brief Returns the number of records dropped because the queue was full, see ANSI_C_MEM_TRACK_ASYNC_LOG_DROP.
+ */
+size_t ansi_c_mem_track_log_dropped(void);
+
+#endif // ANSI_C_MEM_TRACK_LOG_H
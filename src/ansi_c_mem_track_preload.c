@@ -0,0 +1,288 @@
+#if !defined(_MSC_VER) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ansi_c_mem_track_preload.h"
+#include "../include/ansi_c_mem_track.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_PRELOAD
+
+#if !defined(__GLIBC__)
+#error ANSI_C_MEM_TRACK_PRELOAD needs the GNU C library
+#endif
+
+// The thread cache build reads 32 bytes in front of every pointer it is given, more than glibc keeps readable
+// in front of its blocks
+#ifdef ANSI_C_MEM_TRACK_THREAD_CACHE
+#error ANSI_C_MEM_TRACK_PRELOAD cannot be combined with ANSI_C_MEM_TRACK_THREAD_CACHE
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <dlfcn.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static CallSiteDescriptor preload_malloc_call_site = { "(preload)", "malloc", "void*", 0, 0 };
+static CallSiteDescriptor preload_calloc_call_site = { "(preload)", "calloc", "void*", 0, 0 };
+static CallSiteDescriptor preload_realloc_call_site = { "(preload)", "realloc", "void*", 0, 0 };
+static CallSiteDescriptor preload_memalign_call_site = { "(preload)", "memalign", "void*", 0, 0 };
+
+/*
+ * The depth is nonzero while the calling thread runs the tracker, and the interposed functions then go straight to
+ * the C library. The initial-exec model makes it a single load relative to the thread pointer, which never
+ * allocates. The tracker is used only once the constructor has initialized it.
+ */
+static THREAD_LOCAL unsigned int preload_depth __attribute__((tls_model("initial-exec")));
+static bool preload_active = false;
+static volatile sig_atomic_t preload_report_requested = 0;
+static char preload_log_file_name[PRELOAD_FILE_NAME_SIZE] = PRELOAD_DEFAULT_LOG_FILE_NAME;
+static char preload_pprof_file_name[PRELOAD_FILE_NAME_SIZE] = "";
+static bool preload_log_blocks = false;
+static size_t (*real_malloc_usable_size)(void* ptr) = NULL;
+
+/**
+ * @brief Writes the usage information and the call site profile, and at exit the optional block list and heap
+ * profile. The caller must have raised the depth.
+ */
+static void preload_report(bool is_exit) {
+    MemoryUsageInfo info = ansi_c_mem_track_get_info();
+    ansi_c_mem_track_print_info(preload_log_file_name, &info);
+    ansi_c_mem_track_print_call_site_profile(preload_log_file_name, PRELOAD_PROFILE_ENTRIES,
+        CALL_SITE_PROFILE_BY_MEMORY_USAGE);
+    if (is_exit && preload_log_blocks) {
+        ansi_c_mem_track_log_blocks(preload_log_file_name, NULL);
+    }
+    if (is_exit && preload_pprof_file_name[0]) {
+        ansi_c_mem_track_export_pprof(preload_pprof_file_name);
+    }
+    ansi_c_mem_track_log_flush();
+}
+
+/**
+ * @brief Raises the depth of the calling thread before an interposed function calls the tracker, and writes the
+ * report a signal requested.
+ *
+ * @return false if the call has to go to the C library, because the tracker is not initialized or already runs on
+ * the thread.
+ */
+static bool preload_enter(void) {
+    if (preload_depth != 0 || !preload_active) {
+        return false;
+    }
+    preload_depth = 1;
+    if (preload_report_requested) {
+        preload_report_requested = 0;
+        preload_report(false);
+    }
+    return true;
+}
+
+static void preload_leave(void) {
+    preload_depth = 0;
+}
+
+static size_t preload_real_usable_size(void* ptr) {
+    if (!real_malloc_usable_size) {
+        // dlsym returns an object pointer, so it is copied into the function pointer
+        void* symbol = dlsym(RTLD_NEXT, "malloc_usable_size");
+        memcpy(&real_malloc_usable_size, &symbol, sizeof(symbol));
+    }
+    return real_malloc_usable_size ? real_malloc_usable_size(ptr) : 0;
+}
+
+static void preload_signal_handler(int signal_number) {
+    (void)signal_number;
+    preload_report_requested = 1;
+}
+
+/**
+ * @brief Copies an environment variable, if it is set, into a buffer, because the program may change its
+ * environment.
+ */
+static void preload_read_environment(const char* name, char* buffer) {
+    const char* value = getenv(name);
+    if (value && value[0] && strlen(value) < PRELOAD_FILE_NAME_SIZE) {
+        strcpy(buffer, value);
+    }
+}
+
+__attribute__((constructor)) static void preload_init(void) {
+    preload_depth = 1;
+    preload_read_environment("ANSI_C_MEM_TRACK_LOG", preload_log_file_name);
+    preload_read_environment("ANSI_C_MEM_TRACK_PPROF", preload_pprof_file_name);
+    const char* log_blocks = getenv("ANSI_C_MEM_TRACK_LOG_BLOCKS");
+    preload_log_blocks = log_blocks && strcmp(log_blocks, "1") == 0;
+    preload_real_usable_size(NULL);
+    bool initialized = ansi_c_mem_track_init();
+    const char* sampling_interval = getenv("ANSI_C_MEM_TRACK_SAMPLING_INTERVAL");
+    if (sampling_interval) {
+        ansi_c_mem_track_set_sampling_interval((size_t)strtoull(sampling_interval, NULL, 10));
+    }
+    const char* signal_number = getenv("ANSI_C_MEM_TRACK_SIGNAL");
+    if (initialized && signal_number && atoi(signal_number) > 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = preload_signal_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(atoi(signal_number), &action, NULL);
+    }
+    preload_active = initialized;
+    preload_depth = 0;
+}
+
+/**
+ * @brief Writes the report at exit. The tracker is not deinitialized, the destructors that run later may still
+ * free tracked blocks.
+ */
+__attribute__((destructor)) static void preload_exit(void) {
+    if (!preload_enter()) {
+        return;
+    }
+    preload_report(true);
+    preload_leave();
+}
+
+void* malloc(size_t size) {
+    if (!preload_enter()) {
+        return __libc_malloc(size);
+    }
+    // The tracker returns NULL for 0 bytes, malloc a unique pointer
+    void* ptr = ansi_c_mem_track_malloc_at(size ? size : 1, &preload_malloc_call_site, 0);
+    preload_leave();
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (!preload_enter()) {
+        __libc_free(ptr);
+        return;
+    }
+    // An untracked pointer is passed to free again by the tracker, and reaches the C library at this depth
+    ansi_c_mem_track_free(ptr);
+    preload_leave();
+}
+
+void* calloc(size_t count, size_t size) {
+    if (!preload_enter()) {
+        return __libc_calloc(count, size);
+    }
+    void* ptr = NULL;
+    if (size == 0 || count <= (size_t)-1 / size) {
+        size_t total = count * size;
+        ptr = ansi_c_mem_track_malloc_at(total ? total : 1, &preload_calloc_call_site, 0);
+        if (ptr) {
+            memset(ptr, 0, total);
+        }
+    }
+    preload_leave();
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!preload_enter()) {
+        return __libc_realloc(ptr, size);
+    }
+    void* new_ptr = NULL;
+    if (!ptr) {
+        new_ptr = ansi_c_mem_track_malloc_at(size ? size : 1, &preload_realloc_call_site, 0);
+    }
+    else if (size == 0) {
+        ansi_c_mem_track_free(ptr);
+        preload_leave();
+        return NULL;
+    }
+    else {
+        new_ptr = ansi_c_mem_track_realloc(ptr, size, 0);
+        // Only a failed realloc pays for telling an untracked block from a lack of memory
+        if (!new_ptr && ansi_c_mem_track_get_block_size(ptr) == 0) {
+            // The block was allocated by the C library, it moves into a tracked block
+            new_ptr = ansi_c_mem_track_malloc_at(size, &preload_realloc_call_site, 0);
+            if (new_ptr) {
+                size_t old_size = preload_real_usable_size(ptr);
+                memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+                __libc_free(ptr);
+            }
+        }
+    }
+    preload_leave();
+    if (!new_ptr) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+/**
+ * @brief Allocates an aligned block. The tracked blocks have the alignment of malloc, larger alignments are served
+ * by the C library untracked.
+ */
+static void* preload_aligned_alloc(size_t alignment, size_t size) {
+    if (alignment > PRELOAD_MALLOC_ALIGNMENT || !preload_enter()) {
+        return __libc_memalign(alignment, size);
+    }
+    void* ptr = ansi_c_mem_track_malloc_at(size ? size : 1, &preload_memalign_call_site, 0);
+    preload_leave();
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    int saved_errno = errno;
+    void* new_ptr = preload_aligned_alloc(alignment, size);
+    errno = saved_errno;
+    if (!new_ptr) {
+        return ENOMEM;
+    }
+    *ptr = new_ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_aligned_alloc(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return preload_aligned_alloc(alignment, size);
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (!preload_enter()) {
+        return preload_real_usable_size(ptr);
+    }
+    size_t size = ansi_c_mem_track_get_block_size(ptr);
+    preload_leave();
+    return size ? size : preload_real_usable_size(ptr);
+}
+
+#endif // ANSI_C_MEM_TRACK_PRELOAD
@@ -0,0 +1,47 @@
+#ifndef ANSI_C_MEM_TRACK_PRELOAD_H
+#define ANSI_C_MEM_TRACK_PRELOAD_H
+
+/**
+ * @file ansi_c_mem_track_preload.h
+ * @brief Interposes malloc, calloc, realloc, free, posix_memalign, aligned_alloc, memalign and malloc_usable_size
+ * of an unmodified program, used when ANSI_C_MEM_TRACK_PRELOAD is defined and the library is built as a shared
+ * library for LD_PRELOAD.
+ *
+ * The interposed functions call the tracker, and the tracker calls malloc and free for its own tables. A
+ * thread-local depth, raised while the tracker runs, sends these nested calls to the allocator of the C library
+ * through its __libc_ entry points, which also avoids resolving the next malloc with dlsym, which allocates
+ * itself. The allocations made before the constructor of the library has initialized the tracker go to the C
+ * library the same way. The tracker recognizes such pointers as untracked: free passes them to the C library, and
+ * realloc moves them into a tracked block. Alignments beyond those of malloc are served by the C library untracked.
+ *
+ * The usage information and the call site profile are written when the program exits, and on a signal if one is
+ * configured. The signal handler only sets a flag, and the report is written by the next call of an interposed
+ * function on any thread, because the tracker takes locks and allocates.
+ *
+ * The configuration is read from the environment when the library is loaded:
+ *
+ * ANSI_C_MEM_TRACK_LOG - The file the reports are appended to, the standard error by default.
+ * ANSI_C_MEM_TRACK_SIGNAL - The number of the signal that requests a report, none by default.
+ * ANSI_C_MEM_TRACK_LOG_BLOCKS - Set to 1 to list every block that is still allocated in the report at exit.
+ * ANSI_C_MEM_TRACK_PPROF - A file the heap profile is exported to at exit, see ansi_c_mem_track_export_pprof.
+ * ANSI_C_MEM_TRACK_SAMPLING_INTERVAL - The sampling interval in bytes in the sampling build.
+ */
+
+/**
+ * @brief The largest alignment of the tracked blocks, the alignment of the blocks of the glibc malloc.
+ */
+#define PRELOAD_MALLOC_ALIGNMENT (2 * sizeof(size_t))
+
+/**
+ * @brief The number of call sites in the call site profile of a report.
+ */
+#define PRELOAD_PROFILE_ENTRIES 20
+
+/**
+ * @brief The room for the file names read from the environment, including the terminating zero.
+ */
+#define PRELOAD_FILE_NAME_SIZE 1024
+
+#define PRELOAD_DEFAULT_LOG_FILE_NAME "/dev/stderr"
+
+#endif // ANSI_C_MEM_TRACK_PRELOAD_H
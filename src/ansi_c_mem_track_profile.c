@@ -0,0 +1,250 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "ansi_c_mem_track_profile.h"
+#include "../include/ansi_c_mem_track.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#define PROTO_WIRE_VARINT 0
+#define PROTO_WIRE_LENGTH 2
+
+// The fields of the messages of profile.proto that are written
+#define PPROF_PROFILE_SAMPLE_TYPE 1
+#define PPROF_PROFILE_SAMPLE 2
+#define PPROF_PROFILE_LOCATION 4
+#define PPROF_PROFILE_FUNCTION 5
+#define PPROF_PROFILE_STRING_TABLE 6
+#define PPROF_PROFILE_TIME_NANOS 9
+#define PPROF_PROFILE_PERIOD_TYPE 11
+#define PPROF_PROFILE_PERIOD 12
+#define PPROF_PROFILE_DEFAULT_SAMPLE_TYPE 14
+#define PPROF_VALUE_TYPE_TYPE 1
+#define PPROF_VALUE_TYPE_UNIT 2
+#define PPROF_SAMPLE_LOCATION_ID 1
+#define PPROF_SAMPLE_VALUE 2
+#define PPROF_SAMPLE_LABEL 3
+#define PPROF_LABEL_KEY 1
+#define PPROF_LABEL_STR 2
+#define PPROF_LOCATION_ID 1
+#define PPROF_LOCATION_LINE 4
+#define PPROF_LINE_FUNCTION_ID 1
+#define PPROF_LINE_LINE 2
+#define PPROF_FUNCTION_ID 1
+#define PPROF_FUNCTION_NAME 2
+#define PPROF_FUNCTION_SYSTEM_NAME 3
+#define PPROF_FUNCTION_FILENAME 4
+
+/**
+ * @brief The strings written at the start of the string table, in the order of their indices.
+ */
+static const char* const pprof_fixed_strings[] = {
+    "", "alloc_objects", "count", "alloc_space", "bytes", "inuse_objects", "inuse_space", "type", "space"
+};
+#define PPROF_STRING_ALLOC_OBJECTS 1
+#define PPROF_STRING_COUNT 2
+#define PPROF_STRING_ALLOC_SPACE 3
+#define PPROF_STRING_BYTES 4
+#define PPROF_STRING_INUSE_OBJECTS 5
+#define PPROF_STRING_INUSE_SPACE 6
+#define PPROF_STRING_TYPE 7
+#define PPROF_STRING_SPACE 8
+
+/**
+ * @brief The largest encoded message besides the strings: a key, a length and up to 8 varints with keys.
+ */
+#define PROTO_MESSAGE_SIZE 128
+
+/**
+ * @brief Encodes a varint.
+ *
+ * @return The number of bytes written, at most 10.
+ */
+static size_t proto_varint(unsigned char* buffer, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (unsigned char)value;
+    return length;
+}
+
+/**
+ * @brief Encodes the key of a field.
+ */
+static size_t proto_key(unsigned char* buffer, unsigned int field, unsigned int wire_type) {
+    return proto_varint(buffer, ((uint64_t)field << 3) | wire_type);
+}
+
+/**
+ * @brief Encodes a varint field.
+ */
+static size_t proto_uint(unsigned char* buffer, unsigned int field, uint64_t value) {
+    size_t length = proto_key(buffer, field, PROTO_WIRE_VARINT);
+    return length + proto_varint(buffer + length, value);
+}
+
+/**
+ * @brief Encodes a field with an embedded message or packed values that are already encoded.
+ */
+static size_t proto_bytes(unsigned char* buffer, unsigned int field, const unsigned char* bytes, size_t size) {
+    size_t length = proto_key(buffer, field, PROTO_WIRE_LENGTH);
+    length += proto_varint(buffer + length, size);
+    memcpy(buffer + length, bytes, size);
+    return length + size;
+}
+
+/**
+ * @brief Appends a string to the string table of a pprof profile.
+ *
+ * @param count The number of strings in the table, incremented.
+ * @return The index of the string.
+ */
+static uint64_t pprof_string(FILE* file, const char* text, uint64_t* count) {
+    unsigned char buffer[PROTO_MESSAGE_SIZE];
+    size_t size = strlen(text);
+    size_t length = proto_key(buffer, PPROF_PROFILE_STRING_TABLE, PROTO_WIRE_LENGTH);
+    length += proto_varint(buffer + length, size);
+    fwrite(buffer, 1, length, file);
+    fwrite(text, 1, size, file);
+    return (*count)++;
+}
+
+/**
+ * @brief Writes a ValueType message field.
+ */
+static void pprof_value_type(FILE* file, unsigned int field, uint64_t type, uint64_t unit) {
+    unsigned char message[PROTO_MESSAGE_SIZE];
+    unsigned char buffer[PROTO_MESSAGE_SIZE];
+    size_t length = proto_uint(message, PPROF_VALUE_TYPE_TYPE, type);
+    length += proto_uint(message + length, PPROF_VALUE_TYPE_UNIT, unit);
+    fwrite(buffer, 1, proto_bytes(buffer, field, message, length), file);
+}
+
+/**
+ * @brief Returns the text, or the fallback if the text is NULL or empty.
+ */
+static const char* profile_name(const char* text, const char* fallback) {
+    return text && *text ? text : fallback;
+}
+
+/**
+ * @brief Writes the function, the location and the sample of one call site to a pprof profile. Both the function
+ * and the location take the ID of the call site plus one, because 0 is not a valid ID in pprof.
+ */
+static void pprof_call_site(FILE* file, size_t call_site_id, const CallSite* call_site, const CallSiteUsageInfo* usage,
+    uint64_t* string_count) {
+    unsigned char message[PROTO_MESSAGE_SIZE];
+    unsigned char inner[PROTO_MESSAGE_SIZE];
+    unsigned char buffer[PROTO_MESSAGE_SIZE];
+    uint64_t id = (uint64_t)call_site_id + 1;
+    uint64_t name = pprof_string(file, profile_name(call_site->comment, "(unknown)"), string_count);
+    uint64_t file_name = pprof_string(file, profile_name(call_site->file_name, "(unknown)"), string_count);
+    uint64_t type = pprof_string(file, profile_name(call_site->type, ""), string_count);
+
+    size_t length = proto_uint(message, PPROF_FUNCTION_ID, id);
+    length += proto_uint(message + length, PPROF_FUNCTION_NAME, name);
+    length += proto_uint(message + length, PPROF_FUNCTION_SYSTEM_NAME, name);
+    length += proto_uint(message + length, PPROF_FUNCTION_FILENAME, file_name);
+    fwrite(buffer, 1, proto_bytes(buffer, PPROF_PROFILE_FUNCTION, message, length), file);
+
+    size_t inner_length = proto_uint(inner, PPROF_LINE_FUNCTION_ID, id);
+    inner_length += proto_uint(inner + inner_length, PPROF_LINE_LINE, call_site->line);
+    length = proto_uint(message, PPROF_LOCATION_ID, id);
+    length += proto_bytes(message + length, PPROF_LOCATION_LINE, inner, inner_length);
+    fwrite(buffer, 1, proto_bytes(buffer, PPROF_PROFILE_LOCATION, message, length), file);
+
+    // The values are packed, in the order of the sample types
+    length = proto_varint(inner, id);
+    size_t value_length = proto_bytes(message, PPROF_SAMPLE_LOCATION_ID, inner, length);
+    inner_length = proto_varint(inner, usage->total_size);
+    inner_length += proto_varint(inner + inner_length, usage->total_memory_usage);
+    inner_length += proto_varint(inner + inner_length, usage->size);
+    inner_length += proto_varint(inner + inner_length, usage->memory_usage);
+    value_length += proto_bytes(message + value_length, PPROF_SAMPLE_VALUE, inner, inner_length);
+    inner_length = proto_uint(inner, PPROF_LABEL_KEY, PPROF_STRING_TYPE);
+    inner_length += proto_uint(inner + inner_length, PPROF_LABEL_STR, type);
+    value_length += proto_bytes(message + value_length, PPROF_SAMPLE_LABEL, inner, inner_length);
+    fwrite(buffer, 1, proto_bytes(buffer, PPROF_PROFILE_SAMPLE, message, value_length), file);
+}
+
+bool ansi_c_mem_track_profile_write_pprof(FILE* file) {
+    unsigned char buffer[PROTO_MESSAGE_SIZE];
+    uint64_t string_count = 0;
+    for (size_t i = 0; i < sizeof(pprof_fixed_strings) / sizeof(pprof_fixed_strings[0]); ++i) {
+        pprof_string(file, pprof_fixed_strings[i], &string_count);
+    }
+    pprof_value_type(file, PPROF_PROFILE_SAMPLE_TYPE, PPROF_STRING_ALLOC_OBJECTS, PPROF_STRING_COUNT);
+    pprof_value_type(file, PPROF_PROFILE_SAMPLE_TYPE, PPROF_STRING_ALLOC_SPACE, PPROF_STRING_BYTES);
+    pprof_value_type(file, PPROF_PROFILE_SAMPLE_TYPE, PPROF_STRING_INUSE_OBJECTS, PPROF_STRING_COUNT);
+    pprof_value_type(file, PPROF_PROFILE_SAMPLE_TYPE, PPROF_STRING_INUSE_SPACE, PPROF_STRING_BYTES);
+    pprof_value_type(file, PPROF_PROFILE_PERIOD_TYPE, PPROF_STRING_SPACE, PPROF_STRING_BYTES);
+    size_t length = proto_uint(buffer, PPROF_PROFILE_PERIOD, 1);
+    length += proto_uint(buffer + length, PPROF_PROFILE_DEFAULT_SAMPLE_TYPE, PPROF_STRING_INUSE_SPACE);
+    length += proto_uint(buffer + length, PPROF_PROFILE_TIME_NANOS, (uint64_t)time(NULL) * 1000000000u);
+    fwrite(buffer, 1, length, file);
+
+    // The string table is a repeated field, so the strings of the call sites can follow in between the messages
+    const CallSite* call_site;
+    for (size_t id = 0; (call_site = ansi_c_mem_track_get_call_site(id)) != NULL; ++id) {
+        CallSiteUsageInfo usage = ansi_c_mem_track_get_call_site_info(id);
+        if (usage.total_size != 0) {
+            pprof_call_site(file, id, call_site, &usage, &string_count);
+        }
+    }
+    return !ferror(file);
+}
+
+/**
+ * @brief Writes a frame of a folded stack. The separators of the format are replaced: semicolons by colons and
+ * line breaks and tabs by spaces.
+ */
+static void folded_frame(FILE* file, const char* text) {
+    for (; *text; ++text) {
+        if (*text == ';') {
+            fputc(':', file);
+        }
+        else if (*text == '\n' || *text == '\r' || *text == '\t') {
+            fputc(' ', file);
+        }
+        else {
+            fputc(*text, file);
+        }
+    }
+}
+
+bool ansi_c_mem_track_profile_write_folded(FILE* file, CallSiteProfileOrder value) {
+    const CallSite* call_site;
+    for (size_t id = 0; (call_site = ansi_c_mem_track_get_call_site(id)) != NULL; ++id) {
+        CallSiteUsageInfo usage = ansi_c_mem_track_get_call_site_info(id);
+        size_t count = usage.memory_usage;
+        if (value == CALL_SITE_PROFILE_BY_SIZE) {
+            count = usage.size;
+        }
+        else if (value == CALL_SITE_PROFILE_BY_TOTAL_MEMORY_USAGE) {
+            count = usage.total_memory_usage;
+        }
+        else if (value == CALL_SITE_PROFILE_BY_TOTAL_SIZE) {
+            count = usage.total_size;
+        }
+        if (count == 0) {
+            continue;
+        }
+        folded_frame(file, profile_name(call_site->file_name, "(unknown)"));
+        if (call_site->line) {
+            fprintf(file, ":%u", call_site->line);
+        }
+        fputc(';', file);
+        folded_frame(file, profile_name(call_site->comment, "(unknown)"));
+        fputc(';', file);
+        folded_frame(file, profile_name(call_site->type, "(unknown)"));
+        fprintf(file, " %lu\n", (unsigned long)count);
+    }
+    return !ferror(file);
+}
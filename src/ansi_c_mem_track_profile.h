@@ -0,0 +1,43 @@
+#ifndef ANSI_C_MEM_TRACK_PROFILE_H
+#define ANSI_C_MEM_TRACK_PROFILE_H
+
+/**
+ * @file ansi_c_mem_track_profile.h
+ * @brief Export of the call site usage as a heap profile for external tools.
+ *
+ * The profiles are written from the usage the tracker aggregates per call site, in one pass over the call sites
+ * through the buffer of the output file; the memory blocks are not visited. In a pprof profile a call site is a
+ * location in the function named by its comment, at its file and line. In a folded profile the file and line, the
+ * comment and the type of a call site are the frames of its stack, from the root to the leaf.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "../include/ansi_c_mem_track.h"
+
+/**
+ * @brief The size of the output buffer of the profile writers.
+ */
+#define PROFILE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief Writes a profile in the protocol buffer format of pprof, uncompressed. The samples have the values
+ * alloc_objects, alloc_space, inuse_objects and inuse_space, like the heap profiles of Go, and inuse_space is
+ * the default. The type of a call site is the label "type" of its sample.
+ *
+ * @param file The output file, opened in binary mode.
+ * @return true if the profile was written, false otherwise.
+ */
+bool ansi_c_mem_track_profile_write_pprof(FILE* file);
+
+/**
+ * @brief Writes a profile in the folded stack format of the flame graph tools: one line per call site, with the
+ * frames separated by semicolons and followed by the value. Call sites whose value is zero are left out.
+ *
+ * @param file The output file.
+ * @param value The column of the call site usage to write as the value.
+ * @return true if the profile was written, false otherwise.
+ */
+bool ansi_c_mem_track_profile_write_folded(FILE* file, CallSiteProfileOrder value);
+
+#endif // ANSI_C_MEM_TRACK_PROFILE_H
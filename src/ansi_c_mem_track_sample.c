@@ -0,0 +1,78 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "ansi_c_mem_track_sample.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_SAMPLING
+
+static size_t sample_interval = ANSI_C_MEM_TRACK_SAMPLING_INTERVAL;
+
+/**
+ * @brief The bytes the calling thread may still allocate before the next sample, 0 before its first distance.
+ */
+static THREAD_LOCAL size_t sample_bytes_left = 0;
+static THREAD_LOCAL uint64_t sample_random = 0;
+
+/**
+ * @brief Draws the number of bytes until the next sample from an exponential distribution.
+ */
+static size_t sample_distance(size_t interval) {
+    if (sample_random == 0) {
+        // The address of the thread-local state differs between threads, so do their sequences
+        sample_random = (uint64_t)(uintptr_t)&sample_random ^ 0x9E3779B97F4A7C15ULL;
+    }
+    sample_random = sample_random * 6364136223846793005ULL + 1442695040888963407ULL;
+    // The upper 53 bits give a uniform value in (0, 1], whose logarithm is finite
+    double uniform = (double)((sample_random >> 11) + 1) / 9007199254740992.0;
+    double distance = -log(uniform) * (double)interval;
+    if (distance < 1.0) {
+        return 1;
+    }
+    return distance < (double)(SIZE_MAX / 2) ? (size_t)distance : SIZE_MAX / 2;
+}
+
+void ansi_c_mem_track_sample_set_interval(size_t interval) {
+    ATOMIC_STORE(&sample_interval, interval);
+}
+
+size_t ansi_c_mem_track_sample_get_interval(void) {
+    return ATOMIC_LOAD(&sample_interval);
+}
+
+bool ansi_c_mem_track_sample_take(size_t size) {
+    size_t interval = ATOMIC_LOAD(&sample_interval);
+    if (interval == 0) {
+        return true;
+    }
+    if (size < sample_bytes_left) {
+        sample_bytes_left -= size;
+        return false;
+    }
+    if (sample_bytes_left == 0) {
+        // The first allocation of the thread starts its countdown instead of being sampled for sure
+        sample_bytes_left = sample_distance(interval);
+        if (size < sample_bytes_left) {
+            sample_bytes_left -= size;
+            return false;
+        }
+    }
+    sample_bytes_left = sample_distance(interval);
+    return true;
+}
+
+size_t ansi_c_mem_track_sample_estimate(size_t size) {
+    size_t interval = ATOMIC_LOAD(&sample_interval);
+    if (interval == 0 || size == 0) {
+        return size;
+    }
+    double probability = 1.0 - exp(-(double)size / (double)interval);
+    double estimate = (double)size / probability;
+    return estimate < (double)SIZE_MAX ? (size_t)(estimate + 0.5) : SIZE_MAX;
+}
+
+#endif // ANSI_C_MEM_TRACK_SAMPLING
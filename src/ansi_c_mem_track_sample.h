@@ -0,0 +1,48 @@
+#ifndef ANSI_C_MEM_TRACK_SAMPLE_H
+#define ANSI_C_MEM_TRACK_SAMPLE_H
+
+/**
+ * @file ansi_c_mem_track_sample.h
+ * @brief Byte-weighted sampling of the allocations, used when ANSI_C_MEM_TRACK_SAMPLING is defined.
+ *
+ * Every thread counts the bytes it allocates down from a distance drawn from an exponential distribution whose
+ * mean is the sampling interval, and the allocation that reaches zero is sampled. An allocation of `size` bytes
+ * is therefore sampled with the probability 1 - exp(-size / interval), independently of the allocations before
+ * it, so large blocks are sampled almost always and a sampled block stands for 1 / probability blocks of its size.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @brief The mean number of bytes allocated between two sampled allocations when the tracker starts.
+ */
+#ifndef ANSI_C_MEM_TRACK_SAMPLING_INTERVAL
+#define ANSI_C_MEM_TRACK_SAMPLING_INTERVAL (512 * 1024)
+#endif
+
+/**
+ * @brief Sets the sampling interval. 0 samples every allocation. A thread picks up a new nonzero interval when it
+ * draws its next distance.
+ */
+void ansi_c_mem_track_sample_set_interval(size_t interval);
+
+/**
+ * @brief Returns the sampling interval, 0 if every allocation is sampled.
+ */
+size_t ansi_c_mem_track_sample_get_interval(void);
+
+/**
+ * @brief Counts an allocation of the calling thread and decides whether it is sampled.
+ *
+ * @param size The number of bytes allocated.
+ * @return true if the allocation is sampled.
+ */
+bool ansi_c_mem_track_sample_take(size_t size);
+
+/**
+ * @brief Returns the number of bytes a sampled block of `size` bytes stands for at the current interval.
+ */
+size_t ansi_c_mem_track_sample_estimate(size_t size);
+
+#endif // ANSI_C_MEM_TRACK_SAMPLE_H
@@ -0,0 +1,203 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "ansi_c_mem_track_slab.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_SLAB
+
+#define SLAB_CLASS_COUNT 12
+
+typedef struct Slab Slab;
+
+/**
+ * @brief Header at the start of every slab.
+ */
+struct Slab {
+    size_t class_index; /**< The size class of the blocks in the slab. */
+    size_t used;        /**< Number of allocated blocks. */
+    size_t capacity;    /**< Number of blocks that fit in the slab. */
+    void* free_list;    /**< Freed blocks, linked through their first bytes. */
+    char* unused;       /**< The first block that was never allocated, the blocks behind it were not allocated either. */
+    Slab* prev;         /**< The previous slab in the list of slabs with free blocks of the size class. */
+    Slab* next;         /**< The next slab in the list of slabs with free blocks of the size class. */
+};
+
+/**
+ * @brief The blocks start at a multiple of 64 bytes, so every block keeps the alignment of its size class.
+ */
+#define SLAB_HEADER_SIZE ((sizeof(Slab) + 63) & ~(size_t)63)
+
+/**
+ * @brief Size class of the slab backend.
+ */
+typedef struct {
+    MUTEX_TYPE lock;   /**< Protects the size class and its slabs. */
+    size_t block_size; /**< The size of the blocks. */
+    Slab* available;   /**< Slabs with free blocks. Full slabs are not linked anywhere until a block is freed. */
+    size_t slab_count; /**< Number of slabs of the size class. */
+    size_t empty_count; /**< Number of slabs without allocated blocks, at most one stays cached. */
+} SlabClass;
+
+static SlabClass slab_classes[SLAB_CLASS_COUNT] = {
+    { MUTEX_STATIC_INIT, 16, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 32, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 48, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 64, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 80, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 96, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 112, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 128, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 160, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 192, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 224, NULL, 0, 0 },
+    { MUTEX_STATIC_INIT, 256, NULL, 0, 0 }
+};
+
+/**
+ * @brief Returns the smallest size class that fits the size: steps of 16 bytes up to 128, then steps of 32 bytes.
+ */
+static size_t slab_class_index(size_t size) {
+    if (size <= 16) {
+        return 0;
+    }
+    if (size <= 128) {
+        return (size - 1) / 16;
+    }
+    return (size - 1) / 32 + 4;
+}
+
+static Slab* slab_of(const void* address) {
+    return (Slab*)((uintptr_t)address & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void slab_link(SlabClass* slab_class, Slab* slab) {
+    slab->prev = NULL;
+    slab->next = slab_class->available;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    slab_class->available = slab;
+}
+
+static void slab_unlink(SlabClass* slab_class, Slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        slab_class->available = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * @brief Allocates an empty slab for the size class and links it. The caller must hold the lock of the size class.
+ */
+static Slab* slab_create(SlabClass* slab_class) {
+    void* memory = NULL;
+    ALIGNED_MALLOC(memory, SLAB_SIZE, SLAB_SIZE);
+    if (!memory) {
+        return NULL;
+    }
+    Slab* slab = (Slab*)memory;
+    slab->class_index = (size_t)(slab_class - slab_classes);
+    slab->used = 0;
+    slab->capacity = (SLAB_SIZE - SLAB_HEADER_SIZE) / slab_class->block_size;
+    slab->free_list = NULL;
+    slab->unused = (char*)memory + SLAB_HEADER_SIZE;
+    slab_link(slab_class, slab);
+    slab_class->slab_count++;
+    slab_class->empty_count++;
+    return slab;
+}
+
+void* ansi_c_mem_track_slab_alloc(size_t size) {
+    if (size > SLAB_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+    SlabClass* slab_class = &slab_classes[slab_class_index(size)];
+    MUTEX_LOCK(&slab_class->lock);
+    Slab* slab = slab_class->available;
+    if (!slab) {
+        slab = slab_create(slab_class);
+        if (!slab) {
+            MUTEX_UNLOCK(&slab_class->lock);
+            return NULL;
+        }
+    }
+
+    // Freed blocks are reused first, so the untouched end of the slab stays untouched as long as possible
+    void* block = slab->free_list;
+    if (block) {
+        slab->free_list = *(void**)block;
+    }
+    else {
+        block = slab->unused;
+        slab->unused += slab_class->block_size;
+    }
+    if (slab->used++ == 0) {
+        slab_class->empty_count--;
+    }
+    if (slab->used == slab->capacity) {
+        slab_unlink(slab_class, slab);
+    }
+    MUTEX_UNLOCK(&slab_class->lock);
+    return block;
+}
+
+void ansi_c_mem_track_slab_free(void* address) {
+    Slab* slab = slab_of(address);
+    SlabClass* slab_class = &slab_classes[slab->class_index];
+    MUTEX_LOCK(&slab_class->lock);
+    *(void**)address = slab->free_list;
+    slab->free_list = address;
+    if (slab->used-- == slab->capacity) {
+        slab_link(slab_class, slab);
+    }
+    if (slab->used == 0) {
+        // One empty slab is kept, so a size class that oscillates around a slab boundary does not thrash
+        if (slab_class->empty_count > 0) {
+            slab_unlink(slab_class, slab);
+            slab_class->slab_count--;
+            ALIGNED_FREE(slab);
+        }
+        else {
+            slab_class->empty_count++;
+        }
+    }
+    MUTEX_UNLOCK(&slab_class->lock);
+}
+
+size_t ansi_c_mem_track_slab_block_size(const void* address) {
+    return slab_classes[slab_of(address)->class_index].block_size;
+}
+
+size_t ansi_c_mem_track_slab_class_size(size_t size) {
+    return size <= SLAB_MAX_BLOCK_SIZE ? slab_classes[slab_class_index(size)].block_size : 0;
+}
+
+SlabInfo ansi_c_mem_track_slab_get_info(void) {
+    SlabInfo info = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        SlabClass* slab_class = &slab_classes[i];
+        MUTEX_LOCK(&slab_class->lock);
+        info.slab_count += slab_class->slab_count;
+        for (const Slab* slab = slab_class->available; slab; slab = slab->next) {
+            if (slab->used > 0) {
+                info.partial_slab_count++;
+            }
+            info.slab_free_memory += (slab->capacity - slab->used) * slab_class->block_size;
+        }
+        MUTEX_UNLOCK(&slab_class->lock);
+    }
+    info.slab_memory = info.slab_count * SLAB_SIZE;
+    return info;
+}
+
+#endif // ANSI_C_MEM_TRACK_SLAB
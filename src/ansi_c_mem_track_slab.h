@@ -0,0 +1,60 @@
+#ifndef ANSI_C_MEM_TRACK_SLAB_H
+#define ANSI_C_MEM_TRACK_SLAB_H
+
+/**
+ * @file ansi_c_mem_track_slab.h
+ * @brief Size-class slab backend of the memory tracker, used when ANSI_C_MEM_TRACK_SLAB is defined.
+ *
+ * Small memory blocks are cut from slabs, aligned chunks of SLAB_SIZE bytes that hold blocks of a single size
+ * class. The slab of a block is found by masking its address, so a block needs no metadata of its own, and a
+ * freed block goes back to the free list of its slab.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define SLAB_SIZE 65536
+#define SLAB_MAX_BLOCK_SIZE 256
+
+/**
+ * @brief Statistics of the slab backend.
+ */
+typedef struct {
+    size_t slab_count; /**< Number of slabs. */
+    size_t partial_slab_count; /**< Number of slabs with both allocated and free blocks. */
+    size_t slab_memory; /**< Memory reserved by the slabs. */
+    size_t slab_free_memory; /**< Memory of the free blocks in the slabs. */
+} SlabInfo;
+
+/**
+ * @brief Allocates a block from the slab of the smallest size class that fits.
+ *
+ * @param size The size of the block, at most SLAB_MAX_BLOCK_SIZE.
+ * @return The block, or NULL if a new slab could not be allocated.
+ */
+void* ansi_c_mem_track_slab_alloc(size_t size);
+
+/**
+ * @brief Returns a block to its slab. A slab that becomes empty is released, unless it is the only empty slab of
+ * its size class.
+ *
+ * @param address A block returned by `ansi_c_mem_track_slab_alloc`.
+ */
+void ansi_c_mem_track_slab_free(void* address);
+
+/**
+ * @brief Returns the usable size of a block, which is the size of its size class.
+ */
+size_t ansi_c_mem_track_slab_block_size(const void* address);
+
+/**
+ * @brief Returns the block size of the size class that serves the given size, or 0 if the size is too large.
+ */
+size_t ansi_c_mem_track_slab_class_size(size_t size);
+
+/**
+ * @brief Collects the statistics of all size classes.
+ */
+SlabInfo ansi_c_mem_track_slab_get_info(void);
+
+#endif // ANSI_C_MEM_TRACK_SLAB_H
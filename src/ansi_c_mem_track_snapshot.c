@@ -0,0 +1,285 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ansi_c_mem_track_snapshot.h"
+#include "ansi_c_mem_track_log.h"
+#include "../include/ansi_c_mem_track.h"
+#include "../include/ansi_c_macro_utils.h"
+
+/**
+ * @brief The state of `ansi_c_mem_track_take_snapshot` while it visits the blocks.
+ */
+typedef struct {
+    HeapSnapshot* snapshot; /**< The snapshot being taken. */
+    size_t capacity;        /**< Number of blocks `snapshot->blocks` has room for. */
+    bool is_failed;         /**< An allocation failed. */
+} SnapshotBuilder;
+
+/**
+ * @brief Appends a block to the snapshot. Runs under the lock of the shard of the block, so the array grows with
+ * the system realloc.
+ */
+static bool snapshot_add_block(const MemoryBlock* block, void* context) {
+    SnapshotBuilder* builder = (SnapshotBuilder*)context;
+    HeapSnapshot* snapshot = builder->snapshot;
+    if (snapshot->block_count == builder->capacity) {
+        size_t capacity = builder->capacity * 2;
+        HeapSnapshotBlock* blocks = (HeapSnapshotBlock*)realloc(snapshot->blocks, capacity * sizeof(HeapSnapshotBlock));
+        if (!blocks) {
+            builder->is_failed = true;
+            return false;
+        }
+        snapshot->blocks = blocks;
+        builder->capacity = capacity;
+    }
+    HeapSnapshotBlock* entry = &snapshot->blocks[snapshot->block_count++];
+    entry->address = block->address;
+    entry->size = block->size;
+    entry->call_site_id = block->call_site_id;
+    entry->estimated_size = ansi_c_mem_track_get_estimated_size(block);
+    snapshot->memory_usage += entry->estimated_size;
+    return true;
+}
+
+/**
+ * @brief Returns the number of blocks a snapshot block stands for, more than 1 only for a sampled block.
+ */
+static size_t snapshot_block_count(const HeapSnapshotBlock* block) {
+    if (block->size == 0 || block->estimated_size <= block->size) {
+        return 1;
+    }
+    return (block->estimated_size + block->size / 2) / block->size;
+}
+
+/**
+ * @brief Sorts the blocks by address with a least significant digit radix sort.
+ *
+ * @return false if an allocation failed.
+ */
+static bool snapshot_sort(HeapSnapshotBlock* blocks, size_t count) {
+    if (count < 2) {
+        return true;
+    }
+    HeapSnapshotBlock* buffer = (HeapSnapshotBlock*)malloc(count * sizeof(HeapSnapshotBlock));
+    size_t* counts = (size_t*)calloc(SNAPSHOT_RADIX_DIGITS * SNAPSHOT_RADIX_SIZE, sizeof(size_t));
+    if (!buffer || !counts) {
+        free(buffer);
+        free(counts);
+        return false;
+    }
+    // The counts of all digits are taken in one pass
+    for (size_t i = 0; i < count; ++i) {
+        uintptr_t key = (uintptr_t)blocks[i].address;
+        for (size_t digit = 0; digit < SNAPSHOT_RADIX_DIGITS; ++digit) {
+            ++counts[digit * SNAPSHOT_RADIX_SIZE + ((key >> (digit * SNAPSHOT_RADIX_BITS)) & (SNAPSHOT_RADIX_SIZE - 1))];
+        }
+    }
+    HeapSnapshotBlock* source = blocks;
+    HeapSnapshotBlock* target = buffer;
+    for (size_t digit = 0; digit < SNAPSHOT_RADIX_DIGITS; ++digit) {
+        size_t* digit_counts = &counts[digit * SNAPSHOT_RADIX_SIZE];
+        size_t shift = digit * SNAPSHOT_RADIX_BITS;
+        // A digit that all addresses share would not move any block
+        if (digit_counts[((uintptr_t)source[0].address >> shift) & (SNAPSHOT_RADIX_SIZE - 1)] == count) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t value = 0; value < SNAPSHOT_RADIX_SIZE; ++value) {
+            size_t value_count = digit_counts[value];
+            digit_counts[value] = offset;
+            offset += value_count;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            target[digit_counts[((uintptr_t)source[i].address >> shift) & (SNAPSHOT_RADIX_SIZE - 1)]++] = source[i];
+        }
+        HeapSnapshotBlock* sorted = target;
+        target = source;
+        source = sorted;
+    }
+    if (source != blocks) {
+        memcpy(blocks, source, count * sizeof(HeapSnapshotBlock));
+    }
+    free(buffer);
+    free(counts);
+    return true;
+}
+
+bool ansi_c_mem_track_take_snapshot(HeapSnapshot* snapshot, const BlockFilter* filter) {
+    snapshot->block_count = 0;
+    snapshot->memory_usage = 0;
+    SnapshotBuilder builder;
+    builder.snapshot = snapshot;
+    builder.capacity = ansi_c_mem_track_get_info().size + SNAPSHOT_CAPACITY_SLACK;
+    builder.is_failed = false;
+    snapshot->blocks = (HeapSnapshotBlock*)malloc(builder.capacity * sizeof(HeapSnapshotBlock));
+    if (!snapshot->blocks) {
+        return false;
+    }
+    ansi_c_mem_track_visit_blocks(filter, snapshot_add_block, &builder);
+    if (builder.is_failed || !snapshot_sort(snapshot->blocks, snapshot->block_count)) {
+        ansi_c_mem_track_free_snapshot(snapshot);
+        return false;
+    }
+    return true;
+}
+
+void ansi_c_mem_track_free_snapshot(HeapSnapshot* snapshot) {
+    free(snapshot->blocks);
+    snapshot->blocks = NULL;
+    snapshot->block_count = 0;
+    snapshot->memory_usage = 0;
+}
+
+/**
+ * @brief Returns the growth of the memory usage of a call site, negative if it shrank.
+ */
+static long call_site_growth(const CallSiteGrowth* growth) {
+    return (long)(growth->after_memory_usage - growth->before_memory_usage);
+}
+
+/**
+ * @brief Orders the call sites of a difference by their growth, the largest first, then by their ID.
+ */
+static int call_site_growth_compare(const void* a, const void* b) {
+    const CallSiteGrowth* growth_a = (const CallSiteGrowth*)a;
+    const CallSiteGrowth* growth_b = (const CallSiteGrowth*)b;
+    long key_a = call_site_growth(growth_a);
+    long key_b = call_site_growth(growth_b);
+    if (key_a != key_b) {
+        return key_a > key_b ? -1 : 1;
+    }
+    return growth_a->call_site_id < growth_b->call_site_id ? -1 : growth_a->call_site_id > growth_b->call_site_id;
+}
+
+bool ansi_c_mem_track_diff_snapshots(const HeapSnapshot* before, const HeapSnapshot* after, HeapSnapshotDiff* diff) {
+    memset(diff, 0, sizeof(HeapSnapshotDiff));
+    size_t call_site_limit = 0;
+    for (size_t i = 0; i < before->block_count; ++i) {
+        if (before->blocks[i].call_site_id >= call_site_limit) {
+            call_site_limit = before->blocks[i].call_site_id + 1;
+        }
+    }
+    for (size_t i = 0; i < after->block_count; ++i) {
+        if (after->blocks[i].call_site_id >= call_site_limit) {
+            call_site_limit = after->blocks[i].call_site_id + 1;
+        }
+    }
+    // The call site IDs are dense, so the call sites are summed in a table indexed by the ID
+    CallSiteGrowth* call_sites = (CallSiteGrowth*)calloc(call_site_limit ? call_site_limit : 1, sizeof(CallSiteGrowth));
+    HeapSnapshotBlock* new_blocks = (HeapSnapshotBlock*)malloc((after->block_count ? after->block_count : 1) * sizeof(HeapSnapshotBlock));
+    if (!call_sites || !new_blocks) {
+        free(call_sites);
+        free(new_blocks);
+        return false;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before->block_count || j < after->block_count) {
+        const HeapSnapshotBlock* old_block = i < before->block_count ? &before->blocks[i] : NULL;
+        const HeapSnapshotBlock* new_block = j < after->block_count ? &after->blocks[j] : NULL;
+        if (old_block && new_block && old_block->address == new_block->address) {
+            if (old_block->size == new_block->size && old_block->call_site_id == new_block->call_site_id) {
+                // The block is in both snapshots
+                old_block = NULL;
+                new_block = NULL;
+            }
+            ++i;
+            ++j;
+        }
+        else if (!new_block || (old_block && (uintptr_t)old_block->address < (uintptr_t)new_block->address)) {
+            new_block = NULL;
+            ++i;
+        }
+        else {
+            old_block = NULL;
+            ++j;
+        }
+        if (old_block) {
+            diff->freed_block_count++;
+            diff->freed_memory_usage += old_block->estimated_size;
+        }
+        if (new_block) {
+            new_blocks[diff->new_block_count++] = *new_block;
+            diff->new_memory_usage += new_block->estimated_size;
+            call_sites[new_block->call_site_id].new_size += snapshot_block_count(new_block);
+            call_sites[new_block->call_site_id].new_memory_usage += new_block->estimated_size;
+        }
+    }
+    for (i = 0; i < before->block_count; ++i) {
+        call_sites[before->blocks[i].call_site_id].before_size += snapshot_block_count(&before->blocks[i]);
+        call_sites[before->blocks[i].call_site_id].before_memory_usage += before->blocks[i].estimated_size;
+    }
+    for (j = 0; j < after->block_count; ++j) {
+        call_sites[after->blocks[j].call_site_id].after_size += snapshot_block_count(&after->blocks[j]);
+        call_sites[after->blocks[j].call_site_id].after_memory_usage += after->blocks[j].estimated_size;
+    }
+
+    // Only the call sites with new or freed blocks are kept, moved to the front of the table
+    size_t count = 0;
+    for (size_t id = 0; id < call_site_limit; ++id) {
+        CallSiteGrowth* growth = &call_sites[id];
+        size_t kept_size = growth->after_size - growth->new_size;
+        if (growth->new_size != 0 || growth->before_size != kept_size) {
+            growth->call_site_id = id;
+            call_sites[count++] = *growth;
+        }
+    }
+    qsort(call_sites, count, sizeof(CallSiteGrowth), call_site_growth_compare);
+    diff->call_sites = call_sites;
+    diff->call_site_count = count;
+    diff->new_blocks = new_blocks;
+    return true;
+}
+
+void ansi_c_mem_track_free_snapshot_diff(HeapSnapshotDiff* diff) {
+    free(diff->call_sites);
+    free(diff->new_blocks);
+    memset(diff, 0, sizeof(HeapSnapshotDiff));
+}
+
+bool ansi_c_mem_track_print_snapshot_diff(const char* file_name, const HeapSnapshotDiff* diff, size_t max_entries) {
+    size_t line_size = 512;
+    size_t count = diff->call_site_count < max_entries ? diff->call_site_count : max_entries;
+    char* text = (char*)malloc(line_size * (count ? count : 1) + 1);
+    if (!text) {
+        return false;
+    }
+    size_t length = 0;
+    text[0] = '\0';
+    for (size_t i = 0; i < count; ++i) {
+        const CallSiteGrowth* growth = &diff->call_sites[i];
+        const CallSite* call_site = ansi_c_mem_track_get_call_site(growth->call_site_id);
+        char line[16] = "";
+        if (call_site && call_site->line) {
+            snprintf(line, sizeof(line), ":%u", call_site->line);
+        }
+        int written = snprintf(text + length, line_size,
+            "                             %+ld bytes in %+ld blocks, %lu bytes in %lu new blocks: %s%s %s %s\n",
+            call_site_growth(growth), (long)(growth->after_size - growth->before_size),
+            (unsigned long)growth->new_memory_usage, (unsigned long)growth->new_size,
+            call_site && call_site->file_name ? call_site->file_name : "(unknown)", line,
+            call_site && call_site->comment ? call_site->comment : "", call_site && call_site->type ? call_site->type : "");
+        if (written < 0) {
+            text[length] = '\0';
+            continue;
+        }
+        if ((size_t)written >= line_size) {
+            // A line that does not fit is cut
+            written = (int)line_size - 1;
+            text[length + written - 1] = '\n';
+        }
+        length += (size_t)written;
+    }
+    bool result = ansi_c_mem_track_log_write(file_name,
+        "[MEMORY] Heap growth: %lu bytes in %lu new blocks, %lu bytes in %lu freed blocks, top %lu call sites:\n%s",
+        (unsigned long)diff->new_memory_usage, (unsigned long)diff->new_block_count,
+        (unsigned long)diff->freed_memory_usage, (unsigned long)diff->freed_block_count, (unsigned long)max_entries, text);
+    free(text);
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef ANSI_C_MEM_TRACK_SNAPSHOT_H
+#define ANSI_C_MEM_TRACK_SNAPSHOT_H
+
+/**
+ * @file ansi_c_mem_track_snapshot.h
+ * @brief Heap snapshots and their differences, to find the call sites whose memory usage keeps growing.
+ *
+ * A snapshot is collected by `ansi_c_mem_track_visit_blocks` into an array of (address, size, call site) triples,
+ * which is sorted by address with a least significant digit radix sort; the digits that all addresses share are
+ * skipped, so the heap addresses of a process usually take four or five passes. Two snapshots are compared in one
+ * merge of their arrays, and the growth is summed per call site in a table indexed by the call site ID, so a
+ * difference also takes linear time. The memory of the snapshots is allocated with the system malloc and is not
+ * tracked.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @brief The width of a digit of the radix sort, in bits.
+ */
+#define SNAPSHOT_RADIX_BITS 8
+#define SNAPSHOT_RADIX_SIZE (1 << SNAPSHOT_RADIX_BITS)
+#define SNAPSHOT_RADIX_DIGITS ((sizeof(void*) * 8 + SNAPSHOT_RADIX_BITS - 1) / SNAPSHOT_RADIX_BITS)
+
+/**
+ * @brief The number of blocks a snapshot has room for beyond the current block count, so blocks allocated while
+ * it is taken rarely make it grow.
+ */
+#define SNAPSHOT_CAPACITY_SLACK 1024
+
+#endif // ANSI_C_MEM_TRACK_SNAPSHOT_H
@@ -0,0 +1,242 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ansi_c_mem_track_stack.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_BACKTRACE
+
+#ifdef _WIN32
+#include <windows.h>
+#elif !defined(ANSI_C_MEM_TRACK_BACKTRACE_FRAME_POINTERS)
+#include <execinfo.h>
+#endif
+
+#if (ANSI_C_MEM_TRACK_BACKTRACE_DEPTH) < 1 || (ANSI_C_MEM_TRACK_BACKTRACE_DEPTH) > 64
+#error ANSI_C_MEM_TRACK_BACKTRACE_DEPTH must be between 1 and 64
+#endif
+
+#define STACK_LIMIT ((size_t)STACK_PAGE_SIZE * STACK_PAGE_COUNT)
+#define STACK_INDEX_INITIAL_CAPACITY 1024
+
+/**
+ * @brief The frame pointer walk stops at a frame further than this from the previous one, which cannot be a
+ * frame of the same stack.
+ */
+#define STACK_FRAME_DISTANCE_LIMIT (1024 * 1024)
+
+/**
+ * @brief An interned stack.
+ */
+typedef struct {
+    size_t hash;  /**< The hash of the frames. */
+    size_t depth; /**< The number of frames. */
+    void* frames[ANSI_C_MEM_TRACK_BACKTRACE_DEPTH]; /**< The return addresses, the innermost first. */
+} Stack;
+
+/*
+ * The stacks are stored in pages that never move, so a stack is read by its ID without the lock once the count
+ * that publishes it is read. The index maps the hashes to the IDs by open addressing; it is searched under the
+ * read lock and grows under the write lock. The ID 0 means no stack.
+ */
+static Stack* stack_pages[STACK_PAGE_COUNT];
+static size_t stack_count = 1;
+static size_t* stack_index = NULL; /**< The IDs of the stacks, 0 for an empty entry. */
+static size_t stack_index_capacity = 0;
+static RWLOCK_TYPE stack_lock = RWLOCK_STATIC_INIT;
+
+static Stack* stack_at(size_t id) {
+    return &stack_pages[id / STACK_PAGE_SIZE][id % STACK_PAGE_SIZE];
+}
+
+static size_t stack_hash(void* const* frames, size_t depth) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < depth; ++i) {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return (size_t)hash;
+}
+
+/**
+ * @brief Finds a stack in the index. The caller must hold the lock.
+ *
+ * @return The ID of the stack, or 0 if it is not interned.
+ */
+static size_t stack_find(size_t hash, void* const* frames, size_t depth) {
+    if (!stack_index) {
+        return 0;
+    }
+    size_t mask = stack_index_capacity - 1;
+    for (size_t position = hash & mask; stack_index[position]; position = (position + 1) & mask) {
+        const Stack* stack = stack_at(stack_index[position]);
+        if (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(void*)) == 0) {
+            return stack_index[position];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Doubles the index, or creates it. The caller must hold the write lock.
+ */
+static bool stack_index_grow(void) {
+    size_t capacity = stack_index_capacity ? stack_index_capacity * 2 : STACK_INDEX_INITIAL_CAPACITY;
+    size_t* index = (size_t*)calloc(capacity, sizeof(size_t));
+    if (!index) {
+        return false;
+    }
+    for (size_t i = 0; i < stack_index_capacity; ++i) {
+        if (stack_index[i]) {
+            size_t position = stack_at(stack_index[i])->hash & (capacity - 1);
+            while (index[position]) {
+                position = (position + 1) & (capacity - 1);
+            }
+            index[position] = stack_index[i];
+        }
+    }
+    free(stack_index);
+    stack_index = index;
+    stack_index_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Adds a stack that is not interned yet. The caller must hold the write lock.
+ *
+ * @return The ID of the stack, or 0 if the table is full or an allocation failed.
+ */
+static size_t stack_add(size_t hash, void* const* frames, size_t depth) {
+    size_t id = stack_count;
+    if (id >= STACK_LIMIT) {
+        return 0;
+    }
+    // The index is kept at most half full
+    if ((id + 1) * 2 > stack_index_capacity && !stack_index_grow()) {
+        return 0;
+    }
+    Stack** page = &stack_pages[id / STACK_PAGE_SIZE];
+    if (!*page) {
+        *page = (Stack*)calloc(STACK_PAGE_SIZE, sizeof(Stack));
+        if (!*page) {
+            return 0;
+        }
+    }
+    Stack* stack = stack_at(id);
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(void*));
+    size_t position = hash & (stack_index_capacity - 1);
+    while (stack_index[position]) {
+        position = (position + 1) & (stack_index_capacity - 1);
+    }
+    stack_index[position] = id;
+    // Published last, so that ansi_c_mem_track_stack_get can read the stack without the lock
+    ATOMIC_STORE(&stack_count, id + 1);
+    return id;
+}
+
+size_t ansi_c_mem_track_stack_capture(void) {
+    // The frames are captured here and not in a helper function, so the first frame is always the caller
+    void* frames[ANSI_C_MEM_TRACK_BACKTRACE_DEPTH];
+    size_t depth = 0;
+#if defined(_WIN32)
+    depth = CaptureStackBackTrace(1, ANSI_C_MEM_TRACK_BACKTRACE_DEPTH, frames, NULL);
+#elif defined(ANSI_C_MEM_TRACK_BACKTRACE_FRAME_POINTERS)
+    // Every frame starts with the frame pointer of its caller, followed by the return address into the caller.
+    // The stack grows down, so a frame pointer that does not move up, or moves too far, ends the walk.
+    void** frame = (void**)__builtin_frame_address(0);
+    while (frame && frame[1] && depth < ANSI_C_MEM_TRACK_BACKTRACE_DEPTH) {
+        void** next = (void**)frame[0];
+        frames[depth++] = frame[1];
+        if (next <= frame || (size_t)((char*)next - (char*)frame) > STACK_FRAME_DISTANCE_LIMIT
+            || ((uintptr_t)next & (sizeof(void*) - 1)) != 0) {
+            break;
+        }
+        frame = next;
+    }
+#else
+    void* buffer[ANSI_C_MEM_TRACK_BACKTRACE_DEPTH + 1];
+    int count = backtrace(buffer, ANSI_C_MEM_TRACK_BACKTRACE_DEPTH + 1);
+    if (count > 1) {
+        depth = (size_t)count - 1;
+        memcpy(frames, buffer + 1, depth * sizeof(void*));
+    }
+#endif
+    if (depth == 0) {
+        return 0;
+    }
+    size_t hash = stack_hash(frames, depth);
+
+    // Most stacks repeat, so they are found under the read lock
+    RWLOCK_READ_LOCK(&stack_lock);
+    size_t id = stack_find(hash, frames, depth);
+    RWLOCK_READ_UNLOCK(&stack_lock);
+    if (id) {
+        return id;
+    }
+    RWLOCK_WRITE_LOCK(&stack_lock);
+    id = stack_find(hash, frames, depth);
+    if (!id) {
+        id = stack_add(hash, frames, depth);
+    }
+    RWLOCK_WRITE_UNLOCK(&stack_lock);
+    return id;
+}
+
+size_t ansi_c_mem_track_stack_get(size_t stack_id, void** frames, size_t max_frames) {
+    if (stack_id == 0 || stack_id >= ATOMIC_LOAD(&stack_count)) {
+        return 0;
+    }
+    const Stack* stack = stack_at(stack_id);
+    size_t depth = stack->depth < max_frames ? stack->depth : max_frames;
+    memcpy(frames, stack->frames, depth * sizeof(void*));
+    return depth;
+}
+
+char* ansi_c_mem_track_stack_format(size_t stack_id) {
+    void* frames[ANSI_C_MEM_TRACK_BACKTRACE_DEPTH];
+    size_t depth = ansi_c_mem_track_stack_get(stack_id, frames, ANSI_C_MEM_TRACK_BACKTRACE_DEPTH);
+    if (depth == 0) {
+        return NULL;
+    }
+    size_t line_size = 256;
+    char* text = (char*)malloc(depth * line_size + 1);
+    if (!text) {
+        return NULL;
+    }
+    size_t length = 0;
+    text[0] = '\0';
+#if defined(_WIN32) || defined(ANSI_C_MEM_TRACK_BACKTRACE_FRAME_POINTERS)
+    // Without the symbol handler of the platform the addresses are printed for an external symbolizer
+    for (size_t i = 0; i < depth; ++i) {
+        length += (size_t)snprintf(text + length, line_size, "                             #%lu %p\n",
+            (unsigned long)i, frames[i]);
+    }
+#else
+    char** symbols = backtrace_symbols(frames, (int)depth);
+    for (size_t i = 0; i < depth; ++i) {
+        int written = snprintf(text + length, line_size, "                             #%lu %s\n", (unsigned long)i,
+            symbols ? symbols[i] : "?");
+        if (written < 0) {
+            text[length] = '\0';
+            continue;
+        }
+        if ((size_t)written >= line_size) {
+            // A line that does not fit is cut
+            written = (int)line_size - 1;
+            text[length + written - 1] = '\n';
+        }
+        length += (size_t)written;
+    }
+    free(symbols);
+#endif
+    return text;
+}
+
+#endif // ANSI_C_MEM_TRACK_BACKTRACE
@@ -0,0 +1,52 @@
+#ifndef ANSI_C_MEM_TRACK_STACK_H
+#define ANSI_C_MEM_TRACK_STACK_H
+
+/**
+ * @file ansi_c_mem_track_stack.h
+ * @brief Call stacks of the allocations, used when ANSI_C_MEM_TRACK_BACKTRACE is defined.
+ *
+ * The return addresses of up to ANSI_C_MEM_TRACK_BACKTRACE_DEPTH frames are captured when a block is tracked and
+ * interned in a stack table, so every distinct stack is stored once and a block keeps only its ID. The table is
+ * shared by all threads, grows in pages that never move, and lives until the process exits, so stack IDs stay
+ * valid across `ansi_c_mem_track_deinit`. Addresses are turned into names only when a stack is printed.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @brief The number of frames captured at most, which bounds the cost of a capture.
+ */
+#ifndef ANSI_C_MEM_TRACK_BACKTRACE_DEPTH
+#define ANSI_C_MEM_TRACK_BACKTRACE_DEPTH 16
+#endif
+
+#define STACK_PAGE_SIZE 256
+#define STACK_PAGE_COUNT 1024
+
+/**
+ * @brief Captures the call stack of the caller and interns it.
+ *
+ * @return The ID of the stack, or 0 if no frame could be captured or the stack table is full.
+ */
+size_t ansi_c_mem_track_stack_capture(void);
+
+/**
+ * @brief Copies the frames of an interned stack, the innermost frame first.
+ *
+ * @param stack_id The ID of the stack.
+ * @param frames Receives the return addresses.
+ * @param max_frames The number of frames to copy at most.
+ * @return The number of frames copied, 0 if there is no stack with the given ID.
+ */
+size_t ansi_c_mem_track_stack_get(size_t stack_id, void** frames, size_t max_frames);
+
+/**
+ * @brief Formats an interned stack with the names of its frames, one line each.
+ *
+ * @return The text, which the caller must free, or NULL if there is no stack with the given ID or the allocation
+ * failed.
+ */
+char* ansi_c_mem_track_stack_format(size_t stack_id);
+
+#endif // ANSI_C_MEM_TRACK_STACK_H
@@ -0,0 +1,321 @@
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "ansi_c_mem_track_trace.h"
+#include "../include/ansi_c_macro_utils.h"
+
+#ifdef ANSI_C_MEM_TRACK_TRACE
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The time stamp counter is read in a few cycles, a system clock call costs several times the rest of an event
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_TSC
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TRACE_TSC
+#endif
+
+/**
+ * @brief The time the frequency of the time stamp counter is measured for when tracing starts.
+ */
+#define TRACE_CALIBRATION_NS 10000000ULL
+
+/**
+ * @brief A mapped trace file.
+ */
+typedef struct {
+#ifdef _WIN32
+    HANDLE file;    /**< The file. */
+    HANDLE mapping; /**< The mapping object of the file. */
+#else
+    int file;       /**< The file descriptor. */
+#endif
+    char* view;     /**< The mapped file, NULL if no file is open. */
+    size_t size;    /**< The size of the file. */
+} TraceFile;
+
+/*
+ * A thread appends an event by claiming its space with an atomic addition to the offset, and counts the bytes as
+ * committed when it has copied the event. The thread whose claim ends up exactly at the capacity rotates: it waits
+ * until all claimed space is committed, maps the next file, resets the offsets and bumps the generation. Threads
+ * that claimed past the capacity meanwhile wait for the new generation and claim again.
+ */
+static struct {
+    char padding_front[64];
+    size_t offset;    /**< The next byte to be claimed in the events area of the current file. */
+    char padding_middle[64];
+    size_t committed; /**< The number of bytes of completely written events in the current file. */
+    char padding_back[64];
+} trace_positions;
+static char* trace_events = NULL;
+static size_t trace_capacity = 0;
+static size_t trace_generation = 0;
+static bool trace_running = false;
+static TraceFile trace_file;
+static char* trace_file_name = NULL;
+static size_t trace_file_count = 0;
+static uint64_t trace_sequence = 0;
+static uint64_t trace_start_time = 0;
+static uint64_t trace_start_clock = 0;
+static uint64_t trace_clock_frequency = 1000000000ULL;
+static MUTEX_TYPE trace_lock = MUTEX_STATIC_INIT;
+static size_t trace_thread_count = 0;
+static THREAD_LOCAL size_t trace_thread_id = 0;
+
+/**
+ * @brief Returns a monotonic time in nanoseconds.
+ */
+static uint64_t trace_clock_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+    return ticks / ticks_per_second * 1000000000ULL + ticks % ticks_per_second * 1000000000ULL / ticks_per_second;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Returns the timestamp of an event, in ticks of trace_clock_frequency.
+ */
+static uint64_t trace_clock(void) {
+#ifdef TRACE_TSC
+    return (uint64_t)__rdtsc();
+#else
+    return trace_clock_ns();
+#endif
+}
+
+/**
+ * @brief Measures the number of trace_clock ticks per second.
+ */
+static uint64_t trace_clock_calibrate(void) {
+#ifdef TRACE_TSC
+    uint64_t start_ns = trace_clock_ns();
+    uint64_t start_ticks = trace_clock();
+    uint64_t elapsed_ns;
+    do {
+        elapsed_ns = trace_clock_ns() - start_ns;
+    } while (elapsed_ns < TRACE_CALIBRATION_NS);
+    return (trace_clock() - start_ticks) * 1000000000ULL / elapsed_ns;
+#else
+    return 1000000000ULL;
+#endif
+}
+
+static bool trace_file_open(TraceFile* file, const char* file_name, size_t size) {
+#ifdef _WIN32
+    file->file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    file->view = file->mapping ? (char*)MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+    if (!file->view) {
+        if (file->mapping) {
+            CloseHandle(file->mapping);
+        }
+        CloseHandle(file->file);
+        return false;
+    }
+#else
+    file->file = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file->file < 0) {
+        return false;
+    }
+    // The file is truncated first, so its unused space reads as zero, which is TRACE_OP_NONE. Allocating its blocks
+    // up front keeps the file system out of the page faults of the events.
+    bool sized = posix_fallocate(file->file, 0, (off_t)size) == 0 || ftruncate(file->file, (off_t)size) == 0;
+    void* view = sized ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->file, 0) : MAP_FAILED;
+    if (view == MAP_FAILED) {
+        close(file->file);
+        return false;
+    }
+    file->view = (char*)view;
+#endif
+    file->size = size;
+    return true;
+}
+
+/**
+ * @brief Stores the number of events in the header of the file and closes it.
+ */
+static void trace_file_close(TraceFile* file, uint64_t event_count) {
+    if (!file->view) {
+        return;
+    }
+    ((TraceFileHeader*)file->view)->event_count = event_count;
+#ifdef _WIN32
+    UnmapViewOfFile(file->view);
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    munmap(file->view, file->size);
+    close(file->file);
+#endif
+    file->view = NULL;
+}
+
+/**
+ * @brief Opens the next file of the rotation, overwriting the oldest one, and writes its header.
+ */
+static bool trace_open_next(void) {
+    size_t name_size = strlen(trace_file_name) + 24;
+    char* name = (char*)malloc(name_size);
+    if (!name) {
+        return false;
+    }
+    snprintf(name, name_size, "%s.%lu", trace_file_name, (unsigned long)(trace_sequence % trace_file_count));
+    bool opened = trace_file_open(&trace_file, name, sizeof(TraceFileHeader) + trace_capacity);
+    free(name);
+    if (!opened) {
+        return false;
+    }
+
+    TraceFileHeader* header = (TraceFileHeader*)trace_file.view;
+    memcpy(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_FILE_VERSION;
+    header->event_size = (uint32_t)sizeof(TraceEvent);
+    header->sequence = trace_sequence++;
+    header->event_count = 0;
+    header->start_time = trace_start_time;
+    header->clock_frequency = trace_clock_frequency;
+    ATOMIC_STORE_PTR(&trace_events, trace_file.view + sizeof(TraceFileHeader));
+    return true;
+}
+
+/**
+ * @brief Replaces the full file with the next one. Called by the thread whose claim ended at the capacity.
+ */
+static void trace_rotate(void) {
+    // The threads that claimed space in the full file finish their events first
+    while (ATOMIC_LOAD(&trace_positions.committed) != trace_capacity) {
+        THREAD_YIELD();
+    }
+    trace_file_close(&trace_file, trace_capacity / sizeof(TraceEvent));
+    if (trace_open_next()) {
+        ATOMIC_STORE(&trace_positions.committed, 0);
+        ATOMIC_STORE(&trace_positions.offset, 0);
+    }
+    else {
+        ATOMIC_STORE_BOOL(&trace_running, false);
+    }
+    ATOMIC_STORE(&trace_generation, trace_generation + 1);
+}
+
+bool ansi_c_mem_track_trace_start(const char* file_name, size_t file_size, size_t file_count) {
+    if (!file_name || file_count == 0 || file_size < sizeof(TraceFileHeader) + sizeof(TraceEvent)) {
+        return false;
+    }
+    MUTEX_LOCK(&trace_lock);
+    // A trace that stopped because a file could not be created still has to be stopped explicitly
+    if (trace_file_name) {
+        MUTEX_UNLOCK(&trace_lock);
+        return false;
+    }
+    size_t name_size = strlen(file_name) + 1;
+    trace_file_name = (char*)malloc(name_size);
+    if (!trace_file_name) {
+        MUTEX_UNLOCK(&trace_lock);
+        return false;
+    }
+    memcpy(trace_file_name, file_name, name_size);
+    trace_file_count = file_count;
+    trace_sequence = 0;
+    // The capacity is a multiple of the event size, so the claim that reaches it is the first one that does not fit
+    trace_capacity = (file_size - sizeof(TraceFileHeader)) / sizeof(TraceEvent) * sizeof(TraceEvent);
+    trace_clock_frequency = trace_clock_calibrate();
+    trace_start_time = (uint64_t)time(NULL) * 1000000000ULL;
+    trace_start_clock = trace_clock();
+
+    bool started = trace_open_next();
+    if (started) {
+        trace_positions.offset = 0;
+        trace_positions.committed = 0;
+        ATOMIC_STORE(&trace_generation, trace_generation + 1);
+        ATOMIC_STORE_BOOL(&trace_running, true);
+    }
+    else {
+        free(trace_file_name);
+        trace_file_name = NULL;
+    }
+    MUTEX_UNLOCK(&trace_lock);
+    return started;
+}
+
+void ansi_c_mem_track_trace_stop(void) {
+    MUTEX_LOCK(&trace_lock);
+    if (trace_file_name) {
+        ATOMIC_STORE_BOOL(&trace_running, false);
+        size_t committed = ATOMIC_LOAD(&trace_positions.committed);
+        trace_file_close(&trace_file, committed / sizeof(TraceEvent));
+        free(trace_file_name);
+        trace_file_name = NULL;
+    }
+    MUTEX_UNLOCK(&trace_lock);
+}
+
+void ansi_c_mem_track_trace_event(TraceOp op, const void* address, const void* old_address, size_t size,
+    size_t call_site_id, size_t object_id) {
+    if (!ATOMIC_LOAD_BOOL(&trace_running)) {
+        return;
+    }
+    if (trace_thread_id == 0) {
+        trace_thread_id = ATOMIC_FETCH_ADD(&trace_thread_count, 1) + 1;
+    }
+    TraceEvent event;
+    event.timestamp = trace_clock() - trace_start_clock;
+    event.address = (uint64_t)(uintptr_t)address;
+    event.old_address = (uint64_t)(uintptr_t)old_address;
+    event.size = (uint64_t)size;
+    event.object_id = (uint64_t)object_id;
+    event.call_site_id = (uint32_t)call_site_id;
+    event.thread_id = (uint16_t)(trace_thread_id - 1);
+    event.op = (uint8_t)op;
+    event.reserved = 0;
+
+    for (;;) {
+        size_t generation = ATOMIC_LOAD(&trace_generation);
+        size_t offset = ATOMIC_FETCH_ADD_ORDERED(&trace_positions.offset, sizeof(TraceEvent));
+        if (offset < trace_capacity) {
+            char* events = (char*)ATOMIC_LOAD_PTR(&trace_events);
+            memcpy(events + offset, &event, sizeof(TraceEvent));
+            (void)ATOMIC_FETCH_ADD_ORDERED(&trace_positions.committed, sizeof(TraceEvent));
+            return;
+        }
+        if (offset == trace_capacity) {
+            trace_rotate();
+        }
+        else {
+            while (ATOMIC_LOAD(&trace_generation) == generation) {
+                THREAD_YIELD();
+            }
+        }
+        if (!ATOMIC_LOAD_BOOL(&trace_running)) {
+            return;
+        }
+    }
+}
+
+#endif // ANSI_C_MEM_TRACK_TRACE
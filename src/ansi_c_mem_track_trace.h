@@ -0,0 +1,83 @@
+#ifndef ANSI_C_MEM_TRACK_TRACE_H
+#define ANSI_C_MEM_TRACK_TRACE_H
+
+/**
+ * @file ansi_c_mem_track_trace.h
+ * @brief Binary allocation trace of the memory tracker, used when ANSI_C_MEM_TRACK_TRACE is defined.
+ *
+ * Every tracked allocation event is appended as a fixed-size TraceEvent to a memory-mapped trace file. The trace
+ * rotates over `file_count` files named `<file_name>.0`, `<file_name>.1`, ..., and overwrites the oldest one when
+ * all are full. Every file starts with a TraceFileHeader, the sequence numbers of the headers give the order of the
+ * files. The events are stored in the byte order of the host.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_FILE_MAGIC "AMTTRACE"
+#define TRACE_FILE_VERSION 1
+
+/**
+ * @brief The operations recorded in the trace.
+ */
+typedef enum {
+    TRACE_OP_NONE = 0,           /**< Unused space at the end of a file that was not closed. */
+    TRACE_OP_MALLOC = 1,         /**< A block was allocated. */
+    TRACE_OP_REALLOC = 2,        /**< A block was resized, `old_address` is its previous address. */
+    TRACE_OP_FREE = 3,           /**< A block was freed. */
+    TRACE_OP_FREE_OBJECT_ID = 4  /**< `ansi_c_mem_track_free_by_object_id` was called, the FREE events of its blocks follow. */
+} TraceOp;
+
+/**
+ * @brief Header at the start of every trace file, 64 bytes.
+ */
+typedef struct {
+    char magic[8];          /**< TRACE_FILE_MAGIC, without the terminating zero. */
+    uint32_t version;       /**< TRACE_FILE_VERSION. */
+    uint32_t event_size;    /**< sizeof(TraceEvent). */
+    uint64_t sequence;      /**< The number of the file since the trace started. */
+    uint64_t event_count;   /**< The number of events in the file, 0 while the file is written. */
+    uint64_t start_time;    /**< The wall clock time when the trace started, in nanoseconds since the Unix epoch. */
+    uint64_t clock_frequency; /**< The number of timestamp ticks per second. */
+    uint64_t reserved[2];
+} TraceFileHeader;
+
+/**
+ * @brief An allocation event, 48 bytes.
+ */
+typedef struct {
+    uint64_t timestamp;     /**< Clock ticks since the trace started, see TraceFileHeader::clock_frequency. */
+    uint64_t address;       /**< The address of the block. */
+    uint64_t old_address;   /**< The address before a realloc, otherwise 0. */
+    uint64_t size;          /**< The size of the block, the new size for a realloc. */
+    uint64_t object_id;     /**< The object ID of the block. */
+    uint32_t call_site_id;  /**< The call site of the allocation, 0 if unknown. */
+    uint16_t thread_id;     /**< The number of the thread in the order the threads started to trace. */
+    uint8_t op;             /**< The TraceOp. */
+    uint8_t reserved;
+} TraceEvent;
+
+/**
+ * @brief Creates the first trace file and starts tracing.
+ *
+ * @param file_name The base name of the trace files.
+ * @param file_size The size of each file in bytes.
+ * @param file_count The number of files to rotate over.
+ * @return true if tracing started, false if it was not stopped since the last start or the file could not be
+ * created.
+ */
+bool ansi_c_mem_track_trace_start(const char* file_name, size_t file_size, size_t file_count);
+
+/**
+ * @brief Stops tracing and closes the trace file. Must not run concurrently with tracked operations.
+ */
+void ansi_c_mem_track_trace_stop(void);
+
+/**
+ * @brief Appends an event to the trace if tracing runs.
+ */
+void ansi_c_mem_track_trace_event(TraceOp op, const void* address, const void* old_address, size_t size,
+    size_t call_site_id, size_t object_id);
+
+#endif // ANSI_C_MEM_TRACK_TRACE_H